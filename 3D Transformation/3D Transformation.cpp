@@ -1,12 +1,55 @@
 #include <glut.h>
+#include <freeglut_ext.h>
 #include <vector>   
 #include <string>   
 #include <stack>
 #include <iostream> 
 #include <stdlib.h> 
+#include <stdio.h>
+#include <ctype.h>
 #include <math.h>   
-
-#define M_PI 3.14159265358979323846
+#include <stddef.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+
+// Memory mapping, file stamps and peak RSS for the mesh importer and cache
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "psapi.lib")
+#endif
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Headless rendering (--headless) needs EGL, so it is only compiled in when
+// building with -DHEADLESS_EGL and linking -lEGL (Linux, e.g. Mesa llvmpipe).
+#ifdef HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// Transform math, meshes and instances; no GL or GLUT
+#include "Geometry.h"
+#include "AllocationCounter.h"
 
 enum TransformationMode {
     TRANSLATE,
@@ -15,24 +58,15 @@ enum TransformationMode {
     SHEAR,
     REFLECT
 };
+const int transformationModeCount = 5;
 
-// Global transformation matrix using 2D array
-float transformMatrix[4][4] = {
-    {1, 0, 0, 0},
-    {0, 1, 0, 0},
-    {0, 0, 1, 0},
-    {0, 0, 0, 1}
-};
-
-// Global position, rotation, scale variables
-float position[3] = { 0.0f, 0.0f, 0.0f };
-float rotation[3] = { 0.0f, 0.0f, 0.0f };
-float scale[3] = { 1.0f, 1.0f, 1.0f };
-float shear[3] = { 0.0f, 0.0f, 0.0f };
-bool reflection[3] = { false, false, false }; // For x, y, z planes
+// Quaternion rotation ('o' or --quaternion): ROTATE keys turn a quaternion
+// and rotation[] only mirrors it. Saved orientations play back with slerp.
+bool quaternionRotation = false;
+int savedOrientationCount = 0;
+bool orientationPlayback = false;
 
 // Shape selection
-enum Shape { CUBE, SPHERE, PYRAMID, CYLINDER };
 Shape currentShape = CUBE;
 TransformationMode currentMode = TRANSLATE;  // Default mode
 
@@ -40,264 +74,1041 @@ float cameraPos[] = { 0.0f, 0.0f, 5.0f };  // Initial camera position
 float cameraFront[] = { 0.0f, 0.0f, -1.0f };  // Camera direction
 float cameraUp[] = { 0.0f, 1.0f, 0.0f };      // Camera up vector
 bool cameraControlMode = false;                // Toggle for camera control
-float cameraSpeed = 0.1f;                      // Camera movement speed
-
-struct Button {
-    float x, y, width, height;
-    std::string label;
-    bool isShapeButton;
-    union {
-        Shape shape;
-        TransformationMode mode;
-    };
-    bool selected;
-
-    // Constructor for shape buttons
-    Button(float _x, float _y, float _w, float _h, const std::string& _label, bool _isShape, Shape _shape, bool _selected)
-        : x(_x), y(_y), width(_w), height(_h), label(_label), isShapeButton(_isShape), selected(_selected) {
-        shape = _shape;
-    }
+float cameraSpeed = 3.0f;                      // Camera movement speed, units per second
+
+bool instanceMode = false;  // Many independent instances (--instances)
+bool sceneMode = false;     // Scene graph, keyboard edits the selected node (--scene)
+
+// Offscreen rendering without a window (--headless). GLUT is never
+// initialised in this mode, so window queries, buffer swaps and GL entry
+// point lookups go through the wrappers below.
+bool headless = false;
+bool softwareRaster = false;  // Single-shape view drawn by the CPU rasterizer (--software)
+int rasterThreads = 0;        // 0 = one per hardware thread (--threads)
+bool corePipeline = false;    // 3D pass through VAOs, a UBO and GLSL 330 (--core)
+bool useInputThread = false;  // Apply input off the GLUT thread (--input-thread)
+int rasterBenchFrames = 0;    // Frames per thread count for --raster-bench
+int headlessWidth = 1280;
+int headlessHeight = 720;
+int headlessFrames = 1;
+std::string headlessOutput;  // Image file prefix, no images when empty
+
+int windowWidth() {
+    return headless ? headlessWidth : glutGet(GLUT_WINDOW_WIDTH);
+}
 
-    // Constructor for transformation mode buttons
-    Button(float _x, float _y, float _w, float _h, const std::string& _label, bool _isShape, TransformationMode _mode, bool _selected)
-        : x(_x), y(_y), width(_w), height(_h), label(_label), isShapeButton(_isShape), selected(_selected) {
-        mode = _mode;
-    }
+int windowHeight() {
+    return headless ? headlessHeight : glutGet(GLUT_WINDOW_HEIGHT);
+}
 
-    Button(float _x, float _y, float _w, float _h, const std::string& _label, bool _selected = false)
-        : x(_x), y(_y), width(_w), height(_h), label(_label), selected(_selected) {}
+// HUD widgets. A widget's ID is its index in widgetRegistry.widgets and
+// stays fixed once registered; what a click does is a tagged action, and
+// the label is only ever drawn. Clicks are resolved through a uniform grid
+// over the widget rectangles, and each selection group keeps an ID table,
+// so neither hit-testing nor highlighting scans the whole list.
+enum WidgetAction {
+    WIDGET_SELECT_SHAPE,   // value is a Shape
+    WIDGET_SELECT_MODE,    // value is a TransformationMode
+    WIDGET_TOGGLE_CAMERA
 };
 
-std::vector<Button> buttons;
+struct Widget {
+    float x, y, width, height;  // Window pixels, y up from the bottom
+    std::string label;
+    WidgetAction action;
+    int value;
+    bool selected;
+};
 
+const float widgetCellSize = 64.0f;
+
+struct WidgetRegistry {
+    std::vector<Widget> widgets;
+    int shapeWidgets[shapeTypeCount];  // ID per Shape, -1 if it has no button
+    int modeWidgets[transformationModeCount];
+    int cameraWidget = -1;
+    // Widgets overlapping cell c are cellWidgets[cellStart[c] .. cellStart[c + 1]), in ID order
+    float originX = 0.0f, originY = 0.0f;
+    int columns = 0, rows = 0;
+    std::vector<int> cellStart;
+    std::vector<int> cellWidgets;
+    unsigned int revision = 0;  // Bumped by every change drawButtons() would show
+};
 
-void matrixIdentity(float matrix[4][4]) {
+WidgetRegistry widgetRegistry;
+
+void clearWidgets() {
+    WidgetRegistry& r = widgetRegistry;
+    r.widgets.clear();
+    for (int i = 0; i < shapeTypeCount; i++) r.shapeWidgets[i] = -1;
+    for (int i = 0; i < transformationModeCount; i++) r.modeWidgets[i] = -1;
+    r.cameraWidget = -1;
+    r.cellStart.clear();
+    r.cellWidgets.clear();
+    r.revision++;
+}
 
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            matrix[i][j] = (i == j) ? 1.0f : 0.0f;
-        }
+// Returns the new widget's ID. Call buildWidgetGrid() once all are added.
+int addWidget(float x, float y, float width, float height, const char* label, WidgetAction action, int value, bool selected) {
+    WidgetRegistry& r = widgetRegistry;
+    int id = (int)r.widgets.size();
+    Widget widget = { x, y, width, height, label, action, value, selected };
+    r.widgets.push_back(widget);
+    switch (action) {
+    case WIDGET_SELECT_SHAPE: r.shapeWidgets[value] = id; break;
+    case WIDGET_SELECT_MODE: r.modeWidgets[value] = id; break;
+    case WIDGET_TOGGLE_CAMERA: r.cameraWidget = id; break;
     }
+    r.revision++;
+    return id;
+}
 
+// Cell range a rectangle overlaps, clamped to the grid
+void widgetCellRange(float x0, float y0, float x1, float y1, int& c0, int& r0, int& c1, int& r1) {
+    const WidgetRegistry& r = widgetRegistry;
+    c0 = std::max(0, (int)floor((x0 - r.originX) / widgetCellSize));
+    r0 = std::max(0, (int)floor((y0 - r.originY) / widgetCellSize));
+    c1 = std::min(r.columns - 1, (int)floor((x1 - r.originX) / widgetCellSize));
+    r1 = std::min(r.rows - 1, (int)floor((y1 - r.originY) / widgetCellSize));
 }
 
-void matrixMultiply(float a[4][4], float b[4][4], float result[4][4]) {
-    float temp[4][4];
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            temp[i][j] = 0;
-            for (int k = 0; k < 4; k++) {
-                temp[i][j] += a[i][k] * b[k][j];
+void buildWidgetGrid() {
+    WidgetRegistry& r = widgetRegistry;
+    r.cellStart.clear();
+    r.cellWidgets.clear();
+    if (r.widgets.empty()) {
+        r.columns = r.rows = 0;
+        return;
+    }
+    float maxX = r.widgets[0].x, maxY = r.widgets[0].y;
+    r.originX = r.widgets[0].x;
+    r.originY = r.widgets[0].y;
+    for (const Widget& w : r.widgets) {
+        r.originX = std::min(r.originX, w.x);
+        r.originY = std::min(r.originY, w.y);
+        maxX = std::max(maxX, w.x + w.width);
+        maxY = std::max(maxY, w.y + w.height);
+    }
+    r.columns = (int)floor((maxX - r.originX) / widgetCellSize) + 1;
+    r.rows = (int)floor((maxY - r.originY) / widgetCellSize) + 1;
+
+    // Counting pass, prefix sum, then fill; widgets go in by ID so each cell stays sorted
+    r.cellStart.assign(r.columns * r.rows + 1, 0);
+    for (int pass = 0; pass < 2; pass++) {
+        std::vector<int> fill;
+        if (pass == 1) {
+            for (size_t c = 1; c < r.cellStart.size(); c++) r.cellStart[c] += r.cellStart[c - 1];
+            r.cellWidgets.resize(r.cellStart.back());
+            fill.assign(r.cellStart.begin(), r.cellStart.end() - 1);
+        }
+        for (int id = 0; id < (int)r.widgets.size(); id++) {
+            const Widget& w = r.widgets[id];
+            int c0, r0, c1, r1;
+            widgetCellRange(w.x, w.y, w.x + w.width, w.y + w.height, c0, r0, c1, r1);
+            for (int row = r0; row <= r1; row++) {
+                for (int column = c0; column <= c1; column++) {
+                    int cell = row * r.columns + column;
+                    if (pass == 0) r.cellStart[cell + 1]++;
+                    else r.cellWidgets[fill[cell]++] = id;
+                }
             }
         }
     }
-    
+}
 
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            result[i][j] = temp[i][j];
-        }
+// ID of the first widget containing (x, y), edges included, or -1
+int hitTestWidget(float x, float y) {
+    const WidgetRegistry& r = widgetRegistry;
+    if (r.columns == 0 || x < r.originX || y < r.originY) return -1;
+    int column = (int)floor((x - r.originX) / widgetCellSize);
+    int row = (int)floor((y - r.originY) / widgetCellSize);
+    if (column >= r.columns || row >= r.rows) return -1;
+    int cell = row * r.columns + column;
+    for (int i = r.cellStart[cell]; i < r.cellStart[cell + 1]; i++) {
+        const Widget& w = r.widgets[r.cellWidgets[i]];
+        if (x >= w.x && x <= w.x + w.width && y >= w.y && y <= w.y + w.height) return r.cellWidgets[i];
     }
+    return -1;
 }
 
+void setWidgetSelected(int id, bool selected) {
+    if (id < 0 || widgetRegistry.widgets[id].selected == selected) return;
+    widgetRegistry.widgets[id].selected = selected;
+    widgetRegistry.revision++;
+}
 
-void createShearMatrix(float xy, float xz, float yx, float yz, float zx, float zy, float matrix[4][4]) {
-    matrixIdentity(matrix);
-    
-    matrix[0][1] = xy;  
-    matrix[0][2] = xz;  
+// Highlights ids[current] and clears the rest of a selection group
+void selectWidgetInGroup(const int* ids, int count, int current) {
+    for (int i = 0; i < count; i++) {
+        setWidgetSelected(ids[i], i == current);
+    }
+}
 
-    
-    matrix[1][0] = yx;  
-    matrix[1][2] = yz;  
 
-    
-    matrix[2][0] = zx;  
-    matrix[2][1] = zy;  
+// OpenGL 1.5 buffer objects are not exported by opengl32.lib on Windows, so
+// they are resolved at runtime through freeglut once a context exists.
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER 0x8892
+#define GL_ELEMENT_ARRAY_BUFFER 0x8893
+#define GL_STREAM_DRAW 0x88E0
+#define GL_STATIC_DRAW 0x88E4
+#endif
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#define GL_QUERY_RESULT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+#ifndef GL_VERTEX_SHADER
+#define GL_FRAGMENT_SHADER 0x8B30
+#define GL_VERTEX_SHADER 0x8B31
+#define GL_COMPILE_STATUS 0x8B81
+#define GL_LINK_STATUS 0x8B82
+#define GL_INFO_LOG_LENGTH 0x8B84
+#endif
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER 0x8D40
+#define GL_RENDERBUFFER 0x8D41
+#define GL_COLOR_ATTACHMENT0 0x8CE0
+#define GL_DEPTH_ATTACHMENT 0x8D00
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#define GL_READ_FRAMEBUFFER 0x8CA8
+#define GL_DRAW_FRAMEBUFFER 0x8CA9
+#endif
+#ifndef GL_DEPTH_COMPONENT24
+#define GL_DEPTH_COMPONENT24 0x81A6
+#endif
+#ifndef GL_RGBA8
+#define GL_RGBA8 0x8058
+#endif
+#ifndef GL_UNIFORM_BUFFER
+#define GL_UNIFORM_BUFFER 0x8A11
+#define GL_INVALID_INDEX 0xFFFFFFFFu
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#define GL_MAP_INVALIDATE_RANGE_BIT 0x0004
+#define GL_MAP_UNSYNCHRONIZED_BIT 0x0020
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+typedef struct __GLsync* GLsync;
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#define GL_ALREADY_SIGNALED 0x911A
+#define GL_TIMEOUT_EXPIRED 0x911B
+#define GL_CONDITION_SATISFIED 0x911C
+#define GL_WAIT_FAILED 0x911D
+#endif
+
+typedef void (APIENTRY* GenBuffersProc)(GLsizei n, GLuint* buffers);
+typedef void (APIENTRY* DeleteBuffersProc)(GLsizei n, const GLuint* buffers);
+typedef void (APIENTRY* BindBufferProc)(GLenum target, GLuint buffer);
+typedef void (APIENTRY* BufferDataProc)(GLenum target, ptrdiff_t size, const void* data, GLenum usage);
+
+typedef GLuint (APIENTRY* CreateShaderProc)(GLenum type);
+typedef void (APIENTRY* ShaderSourceProc)(GLuint shader, GLsizei count, const char* const* source, const GLint* length);
+typedef void (APIENTRY* CompileShaderProc)(GLuint shader);
+typedef void (APIENTRY* GetShaderivProc)(GLuint shader, GLenum pname, GLint* params);
+typedef void (APIENTRY* GetShaderInfoLogProc)(GLuint shader, GLsizei bufSize, GLsizei* length, char* infoLog);
+typedef void (APIENTRY* DeleteShaderProc)(GLuint shader);
+typedef GLuint (APIENTRY* CreateProgramProc)(void);
+typedef void (APIENTRY* AttachShaderProc)(GLuint program, GLuint shader);
+typedef void (APIENTRY* BindAttribLocationProc)(GLuint program, GLuint index, const char* name);
+typedef void (APIENTRY* LinkProgramProc)(GLuint program);
+typedef void (APIENTRY* GetProgramivProc)(GLuint program, GLenum pname, GLint* params);
+typedef void (APIENTRY* GetProgramInfoLogProc)(GLuint program, GLsizei bufSize, GLsizei* length, char* infoLog);
+typedef void (APIENTRY* UseProgramProc)(GLuint program);
+typedef void (APIENTRY* EnableVertexAttribArrayProc)(GLuint index);
+typedef void (APIENTRY* DisableVertexAttribArrayProc)(GLuint index);
+typedef void (APIENTRY* VertexAttribPointerProc)(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer);
+typedef void (APIENTRY* VertexAttribDivisorProc)(GLuint index, GLuint divisor);
+typedef void (APIENTRY* DrawElementsInstancedProc)(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instancecount);
+
+typedef void (APIENTRY* GenVertexArraysProc)(GLsizei n, GLuint* arrays);
+typedef void (APIENTRY* BindVertexArrayProc)(GLuint array);
+typedef void (APIENTRY* BufferSubDataProc)(GLenum target, ptrdiff_t offset, ptrdiff_t size, const void* data);
+typedef void (APIENTRY* BindBufferBaseProc)(GLenum target, GLuint index, GLuint buffer);
+typedef GLuint (APIENTRY* GetUniformBlockIndexProc)(GLuint program, const char* uniformBlockName);
+typedef void (APIENTRY* UniformBlockBindingProc)(GLuint program, GLuint uniformBlockIndex, GLuint uniformBlockBinding);
+
+typedef void (APIENTRY* GenFramebuffersProc)(GLsizei n, GLuint* framebuffers);
+typedef void (APIENTRY* BindFramebufferProc)(GLenum target, GLuint framebuffer);
+typedef void (APIENTRY* FramebufferTexture2DProc)(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+typedef GLenum (APIENTRY* CheckFramebufferStatusProc)(GLenum target);
+typedef void (APIENTRY* GenRenderbuffersProc)(GLsizei n, GLuint* renderbuffers);
+typedef void (APIENTRY* BindRenderbufferProc)(GLenum target, GLuint renderbuffer);
+typedef void (APIENTRY* RenderbufferStorageProc)(GLenum target, GLenum internalformat, GLsizei width, GLsizei height);
+typedef void (APIENTRY* FramebufferRenderbufferProc)(GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer);
+typedef void (APIENTRY* BlitFramebufferProc)(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1,
+    GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter);
+
+typedef void (APIENTRY* GenQueriesProc)(GLsizei n, GLuint* ids);
+typedef void (APIENTRY* BeginQueryProc)(GLenum target, GLuint id);
+typedef void (APIENTRY* EndQueryProc)(GLenum target);
+typedef void (APIENTRY* GetQueryObjectui64vProc)(GLuint id, GLenum pname, unsigned long long* params);
+
+typedef void* (APIENTRY* MapBufferRangeProc)(GLenum target, ptrdiff_t offset, ptrdiff_t length, GLbitfield access);
+typedef GLboolean (APIENTRY* UnmapBufferProc)(GLenum target);
+typedef void (APIENTRY* BufferStorageProc)(GLenum target, ptrdiff_t size, const void* data, GLbitfield flags);
+typedef GLsync (APIENTRY* FenceSyncProc)(GLenum condition, GLbitfield flags);
+typedef GLenum (APIENTRY* ClientWaitSyncProc)(GLsync sync, GLbitfield flags, unsigned long long timeout);
+typedef void (APIENTRY* DeleteSyncProc)(GLsync sync);
+
+GenBuffersProc pglGenBuffers = NULL;
+DeleteBuffersProc pglDeleteBuffers = NULL;
+BindBufferProc pglBindBuffer = NULL;
+BufferDataProc pglBufferData = NULL;
+bool hasVertexBuffers = false;
+
+CreateShaderProc pglCreateShader = NULL;
+ShaderSourceProc pglShaderSource = NULL;
+CompileShaderProc pglCompileShader = NULL;
+GetShaderivProc pglGetShaderiv = NULL;
+GetShaderInfoLogProc pglGetShaderInfoLog = NULL;
+DeleteShaderProc pglDeleteShader = NULL;
+CreateProgramProc pglCreateProgram = NULL;
+AttachShaderProc pglAttachShader = NULL;
+BindAttribLocationProc pglBindAttribLocation = NULL;
+LinkProgramProc pglLinkProgram = NULL;
+GetProgramivProc pglGetProgramiv = NULL;
+GetProgramInfoLogProc pglGetProgramInfoLog = NULL;
+UseProgramProc pglUseProgram = NULL;
+EnableVertexAttribArrayProc pglEnableVertexAttribArray = NULL;
+DisableVertexAttribArrayProc pglDisableVertexAttribArray = NULL;
+VertexAttribPointerProc pglVertexAttribPointer = NULL;
+bool hasShaders = false;
+
+VertexAttribDivisorProc pglVertexAttribDivisor = NULL;
+DrawElementsInstancedProc pglDrawElementsInstanced = NULL;
+bool hasInstancing = false;
+
+GenVertexArraysProc pglGenVertexArrays = NULL;
+BindVertexArrayProc pglBindVertexArray = NULL;
+BufferSubDataProc pglBufferSubData = NULL;
+BindBufferBaseProc pglBindBufferBase = NULL;
+GetUniformBlockIndexProc pglGetUniformBlockIndex = NULL;
+UniformBlockBindingProc pglUniformBlockBinding = NULL;
+bool hasCoreObjects = false;
+
+GenFramebuffersProc pglGenFramebuffers = NULL;
+BindFramebufferProc pglBindFramebuffer = NULL;
+FramebufferTexture2DProc pglFramebufferTexture2D = NULL;
+CheckFramebufferStatusProc pglCheckFramebufferStatus = NULL;
+GenRenderbuffersProc pglGenRenderbuffers = NULL;
+BindRenderbufferProc pglBindRenderbuffer = NULL;
+RenderbufferStorageProc pglRenderbufferStorage = NULL;
+FramebufferRenderbufferProc pglFramebufferRenderbuffer = NULL;
+BlitFramebufferProc pglBlitFramebuffer = NULL;
+bool hasFramebuffers = false;
+
+GenQueriesProc pglGenQueries = NULL;
+BeginQueryProc pglBeginQuery = NULL;
+EndQueryProc pglEndQuery = NULL;
+GetQueryObjectui64vProc pglGetQueryObjectui64v = NULL;
+bool hasTimerQueries = false;
+
+MapBufferRangeProc pglMapBufferRange = NULL;
+UnmapBufferProc pglUnmapBuffer = NULL;
+bool hasMapBufferRange = false;
+
+BufferStorageProc pglBufferStorage = NULL;
+FenceSyncProc pglFenceSync = NULL;
+ClientWaitSyncProc pglClientWaitSync = NULL;
+DeleteSyncProc pglDeleteSync = NULL;
+bool hasBufferStorage = false;
+
+void* lookupGLProc(const char* name) {
+#ifdef HEADLESS_EGL
+    if (headless) return (void*)eglGetProcAddress(name);
+#endif
+    return (void*)glutGetProcAddress(name);
 }
 
+// glXGetProcAddress hands out stubs for any name, so newer entry points are
+// only trusted when the version or extension string advertises them
+bool glSupports(int major, int minor, const char* extension) {
+    const char* version = (const char*)glGetString(GL_VERSION);
+    int haveMajor = 0, haveMinor = 0;
+    if (version && sscanf(version, "%d.%d", &haveMajor, &haveMinor) == 2 &&
+        (haveMajor > major || (haveMajor == major && haveMinor >= minor))) {
+        return true;
+    }
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    size_t length = strlen(extension);
+    for (const char* p = extensions; p && (p = strstr(p, extension)) != NULL; p += length) {
+        if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0')) return true;
+    }
+    return false;
+}
 
-void createReflectionMatrix(bool x, bool y, bool z, float matrix[4][4]) {
-
-    matrixIdentity(matrix);
-    
-    matrix[0][0] = x ? -1.0f : 1.0f;  
-    matrix[1][1] = y ? -1.0f : 1.0f;  
-    matrix[2][2] = z ? -1.0f : 1.0f;  
-    matrix[3][3] = 1.0f;  
+// Looks up a core entry point, falling back to its ARB-suffixed name
+void* getGLProc(const char* name) {
+    void* proc = lookupGLProc(name);
+    if (!proc) {
+        std::string arbName = std::string(name) + "ARB";
+        proc = lookupGLProc(arbName.c_str());
+    }
+    return proc;
+}
 
+void loadGLExtensions() {
+    pglGenBuffers = (GenBuffersProc)getGLProc("glGenBuffers");
+    pglDeleteBuffers = (DeleteBuffersProc)getGLProc("glDeleteBuffers");
+    pglBindBuffer = (BindBufferProc)getGLProc("glBindBuffer");
+    pglBufferData = (BufferDataProc)getGLProc("glBufferData");
+    hasVertexBuffers = pglGenBuffers && pglDeleteBuffers && pglBindBuffer && pglBufferData;
+
+    pglCreateShader = (CreateShaderProc)getGLProc("glCreateShader");
+    pglShaderSource = (ShaderSourceProc)getGLProc("glShaderSource");
+    pglCompileShader = (CompileShaderProc)getGLProc("glCompileShader");
+    pglGetShaderiv = (GetShaderivProc)getGLProc("glGetShaderiv");
+    pglGetShaderInfoLog = (GetShaderInfoLogProc)getGLProc("glGetShaderInfoLog");
+    pglDeleteShader = (DeleteShaderProc)getGLProc("glDeleteShader");
+    pglCreateProgram = (CreateProgramProc)getGLProc("glCreateProgram");
+    pglAttachShader = (AttachShaderProc)getGLProc("glAttachShader");
+    pglBindAttribLocation = (BindAttribLocationProc)getGLProc("glBindAttribLocation");
+    pglLinkProgram = (LinkProgramProc)getGLProc("glLinkProgram");
+    pglGetProgramiv = (GetProgramivProc)getGLProc("glGetProgramiv");
+    pglGetProgramInfoLog = (GetProgramInfoLogProc)getGLProc("glGetProgramInfoLog");
+    pglUseProgram = (UseProgramProc)getGLProc("glUseProgram");
+    pglEnableVertexAttribArray = (EnableVertexAttribArrayProc)getGLProc("glEnableVertexAttribArray");
+    pglDisableVertexAttribArray = (DisableVertexAttribArrayProc)getGLProc("glDisableVertexAttribArray");
+    pglVertexAttribPointer = (VertexAttribPointerProc)getGLProc("glVertexAttribPointer");
+    hasShaders = pglCreateShader && pglShaderSource && pglCompileShader && pglGetShaderiv &&
+        pglGetShaderInfoLog && pglDeleteShader && pglCreateProgram && pglAttachShader &&
+        pglBindAttribLocation && pglLinkProgram && pglGetProgramiv && pglGetProgramInfoLog &&
+        pglUseProgram && pglEnableVertexAttribArray && pglDisableVertexAttribArray && pglVertexAttribPointer;
+
+    pglVertexAttribDivisor = (VertexAttribDivisorProc)getGLProc("glVertexAttribDivisor");
+    pglDrawElementsInstanced = (DrawElementsInstancedProc)getGLProc("glDrawElementsInstanced");
+    hasInstancing = hasVertexBuffers && hasShaders && pglVertexAttribDivisor && pglDrawElementsInstanced;
+
+    // GL 3.0 vertex array objects, GL 3.1 uniform buffers
+    pglGenVertexArrays = (GenVertexArraysProc)getGLProc("glGenVertexArrays");
+    pglBindVertexArray = (BindVertexArrayProc)getGLProc("glBindVertexArray");
+    pglBufferSubData = (BufferSubDataProc)getGLProc("glBufferSubData");
+    pglBindBufferBase = (BindBufferBaseProc)getGLProc("glBindBufferBase");
+    pglGetUniformBlockIndex = (GetUniformBlockIndexProc)getGLProc("glGetUniformBlockIndex");
+    pglUniformBlockBinding = (UniformBlockBindingProc)getGLProc("glUniformBlockBinding");
+    hasCoreObjects = hasInstancing && pglGenVertexArrays && pglBindVertexArray && pglBufferSubData &&
+        pglBindBufferBase && pglGetUniformBlockIndex && pglUniformBlockBinding;
+
+    // GL 3.0 / ARB_framebuffer_object
+    pglGenFramebuffers = (GenFramebuffersProc)getGLProc("glGenFramebuffers");
+    pglBindFramebuffer = (BindFramebufferProc)getGLProc("glBindFramebuffer");
+    pglFramebufferTexture2D = (FramebufferTexture2DProc)getGLProc("glFramebufferTexture2D");
+    pglCheckFramebufferStatus = (CheckFramebufferStatusProc)getGLProc("glCheckFramebufferStatus");
+    pglGenRenderbuffers = (GenRenderbuffersProc)getGLProc("glGenRenderbuffers");
+    pglBindRenderbuffer = (BindRenderbufferProc)getGLProc("glBindRenderbuffer");
+    pglRenderbufferStorage = (RenderbufferStorageProc)getGLProc("glRenderbufferStorage");
+    pglFramebufferRenderbuffer = (FramebufferRenderbufferProc)getGLProc("glFramebufferRenderbuffer");
+    pglBlitFramebuffer = (BlitFramebufferProc)getGLProc("glBlitFramebuffer");
+    hasFramebuffers = pglGenFramebuffers && pglBindFramebuffer && pglFramebufferTexture2D && pglCheckFramebufferStatus &&
+        pglGenRenderbuffers && pglBindRenderbuffer && pglRenderbufferStorage && pglFramebufferRenderbuffer &&
+        pglBlitFramebuffer;
+
+    // GL 3.3 / ARB_timer_query; EXT_timer_query names the 64-bit getter with EXT
+    pglGenQueries = (GenQueriesProc)getGLProc("glGenQueries");
+    pglBeginQuery = (BeginQueryProc)getGLProc("glBeginQuery");
+    pglEndQuery = (EndQueryProc)getGLProc("glEndQuery");
+    pglGetQueryObjectui64v = (GetQueryObjectui64vProc)getGLProc("glGetQueryObjectui64v");
+    if (!pglGetQueryObjectui64v) {
+        pglGetQueryObjectui64v = (GetQueryObjectui64vProc)lookupGLProc("glGetQueryObjectui64vEXT");
+    }
+    hasTimerQueries = pglGenQueries && pglBeginQuery && pglEndQuery && pglGetQueryObjectui64v &&
+        (glSupports(3, 3, "GL_ARB_timer_query") || glSupports(99, 0, "GL_EXT_timer_query"));
+
+    // GL 3.0 / ARB_map_buffer_range, GL 3.2 / ARB_sync, GL 4.4 / ARB_buffer_storage
+    pglMapBufferRange = (MapBufferRangeProc)getGLProc("glMapBufferRange");
+    pglUnmapBuffer = (UnmapBufferProc)getGLProc("glUnmapBuffer");
+    hasMapBufferRange = hasVertexBuffers && pglMapBufferRange && pglUnmapBuffer &&
+        glSupports(3, 0, "GL_ARB_map_buffer_range");
+    pglBufferStorage = (BufferStorageProc)getGLProc("glBufferStorage");
+    pglFenceSync = (FenceSyncProc)getGLProc("glFenceSync");
+    pglClientWaitSync = (ClientWaitSyncProc)getGLProc("glClientWaitSync");
+    pglDeleteSync = (DeleteSyncProc)getGLProc("glDeleteSync");
+    hasBufferStorage = hasMapBufferRange && pglBufferStorage && pglFenceSync && pglClientWaitSync && pglDeleteSync &&
+        glSupports(4, 4, "GL_ARB_buffer_storage") && glSupports(3, 2, "GL_ARB_sync");
 }
 
+// Streaming vertex uploads for geometry rebuilt every frame (grid, HUD text,
+// buttons, layer composite). One buffer holds streamFrameCount regions; a
+// frame writes only into its own region and fences it before the swap, so
+// the CPU never overwrites vertices the GPU may still be reading, and it
+// waits only if a region comes round again before its fence has passed.
+// Producers get a pointer into mapped memory, write their vertices there and
+// commit, which leaves the buffer bound for the gl*Pointer calls.
+//   persistent  ARB_buffer_storage, mapped once, coherent
+//   orphan      glBufferData(NULL) at the start of each frame, then each
+//               write maps its range unsynchronized and unmaps on commit
+//   client      no buffer objects; writes go to a scratch client array
+enum StreamMode { STREAM_CLIENT, STREAM_ORPHAN, STREAM_PERSISTENT };
+
+const char* streamModeNames[] = { "client", "orphan", "persistent" };
+const int streamFrameCount = 3;
+const size_t streamRegionBytes = 1 << 20;
+const size_t streamAlignment = 64;
+
+struct StreamBuffer {
+    StreamMode mode = STREAM_PERSISTENT;  // Best mode wanted; --stream can lower it
+    GLuint buffer = 0;
+    char* mapped = NULL;                  // Persistent mode: all regions
+    GLsync fences[streamFrameCount] = {};
+    int region = 0;
+    size_t used = 0;                      // Bytes taken in the current region
+    size_t writeOffset = 0;
+    size_t writeBytes = 0;
+    bool writeToScratch = false;
+    std::vector<char> scratch;            // Client mode and region overflow, one write at a time
+
+    size_t frameBytes = 0;
+    unsigned long long totalBytes = 0;
+    size_t stalls = 0;                    // Frames that had to wait on a region's fence
+    size_t overflows = 0;                 // Writes that didn't fit their region
+    std::chrono::steady_clock::time_point start;
+};
 
-void createTranslationMatrix(float x, float y, float z, float matrix[4][4]) {
+StreamBuffer stream;
+
+// After loadGLExtensions(); falls back as far as the driver requires
+void initStreamBuffer() {
+    if (stream.mode == STREAM_PERSISTENT && !hasBufferStorage) stream.mode = STREAM_ORPHAN;
+    if (stream.mode == STREAM_ORPHAN && !hasMapBufferRange) stream.mode = STREAM_CLIENT;
+    stream.start = std::chrono::steady_clock::now();
+    if (stream.mode == STREAM_CLIENT) return;
+
+    pglGenBuffers(1, &stream.buffer);
+    pglBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+    if (stream.mode == STREAM_PERSISTENT) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        pglBufferStorage(GL_ARRAY_BUFFER, streamRegionBytes * streamFrameCount, NULL, flags);
+        stream.mapped = (char*)pglMapBufferRange(GL_ARRAY_BUFFER, 0, streamRegionBytes * streamFrameCount, flags);
+        if (!stream.mapped) {
+            std::cerr << "Cannot map the stream buffer persistently, orphaning instead" << std::endl;
+            pglDeleteBuffers(1, &stream.buffer);
+            pglGenBuffers(1, &stream.buffer);
+            pglBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+            stream.mode = STREAM_ORPHAN;
+        }
+    }
+    if (stream.mode == STREAM_ORPHAN) {
+        pglBufferData(GL_ARRAY_BUFFER, streamRegionBytes, NULL, GL_STREAM_DRAW);
+    }
+    pglBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-    matrixIdentity(matrix);
-    matrix[0][3] = x;
-    matrix[1][3] = y;
-    matrix[2][3] = z;
+void beginStreamFrame() {
+    stream.used = 0;
+    stream.frameBytes = 0;
+    if (stream.mode == STREAM_PERSISTENT) {
+        stream.region = (stream.region + 1) % streamFrameCount;
+        GLsync fence = stream.fences[stream.region];
+        if (fence) {
+            GLenum status = pglClientWaitSync(fence, 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED) {
+                stream.stalls++;
+                do {
+                    status = pglClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+                } while (status == GL_TIMEOUT_EXPIRED);
+            }
+            pglDeleteSync(fence);
+            stream.fences[stream.region] = NULL;
+        }
+    }
+    else if (stream.mode == STREAM_ORPHAN) {
+        // The driver detaches last frame's storage, so this frame's writes never wait
+        pglBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+        pglBufferData(GL_ARRAY_BUFFER, streamRegionBytes, NULL, GL_STREAM_DRAW);
+        pglBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+}
 
+// Before the swap, once everything reading this frame's region is queued
+void endStreamFrame() {
+    if (stream.mode == STREAM_PERSISTENT) {
+        stream.fences[stream.region] = pglFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
 }
 
-void createScaleMatrix(float x, float y, float z, float matrix[4][4]) {
+// Space for bytes of vertices, valid until commitStreamVertices(). Only one
+// write may be open at a time.
+void* mapStreamVertices(size_t bytes) {
+    size_t offset = (stream.used + streamAlignment - 1) & ~(streamAlignment - 1);
+    stream.writeBytes = bytes;
+    stream.writeToScratch = stream.mode == STREAM_CLIENT || offset + bytes > streamRegionBytes;
+    if (stream.writeToScratch) {
+        if (stream.mode != STREAM_CLIENT) stream.overflows++;
+        if (stream.scratch.size() < bytes) stream.scratch.resize(bytes);
+        return stream.scratch.data();
+    }
+    stream.writeOffset = offset;
+    stream.used = offset + bytes;
+    if (stream.mode == STREAM_PERSISTENT) {
+        stream.writeOffset += (size_t)stream.region * streamRegionBytes;
+        return stream.mapped + stream.writeOffset;
+    }
+    pglBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+    void* p = pglMapBufferRange(GL_ARRAY_BUFFER, offset, bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!p) {
+        pglBindBuffer(GL_ARRAY_BUFFER, 0);
+        stream.writeToScratch = true;
+        stream.overflows++;
+        if (stream.scratch.size() < bytes) stream.scratch.resize(bytes);
+        return stream.scratch.data();
+    }
+    return p;
+}
 
-    matrixIdentity(matrix);
-    matrix[0][0] = x;
-    matrix[1][1] = y;
-    matrix[2][2] = z;
+// Finishes the open write and binds its buffer. Returns the base to add
+// attribute offsets to in gl*Pointer calls; call unbindStreamBuffer() after them.
+const char* commitStreamVertices() {
+    stream.frameBytes += stream.writeBytes;
+    stream.totalBytes += stream.writeBytes;
+    if (stream.writeToScratch) {
+        return stream.scratch.data();
+    }
+    if (stream.mode == STREAM_ORPHAN) {
+        pglUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    else {
+        pglBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+    }
+    return (const char*)NULL + stream.writeOffset;
+}
 
+void unbindStreamBuffer() {
+    if (stream.mode != STREAM_CLIENT) {
+        pglBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
 }
 
-void createRotationXMatrix(float angle, float matrix[4][4]) {
+// Mean upload rate since startup
+double streamMegabytesPerSecond() {
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - stream.start).count();
+    return seconds > 0.0 ? stream.totalBytes / seconds / 1.0e6 : 0.0;
+}
 
-    matrixIdentity(matrix);
+// Camera. The view matrix is rebuilt only when cameraPos, cameraFront or
+// cameraUp change and the projection only in setCameraViewport(). Model-view
+// matrices are composed on a CPU stack and each pass uploads one matrix per
+// GL matrix mode with glLoadMatrixf; an upload equal to the last one is skipped.
+float viewportAspect = 800.0f / 700.0f;  // Kept in sync with reshape()
+int viewportHeight = 700;
+const int cameraStackDepth = 8;
+const float cameraFovy = 45.0f;
+const float cameraNear = 0.1f;
+const float cameraFar = 100.0f;
+
+struct Camera {
+    float eye[3], front[3], up[3];  // Inputs of the cached view
+    bool viewValid = false;
+    float view[4][4];
+    bool projectionValid = false;
+    float projection[4][4];
+    int pixelWidth = 0, pixelHeight = 0;  // Of the cached pixel-space ortho
+    float pixelOrtho[4][4];
+    Mat4 stack[cameraStackDepth];  // Model-view, row-major; stack[0] is the view
+    int top = 0;
+    Mat4 glProjection, glModelView;  // Last uploaded, column-major
+    bool glProjectionValid = false, glModelViewValid = false;
+};
 
-    float rad = angle * M_PI / 180.0f;
-    float cos_t = cos(rad);
-    float sin_t = sin(rad);
-    matrix[1][1] = cos_t;
-    matrix[1][2] = -sin_t;
-    matrix[2][1] = sin_t;
-    matrix[2][2] = cos_t;
+Camera camera;
 
+void buildPerspectiveMatrix(float fovy, float aspect, float zNear, float zFar, float matrix[4][4]) {
+    float f = 1.0f / tan(fovy * M_PI / 360.0f);
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            matrix[i][j] = 0.0f;
+        }
+    }
+    matrix[0][0] = f / aspect;
+    matrix[1][1] = f;
+    matrix[2][2] = (zFar + zNear) / (zNear - zFar);
+    matrix[2][3] = 2.0f * zFar * zNear / (zNear - zFar);
+    matrix[3][2] = -1.0f;
 }
 
-void createRotationYMatrix(float angle, float matrix[4][4]) {
+// Same matrix gluLookAt builds for the current camera
+void buildLookAtMatrix(const float eye[3], const float front[3], const float up[3], float matrix[4][4]) {
+    float f[3] = { front[0], front[1], front[2] };
+    float fLength = sqrt(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+    for (int k = 0; k < 3; k++) f[k] /= fLength;
 
-    matrixIdentity(matrix);
-    float rad = angle * M_PI / 180.0f;
-    float cos_t = cos(rad);
-    float sin_t = sin(rad);
-    matrix[0][0] = cos_t;
-    matrix[0][2] = sin_t;
-    matrix[2][0] = -sin_t;
-    matrix[2][2] = cos_t;
+    float side[3] = {
+        f[1] * up[2] - f[2] * up[1],
+        f[2] * up[0] - f[0] * up[2],
+        f[0] * up[1] - f[1] * up[0]
+    };
+    float sLength = sqrt(side[0] * side[0] + side[1] * side[1] + side[2] * side[2]);
+    for (int k = 0; k < 3; k++) side[k] /= sLength;
 
+    float u[3] = {
+        side[1] * f[2] - side[2] * f[1],
+        side[2] * f[0] - side[0] * f[2],
+        side[0] * f[1] - side[1] * f[0]
+    };
 
+    for (int k = 0; k < 3; k++) {
+        matrix[0][k] = side[k];
+        matrix[1][k] = u[k];
+        matrix[2][k] = -f[k];
+        matrix[3][k] = 0.0f;
+    }
+    matrix[0][3] = -(side[0] * eye[0] + side[1] * eye[1] + side[2] * eye[2]);
+    matrix[1][3] = -(u[0] * eye[0] + u[1] * eye[1] + u[2] * eye[2]);
+    matrix[2][3] = f[0] * eye[0] + f[1] * eye[1] + f[2] * eye[2];
+    matrix[3][3] = 1.0f;
 }
 
-void createRotationZMatrix(float angle, float matrix[4][4]) {
-
+// Same matrix gluOrtho2D(0, width, 0, height) builds
+void buildPixelOrthoMatrix(int width, int height, float matrix[4][4]) {
     matrixIdentity(matrix);
-    float rad = angle * M_PI / 180.0f;
-    float cos_t = cos(rad);
-    float sin_t = sin(rad);
-    matrix[0][0] = cos_t;
-    matrix[0][1] = -sin_t;
-    matrix[1][0] = sin_t;
-    matrix[1][1] = cos_t;
+    matrix[0][0] = 2.0f / width;
+    matrix[1][1] = 2.0f / height;
+    matrix[2][2] = -1.0f;
+    matrix[0][3] = -1.0f;
+    matrix[1][3] = -1.0f;
+}
 
+void setCameraViewport(int width, int height) {
+    viewportAspect = (float)width / height;
+    viewportHeight = height;
+    buildPerspectiveMatrix(cameraFovy, viewportAspect, cameraNear, cameraFar, camera.projection);
+    camera.projectionValid = true;
+}
 
+// Brings camera.view and camera.projection up to date
+void updateCamera() {
+    if (!camera.projectionValid) {
+        buildPerspectiveMatrix(cameraFovy, viewportAspect, cameraNear, cameraFar, camera.projection);
+        camera.projectionValid = true;
+    }
+    if (camera.viewValid && memcmp(camera.eye, cameraPos, sizeof(camera.eye)) == 0 &&
+        memcmp(camera.front, cameraFront, sizeof(camera.front)) == 0 && memcmp(camera.up, cameraUp, sizeof(camera.up)) == 0) {
+        return;
+    }
+    memcpy(camera.eye, cameraPos, sizeof(camera.eye));
+    memcpy(camera.front, cameraFront, sizeof(camera.front));
+    memcpy(camera.up, cameraUp, sizeof(camera.up));
+    buildLookAtMatrix(camera.eye, camera.front, camera.up, camera.view);
+    camera.viewValid = true;
 }
 
+// GL wants column-major, so the transpose is what gets loaded. GL_MODELVIEW
+// stays the current matrix mode between uploads.
+void uploadProjection(const float matrix[4][4]) {
+    Mat4 columns;
+    matrixKernels->transpose(matrix, columns.m);
+    if (camera.glProjectionValid && memcmp(&columns, &camera.glProjection, sizeof(columns)) == 0) return;
+    glMatrixMode(GL_PROJECTION);
+    glLoadMatrixf(columns.m[0]);
+    glMatrixMode(GL_MODELVIEW);
+    camera.glProjection = columns;
+    camera.glProjectionValid = true;
+}
 
-void updateTransformMatrix() {
-    float translationMat[4][4], rotationXMat[4][4], rotationYMat[4][4],
-        rotationZMat[4][4], scaleMat[4][4], shearMat[4][4],
-        reflectionMat[4][4], tempMat[4][4];
+void uploadModelViewColumns(const Mat4& columns) {
+    if (camera.glModelViewValid && memcmp(&columns, &camera.glModelView, sizeof(columns)) == 0) return;
+    glLoadMatrixf(columns.m[0]);
+    camera.glModelView = columns;
+    camera.glModelViewValid = true;
+}
 
-    
-    createTranslationMatrix(position[0], position[1], position[2], translationMat);
-    createRotationXMatrix(rotation[0], rotationXMat);
-    createRotationYMatrix(rotation[1], rotationYMat);
-    createRotationZMatrix(rotation[2], rotationZMat);
-    createScaleMatrix(scale[0], scale[1], scale[2], scaleMat);
-    createShearMatrix(shear[0], shear[1], shear[0], shear[2], shear[1], shear[2], shearMat);
-    createReflectionMatrix(reflection[0], reflection[1], reflection[2], reflectionMat);
+void uploadCameraModelView() {
+    Mat4 columns;
+    matrixKernels->transpose(camera.stack[camera.top].m, columns.m);
+    uploadModelViewColumns(columns);
+}
 
-    
-    matrixIdentity(tempMat);
-    matrixMultiply(tempMat, scaleMat, tempMat);
-    
-    matrixMultiply(tempMat, shearMat, tempMat);
+// Uploads the top of the stack times a column-major model matrix. In
+// column-major terms (V * M)^T = M^T * V^T, so the product is taken in that order.
+void uploadCameraModelView(const float* columnMajorModel) {
+    Mat4 top, columns;
+    matrixKernels->transpose(camera.stack[camera.top].m, top.m);
+    matrixKernels->multiply((const float(*)[4])columnMajorModel, top.m, columns.m);
+    uploadModelViewColumns(columns);
+}
 
-    matrixMultiply(tempMat, reflectionMat, tempMat);
-    
-    matrixMultiply(tempMat, rotationZMat, tempMat);
-    matrixMultiply(tempMat, rotationYMat, tempMat);
-    matrixMultiply(tempMat, rotationXMat, tempMat);
-    
-    matrixMultiply(tempMat, translationMat, transformMatrix);
+void pushCameraMatrix() {
+    if (camera.top + 1 >= cameraStackDepth) {
+        std::cerr << "Camera matrix stack overflow" << std::endl;
+        return;
+    }
+    camera.stack[camera.top + 1] = camera.stack[camera.top];
+    camera.top++;
 }
 
-void applyTransformMatrix() {
-    
-    float glMatrix[16];
-    int idx = 0;
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            
-            glMatrix[idx++] = transformMatrix[j][i];
-        }
+void popCameraMatrix() {
+    if (camera.top > 0) camera.top--;
+}
+
+void multiplyCameraMatrix(const float matrix[4][4]) {
+    matrixKernels->multiply(camera.stack[camera.top].m, matrix, camera.stack[camera.top].m);
+}
+
+// Starts a 3D pass: perspective projection and the view on an empty stack
+void beginCameraPass() {
+    updateCamera();
+    uploadProjection(camera.projection);
+    camera.top = 0;
+    memcpy(camera.stack[0].m, camera.view, sizeof(camera.view));
+    uploadCameraModelView();
+}
+
+// Pixel-space 2D pass with the origin at the bottom left. The next 3D pass
+// restores its own matrices, so there is nothing to pop afterwards.
+void beginPixelOrtho(int width, int height) {
+    if (width != camera.pixelWidth || height != camera.pixelHeight) {
+        buildPixelOrthoMatrix(width, height, camera.pixelOrtho);
+        camera.pixelWidth = width;
+        camera.pixelHeight = height;
     }
-    glMultMatrixf(glMatrix);
+    uploadProjection(camera.pixelOrtho);
+    Mat4 identity;
+    matrixIdentity(identity.m);
+    uploadModelViewColumns(identity);
 }
 
 
-void drawGrid() {
-    glDisable(GL_LIGHTING);  // Disable lighting for grid lines
-    glColor3f(0.3f, 0.3f, 0.3f);  // Grey color for grid
-    glBegin(GL_LINES);
+struct LineVertex {
+    float position[3];
+    float color[3];
+};
 
-    // Draw grid lines along X axis with larger size (20x20)
+LineVertex* putLineVertex(LineVertex* out, float x, float y, float z, const float color[3]) {
+    LineVertex vertex = { { x, y, z }, { color[0], color[1], color[2] } };
+    *out = vertex;
+    return out + 1;
+}
+
+// Written straight into the stream buffer every frame, then drawn as two
+// batches because the axes use a wider line
+void drawGrid() {
+    const int gridVertices = 41 * 4;
+    const int axisVertices = 6;
+    const float grey[3] = { 0.3f, 0.3f, 0.3f };
+    const float red[3] = { 1.0f, 0.0f, 0.0f };
+    const float green[3] = { 0.0f, 1.0f, 0.0f };
+    const float blue[3] = { 0.0f, 0.0f, 1.0f };
+    LineVertex* v = (LineVertex*)mapStreamVertices((gridVertices + axisVertices) * sizeof(LineVertex));
+
+    // Grid lines along X axis with larger size (20x20)
     for (float i = -20; i <= 20; i += 1.0f) {
-        glVertex3f(i, 0, -20);
-        glVertex3f(i, 0, 20);
+        v = putLineVertex(v, i, 0, -20, grey);
+        v = putLineVertex(v, i, 0, 20, grey);
     }
 
-    // Draw grid lines along Z axis
+    // Grid lines along Z axis
     for (float i = -20; i <= 20; i += 1.0f) {
-        glVertex3f(-20, 0, i);
-        glVertex3f(20, 0, i);
+        v = putLineVertex(v, -20, 0, i, grey);
+        v = putLineVertex(v, 20, 0, i, grey);
     }
 
-    glEnd();
+    // Coordinate axes: X red, Y green, Z blue
+    v = putLineVertex(v, 0, 0, 0, red);
+    v = putLineVertex(v, 4, 0, 0, red);
+    v = putLineVertex(v, 0, 0, 0, green);
+    v = putLineVertex(v, 0, 4, 0, green);
+    v = putLineVertex(v, 0, 0, 0, blue);
+    v = putLineVertex(v, 0, 0, 4, blue);
+
+    const char* base = commitStreamVertices();
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(LineVertex), base + offsetof(LineVertex, position));
+    glColorPointer(3, GL_FLOAT, sizeof(LineVertex), base + offsetof(LineVertex, color));
+    unbindStreamBuffer();
 
-    // Draw coordinate axes with longer length
+    glDisable(GL_LIGHTING);  // Disable lighting for grid lines
+    glDrawArrays(GL_LINES, 0, gridVertices);
     glLineWidth(2.0f);
-    glBegin(GL_LINES);
-    // X axis - Red
-    glColor3f(1.0f, 0.0f, 0.0f);
-    glVertex3f(0, 0, 0);
-    glVertex3f(4, 0, 0);
-
-    // Y axis - Green
-    glColor3f(0.0f, 1.0f, 0.0f);
-    glVertex3f(0, 0, 0);
-    glVertex3f(0, 4, 0);
-
-    // Z axis - Blue
-    glColor3f(0.0f, 0.0f, 1.0f);
-    glVertex3f(0, 0, 0);
-    glVertex3f(0, 0, 4);
-    glEnd();
+    glDrawArrays(GL_LINES, gridVertices, axisVertices);
     glLineWidth(1.0f);
-
     glEnable(GL_LIGHTING);
+    glPopClientAttrib();
+}
+
+// HUD text. renderText() only queues strings; flushText() draws everything
+// queued during the frame with a single draw call from a texture atlas of the
+// 9x15 GLUT font. The atlas is captured from glutBitmapCharacter itself on the
+// first frame, so the glyphs match the bitmap font pixel for pixel.
+const int glyphFirst = 32;  // Printable ASCII only
+const int glyphCount = 95;
+const int glyphColumns = 16;
+const int glyphCellWidth = 16;
+const int glyphCellHeight = 24;
+const int glyphOriginX = 4;  // Raster position inside a cell, leaves room for the descender
+const int glyphOriginY = 8;
+const int textAtlasSize = 256;
+
+struct TextRun {
+    float x, y;
+    bool virtualSpace;  // In renderText's fixed 800x700 space rather than window pixels
+    size_t start, length;
+};
+
+struct TextVertex {
+    float x, y, u, v;
+};
+
+struct TextBatch {
+    std::vector<char> chars;
+    std::vector<TextRun> runs;
+    int advance[glyphCount];
+    GLuint atlas = 0;
+    bool atlasTried = false;
+};
+
+TextBatch textBatch;
+
+void queueText(float x, float y, const char* text, bool virtualSpace) {
+    TextRun run = { x, y, virtualSpace, textBatch.chars.size(), strlen(text) };
+    textBatch.chars.insert(textBatch.chars.end(), text, text + run.length);
+    textBatch.runs.push_back(run);
 }
 
 void renderText(float x, float y, const char* text) {
-    // [Previous renderText function remains the same]
+    queueText(x, y, text, true);
+}
+
+// Draws every glyph into the back buffer and reads them back into an alpha
+// texture. Must run before the frame is cleared. Leaves atlas at 0 (bitmap
+// fallback) if the window is too small to hold the glyph grid.
+void buildTextAtlas() {
+    textBatch.atlasTried = true;
+    if (headless) return;  // GLUT fonts need glutInit; headless frames have no HUD text
+    int width = windowWidth();
+    int height = windowHeight();
+    int gridWidth = glyphColumns * glyphCellWidth;
+    int gridHeight = (glyphCount + glyphColumns - 1) / glyphColumns * glyphCellHeight;
+    if (width < gridWidth || height < gridHeight) return;
+
+    glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT);
     glDisable(GL_LIGHTING);
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    glLoadIdentity();
-    gluOrtho2D(0, 800, 0, 700);
+    glDisable(GL_DEPTH_TEST);
+    beginPixelOrtho(width, height);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glColor3f(1.0f, 1.0f, 1.0f);
+    for (int i = 0; i < glyphCount; i++) {
+        glRasterPos2i(i % glyphColumns * glyphCellWidth + glyphOriginX, i / glyphColumns * glyphCellHeight + glyphOriginY);
+        glutBitmapCharacter(GLUT_BITMAP_9_BY_15, glyphFirst + i);
+        textBatch.advance[i] = glutBitmapWidth(GLUT_BITMAP_9_BY_15, glyphFirst + i);
+    }
 
-    glMatrixMode(GL_MODELVIEW);
-    glPushMatrix();
-    glLoadIdentity();
+    std::vector<unsigned char> pixels(gridWidth * gridHeight * 4);
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, gridWidth, gridHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    glPopAttrib();
+
+    std::vector<unsigned char> alpha(textAtlasSize * textAtlasSize, 0);
+    for (int y = 0; y < gridHeight; y++) {
+        for (int x = 0; x < gridWidth; x++) {
+            alpha[y * textAtlasSize + x] = pixels[(y * gridWidth + x) * 4];
+        }
+    }
+
+    glGenTextures(1, &textBatch.atlas);
+    glBindTexture(GL_TEXTURE_2D, textBatch.atlas);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, textAtlasSize, textAtlasSize, 0, GL_ALPHA, GL_UNSIGNED_BYTE, alpha.data());
+    glPopClientAttrib();
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+TextVertex* putGlyphQuad(TextVertex* out, float penX, float penY, int glyph) {
+    float x0 = penX - glyphOriginX, y0 = penY - glyphOriginY;
+    float x1 = x0 + glyphCellWidth, y1 = y0 + glyphCellHeight;
+    float u0 = float(glyph % glyphColumns * glyphCellWidth) / textAtlasSize;
+    float v0 = float(glyph / glyphColumns * glyphCellHeight) / textAtlasSize;
+    float u1 = u0 + float(glyphCellWidth) / textAtlasSize;
+    float v1 = v0 + float(glyphCellHeight) / textAtlasSize;
+    TextVertex quad[6] = {
+        { x0, y0, u0, v0 }, { x1, y0, u1, v0 }, { x1, y1, u1, v1 },
+        { x0, y0, u0, v0 }, { x1, y1, u1, v1 }, { x0, y1, u0, v1 }
+    };
+    memcpy(out, quad, sizeof(quad));
+    return out + 6;
+}
+
+// Drops the queued text without drawing it
+void discardText() {
+    textBatch.runs.clear();
+    textBatch.chars.clear();
+}
+
+// Draws and clears everything queued by renderText/queueText in one ortho block
+void flushText() {
+    if (headless) {
+        discardText();
+    }
+    if (textBatch.runs.empty()) return;
+
+    int width = windowWidth();
+    int height = windowHeight();
+    float scaleX = width / 800.0f, scaleY = height / 700.0f;
 
+    glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT | GL_TEXTURE_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+    beginPixelOrtho(width, height);
     glColor3f(1.0f, 1.0f, 1.0f);  // White text
-    glRasterPos2f(x, y);
-    for (const char* c = text; *c != '\0'; c++) {
-        glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *c);
+
+    if (textBatch.atlas) {
+        // Every queued character is one quad, written straight into the stream buffer
+        size_t vertexCount = textBatch.chars.size() * 6;
+        TextVertex* out = (TextVertex*)mapStreamVertices(vertexCount * sizeof(TextVertex));
+        for (const TextRun& run : textBatch.runs) {
+            // Glyphs snap to whole pixels the way glBitmap places them
+            float penX = floor(run.virtualSpace ? run.x * scaleX : run.x);
+            float penY = floor(run.virtualSpace ? run.y * scaleY : run.y);
+            for (size_t i = 0; i < run.length; i++) {
+                int glyph = (unsigned char)textBatch.chars[run.start + i] - glyphFirst;
+                if (glyph < 0 || glyph >= glyphCount) glyph = 0;  // Unprintable, draw as a space
+                out = putGlyphQuad(out, penX, penY, glyph);
+                penX += textBatch.advance[glyph];
+            }
+        }
+
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, textBatch.atlas);
+        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+        glEnable(GL_ALPHA_TEST);
+        glAlphaFunc(GL_GREATER, 0.5f);
+
+        const char* base = commitStreamVertices();
+        glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexPointer(2, GL_FLOAT, sizeof(TextVertex), base + offsetof(TextVertex, x));
+        glTexCoordPointer(2, GL_FLOAT, sizeof(TextVertex), base + offsetof(TextVertex, u));
+        unbindStreamBuffer();
+        glDrawArrays(GL_TRIANGLES, 0, (GLsizei)vertexCount);
+        glPopClientAttrib();
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    else {
+        for (const TextRun& run : textBatch.runs) {
+            glRasterPos2f(run.virtualSpace ? run.x * scaleX : run.x, run.virtualSpace ? run.y * scaleY : run.y);
+            for (size_t i = 0; i < run.length; i++) {
+                glutBitmapCharacter(GLUT_BITMAP_9_BY_15, textBatch.chars[run.start + i]);
+            }
+        }
     }
 
-    glPopMatrix();
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
-    glMatrixMode(GL_MODELVIEW);
-    glEnable(GL_LIGHTING);
+    glPopAttrib();
+    discardText();
 }
 
 // Add this function to display keyboard instructions
@@ -334,6 +1145,10 @@ void renderInstructions() {
             renderText(10, startY - 60, "Q/E: Rotate around Z axis");
             renderText(10, startY - 80, "Space: Reset rotation");
             renderText(10, startY - 100, "C: Toggle camera/object control");
+            renderText(10, startY - 120, quaternionRotation ? "O: Euler rotation" : "O: Quaternion rotation");
+            if (quaternionRotation) {
+                renderText(10, startY - 140, "K: Save orientation  L: Play (slerp)  J: Clear");
+            }
             break;
 
         case SCALE:
@@ -366,231 +1181,199 @@ void renderInstructions() {
     }
 
     // Add general instructions at the bottom
-    renderText(10, startY - 140, "ESC: Exit program");
+    renderText(10, startY - 140, sceneMode ? "ESC: Exit   P: Profiler   [/]: Select scene node   F: Toggle culling" :
+        instanceMode ? "ESC: Exit   P: Profiler   F: Toggle culling" : "ESC: Exit program   P: Profiler");
 }
 
 
-// Keep only one drawButtons function and remove the duplicate
+struct WidgetVertex {
+    float x, y;
+    float r, g, b;
+};
+
+// Labels sit to the right of their buttons and join the HUD text batch. They
+// must be queued before beginHudLayer() so the layer keeps their regions.
+void queueWidgetLabels() {
+    for (const Widget& w : widgetRegistry.widgets) {
+        queueText(w.x + 35, w.y + w.height / 2, w.label.c_str(), false);
+    }
+}
+
+// All widget backgrounds go out in one draw call
 void drawButtons() {
-    glDisable(GL_LIGHTING);
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    glLoadIdentity();
-    gluOrtho2D(0, glutGet(GLUT_WINDOW_WIDTH), 0, glutGet(GLUT_WINDOW_HEIGHT));
-    glMatrixMode(GL_MODELVIEW);
-    glPushMatrix();
-    glLoadIdentity();
+    size_t vertexCount = widgetRegistry.widgets.size() * 4;
+    if (vertexCount == 0) return;
+    WidgetVertex* out = (WidgetVertex*)mapStreamVertices(vertexCount * sizeof(WidgetVertex));
+    for (const Widget& w : widgetRegistry.widgets) {
+        float shade = w.selected ? 0.5f : 0.3f;  // Highlighted when selected
+        float blue = w.selected ? 0.8f : 0.3f;
+        WidgetVertex quad[4] = {
+            { w.x, w.y, shade, shade, blue },
+            { w.x + w.width, w.y, shade, shade, blue },
+            { w.x + w.width, w.y + w.height, shade, shade, blue },
+            { w.x, w.y + w.height, shade, shade, blue }
+        };
+        memcpy(out, quad, sizeof(quad));
+        out += 4;
+    }
+    const char* base = commitStreamVertices();
 
-    for (const Button& btn : buttons) {
-        // Draw button background
-        if (btn.selected) {
-            glColor3f(0.5f, 0.5f, 0.8f);  // Highlighted color for selected
-        }
-        else {
-            glColor3f(0.3f, 0.3f, 0.3f);  // Normal color
-        }
+    glDisable(GL_LIGHTING);
+    beginPixelOrtho(windowWidth(), windowHeight());
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, sizeof(WidgetVertex), base + offsetof(WidgetVertex, x));
+    glColorPointer(3, GL_FLOAT, sizeof(WidgetVertex), base + offsetof(WidgetVertex, r));
+    unbindStreamBuffer();
+    glDrawArrays(GL_QUADS, 0, (GLsizei)vertexCount);
+    glPopClientAttrib();
+    glEnable(GL_LIGHTING);
+}
 
-        glBegin(GL_QUADS);
-        glVertex2f(btn.x, btn.y);
-        glVertex2f(btn.x + btn.width, btn.y);
-        glVertex2f(btn.x + btn.width, btn.y + btn.height);
-        glVertex2f(btn.x, btn.y + btn.height);
-        glEnd();
+GLuint compileShader(GLenum type, const char* source) {
+    GLuint shader = pglCreateShader(type);
+    pglShaderSource(shader, 1, &source, NULL);
+    pglCompileShader(shader);
+
+    GLint status = 0;
+    pglGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        char log[1024];
+        pglGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        std::cerr << "Shader compile failed: " << log << std::endl;
+        pglDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
 
-        // Draw button text
-        glColor3f(1.0f, 1.0f, 1.0f);
-        glRasterPos2f(btn.x + 35, btn.y + btn.height / 2);
-        for (char c : btn.label) {
-            glutBitmapCharacter(GLUT_BITMAP_9_BY_15, c);
-        }
+// Links a vertex/fragment pair; attribute names are bound to their index in attribs
+GLuint linkProgram(const char* vertexSource, const char* fragmentSource,
+    const char* const* attribs, int attribCount) {
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+    if (!vertexShader || !fragmentShader) return 0;
+
+    GLuint program = pglCreateProgram();
+    pglAttachShader(program, vertexShader);
+    pglAttachShader(program, fragmentShader);
+    for (int i = 0; i < attribCount; i++) {
+        if (attribs[i]) pglBindAttribLocation(program, i, attribs[i]);
+    }
+    pglLinkProgram(program);
+    pglDeleteShader(vertexShader);
+    pglDeleteShader(fragmentShader);
+
+    GLint status = 0;
+    pglGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status) {
+        char log[1024];
+        pglGetProgramInfoLog(program, sizeof(log), NULL, log);
+        std::cerr << "Program link failed: " << log << std::endl;
+        return 0;
     }
+    return program;
+}
 
-    glPopMatrix();
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
-    glMatrixMode(GL_MODELVIEW);
-    glEnable(GL_LIGHTING);
+
+// Tessellation levels for the curved shapes, coarsest first. The default
+// level is the tessellation the shapes have always been drawn with.
+const int lodLevelCount = 4;
+const int defaultLodLevel = 2;
+const int sphereLodStacks[lodLevelCount] = { 6, 10, 20, 40 };
+const int sphereLodSlices[lodLevelCount] = { 8, 14, 20, 48 };
+const int cylinderLodSegments[lodLevelCount] = { 8, 16, 30, 64 };
+
+Mesh shapeMeshes[shapeTypeCount][lodLevelCount];  // Indexed by Shape and level; flat shapes use level 0
+int currentShapeLod = defaultLodLevel;  // Level of the single-shape view
+size_t frameTriangles = 0;              // Triangles submitted since the start of the frame
+
+bool shapeHasLod(Shape shape) {
+    return shape == SPHERE || shape == CYLINDER;
 }
 
+void uploadMesh(Mesh& mesh) {
+    pglGenBuffers(1, &mesh.vertexBuffer);
+    pglGenBuffers(1, &mesh.indexBuffer);
 
+    pglBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBuffer);
+    pglBufferData(GL_ARRAY_BUFFER, meshVertexCount(mesh) * sizeof(MeshVertex), meshVertexData(mesh), GL_STATIC_DRAW);
+    pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBuffer);
+    pglBufferData(GL_ELEMENT_ARRAY_BUFFER, meshIndexCount(mesh) * sizeof(unsigned int), meshIndexData(mesh), GL_STATIC_DRAW);
+    pglBindBuffer(GL_ARRAY_BUFFER, 0);
+    pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-void drawCube() {
-    glBegin(GL_QUADS);
-
-    // Front face (Red)
-    glColor3f(1.0f, 0.0f, 0.0f);
-    glNormal3f(0.0f, 0.0f, 1.0f);
-    glVertex3f(-0.5f, -0.5f, 0.5f);
-    glVertex3f(0.5f, -0.5f, 0.5f);
-    glVertex3f(0.5f, 0.5f, 0.5f);
-    glVertex3f(-0.5f, 0.5f, 0.5f);
-
-    // Back face (Green)
-    glColor3f(0.0f, 1.0f, 0.0f);
-    glNormal3f(0.0f, 0.0f, -1.0f);
-    glVertex3f(-0.5f, -0.5f, -0.5f);
-    glVertex3f(-0.5f, 0.5f, -0.5f);
-    glVertex3f(0.5f, 0.5f, -0.5f);
-    glVertex3f(0.5f, -0.5f, -0.5f);
-
-    // Top face (Blue)
-    glColor3f(0.0f, 0.0f, 1.0f);
-    glNormal3f(0.0f, 1.0f, 0.0f);
-    glVertex3f(-0.5f, 0.5f, -0.5f);
-    glVertex3f(-0.5f, 0.5f, 0.5f);
-    glVertex3f(0.5f, 0.5f, 0.5f);
-    glVertex3f(0.5f, 0.5f, -0.5f);
-
-    // Bottom face (Yellow)
-    glColor3f(1.0f, 1.0f, 0.0f);
-    glNormal3f(0.0f, -1.0f, 0.0f);
-    glVertex3f(-0.5f, -0.5f, -0.5f);
-    glVertex3f(0.5f, -0.5f, -0.5f);
-    glVertex3f(0.5f, -0.5f, 0.5f);
-    glVertex3f(-0.5f, -0.5f, 0.5f);
-
-    // Right face (Purple)
-    glColor3f(1.0f, 0.0f, 1.0f);
-    glNormal3f(1.0f, 0.0f, 0.0f);
-    glVertex3f(0.5f, -0.5f, -0.5f);
-    glVertex3f(0.5f, 0.5f, -0.5f);
-    glVertex3f(0.5f, 0.5f, 0.5f);
-    glVertex3f(0.5f, -0.5f, 0.5f);
-
-    // Left face (Cyan)
-    glColor3f(0.0f, 1.0f, 1.0f);
-    glNormal3f(-1.0f, 0.0f, 0.0f);
-    glVertex3f(-0.5f, -0.5f, -0.5f);
-    glVertex3f(-0.5f, -0.5f, 0.5f);
-    glVertex3f(-0.5f, 0.5f, 0.5f);
-    glVertex3f(-0.5f, 0.5f, -0.5f);
-
-    glEnd();
+    mesh.uploaded = true;
 }
 
+Mesh& getShapeMesh(Shape shape, int lod = defaultLodLevel) {
+    if (!shapeHasLod(shape)) lod = 0;
+    Mesh& mesh = shapeMeshes[shape][lod];
+    if (!mesh.built) {
+        switch (shape) {
+        case CUBE: buildCubeMesh(mesh); break;
+        case SPHERE: buildSphereMesh(mesh, sphereLodStacks[lod], sphereLodSlices[lod]); break;
+        case PYRAMID: buildPyramidMesh(mesh); break;
+        case CYLINDER: buildCylinderMesh(mesh, cylinderLodSegments[lod]); break;
+        case IMPORTED: break;  // Filled by loadImportedMesh, empty without --mesh
+        }
+        mesh.built = true;
+    }
+    if (!mesh.uploaded && hasVertexBuffers) {
+        uploadMesh(mesh);
+    }
+    return mesh;
+}
 
-void drawSphere() {
-    const int stacks = 20;
-    const int slices = 20;
-    const float radius = 0.5f;
+void drawMesh(const Mesh& mesh) {
+    const char* vertexBase = NULL;
+    const void* indexBase = NULL;
+    if (mesh.uploaded) {
+        pglBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBuffer);
+        pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBuffer);
+    }
+    else {
+        vertexBase = (const char*)meshVertexData(mesh);
+        indexBase = meshIndexData(mesh);
+    }
 
-    // Draw sphere using triangle strips
-    for (int i = 0; i < stacks; i++) {
-        float phi1 = M_PI * float(i) / stacks;
-        float phi2 = M_PI * float(i + 1) / stacks;
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(MeshVertex), vertexBase + offsetof(MeshVertex, position));
+    glNormalPointer(GL_FLOAT, sizeof(MeshVertex), vertexBase + offsetof(MeshVertex, normal));
+    glColorPointer(3, GL_FLOAT, sizeof(MeshVertex), vertexBase + offsetof(MeshVertex, color));
 
-        glBegin(GL_TRIANGLE_STRIP);
-        for (int j = 0; j <= slices; j++) {
-            float theta = 2.0f * M_PI * float(j) / slices;
+    glDrawElements(GL_TRIANGLES, (GLsizei)meshIndexCount(mesh), GL_UNSIGNED_INT, indexBase);
+    frameTriangles += meshIndexCount(mesh) / 3;
 
-            // First vertex
-            float x = radius * sin(phi1) * cos(theta);
-            float y = radius * cos(phi1);
-            float z = radius * sin(phi1) * sin(theta);
-            glColor3f(1.0f, 0.0f, 0.0f);  // Red color
-            glNormal3f(x / radius, y / radius, z / radius);
-            glVertex3f(x, y, z);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
 
-            // Second vertex
-            x = radius * sin(phi2) * cos(theta);
-            y = radius * cos(phi2);
-            z = radius * sin(phi2) * sin(theta);
-            glNormal3f(x / radius, y / radius, z / radius);
-            glVertex3f(x, y, z);
-        }
-        glEnd();
+    if (mesh.uploaded) {
+        pglBindBuffer(GL_ARRAY_BUFFER, 0);
+        pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     }
 }
 
+
+void drawCube() {
+    drawMesh(getShapeMesh(CUBE));
+}
+
+void drawSphere() {
+    drawMesh(getShapeMesh(SPHERE, currentShapeLod));
+}
+
 // Function to draw a pyramid
 void drawPyramid() {
-    glBegin(GL_TRIANGLES);
-    // Front
-    glColor3f(1.0f, 0.0f, 0.0f);
-    glNormal3f(0.0f, 0.5f, 0.5f);
-    glVertex3f(0.0f, 0.5f, 0.0f);
-    glVertex3f(-0.5f, -0.5f, 0.5f);
-    glVertex3f(0.5f, -0.5f, 0.5f);
-
-    // Right
-    glColor3f(0.0f, 1.0f, 0.0f);
-    glNormal3f(0.5f, 0.5f, 0.0f);
-    glVertex3f(0.0f, 0.5f, 0.0f);
-    glVertex3f(0.5f, -0.5f, 0.5f);
-    glVertex3f(0.5f, -0.5f, -0.5f);
-
-    // Back
-    glColor3f(0.0f, 0.0f, 1.0f);
-    glNormal3f(0.0f, 0.5f, -0.5f);
-    glVertex3f(0.0f, 0.5f, 0.0f);
-    glVertex3f(0.5f, -0.5f, -0.5f);
-    glVertex3f(-0.5f, -0.5f, -0.5f);
-
-    // Left
-    glColor3f(1.0f, 1.0f, 0.0f);
-    glNormal3f(-0.5f, 0.5f, 0.0f);
-    glVertex3f(0.0f, 0.5f, 0.0f);
-    glVertex3f(-0.5f, -0.5f, -0.5f);
-    glVertex3f(-0.5f, -0.5f, 0.5f);
-    glEnd();
-
-    // Bottom
-    glBegin(GL_QUADS);
-    glColor3f(1.0f, 0.0f, 1.0f);
-    glNormal3f(0.0f, -1.0f, 0.0f);
-    glVertex3f(-0.5f, -0.5f, 0.5f);
-    glVertex3f(-0.5f, -0.5f, -0.5f);
-    glVertex3f(0.5f, -0.5f, -0.5f);
-    glVertex3f(0.5f, -0.5f, 0.5f);
-    glEnd();
+    drawMesh(getShapeMesh(PYRAMID));
 }
 
 void drawCylinder() {
-    const float radius = 0.5f;
-    const float height = 1.0f;
-    const int segments = 30;
-    
-    // Draw the sides
-    glBegin(GL_QUAD_STRIP);
-    for (int i = 0; i <= segments; i++) {
-        float theta = 2.0f * M_PI * float(i) / segments;
-        float x = radius * cos(theta);
-        float z = radius * sin(theta);
-        
-        glColor3f(0.0f, 0.0f, 1.0f);  // Cyan color
-        
-        // Normal for the side
-        glNormal3f(cos(theta), 0.0f, sin(theta));
-        
-        // Top vertex
-        glVertex3f(x, height/2, z);
-        // Bottom vertex
-        glVertex3f(x, -height/2, z);
-    }
-    glEnd();
-    
-
-    // Draw top and bottom circles
-    for (int side = 0; side < 2; side++) {
-        float y = (side == 0) ? height/2 : -height/2;
-        float normal_y = (side == 0) ? 1.0f : -1.0f;
-        glColor3f(0.0f, 1.0f, 0.0f);
-
-        glBegin(GL_TRIANGLE_FAN);
-        glNormal3f(0.0f, normal_y, 0.0f);
-        glVertex3f(0.0f, y, 0.0f);  // Center point
-        
-        for (int i = 0; i <= segments; i++) {
-            float theta = (side == 0) ? 
-                         -2.0f * M_PI * float(i) / segments :  
-                         2.0f * M_PI * float(i) / segments;    
-            
-            float x = radius * cos(theta);
-            float z = radius * sin(theta);
-            glVertex3f(x, y, z);
-        }
-        glEnd();
-    }
+    drawMesh(getShapeMesh(CYLINDER, currentShapeLod));
 }
 
 
@@ -608,441 +1391,4894 @@ void drawShape() {
     case CYLINDER:
         drawCylinder();
         break;
+    case IMPORTED:
+        drawMesh(getShapeMesh(IMPORTED));
+        break;
     }
 }
 
 
 
 
-void init() {
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+// GL side of the instanced scene mode; the instance set itself and its
+// per-frame composition live in Geometry.cpp
+GLuint instanceProgram = 0;
+GLuint instanceMatrixBuffer = 0;
+const GLuint instanceMatrixAttrib = 4;  // Uses attribute slots 4..7
+
+// Same light and material response as the fixed-function setup in init(),
+// with the per-instance model matrix applied before the modelview.
+const char* instanceVertexShader =
+    "#version 120\n"
+    "attribute vec4 vertexPosition;\n"
+    "attribute vec3 vertexNormal;\n"
+    "attribute vec3 vertexColor;\n"
+    "attribute mat4 instanceMatrix;\n"
+    "varying vec4 litColor;\n"
+    "void main() {\n"
+    "    vec4 eyePos = gl_ModelViewMatrix * (instanceMatrix * vertexPosition);\n"
+    "    gl_Position = gl_ProjectionMatrix * eyePos;\n"
+    "    mat3 m = mat3(gl_ModelViewMatrix) * mat3(instanceMatrix);\n"
+    "    vec3 c0 = cross(m[1], m[2]);\n"
+    "    mat3 cofactor = mat3(c0, cross(m[2], m[0]), cross(m[0], m[1]));\n"
+    "    vec3 n = normalize(cofactor * vertexNormal) * sign(dot(m[0], c0));\n"
+    "    vec3 l = normalize(gl_LightSource[0].position.xyz - eyePos.xyz);\n"
+    "    vec3 h = normalize(l + vec3(0.0, 0.0, 1.0));\n"
+    "    float diffuse = max(dot(n, l), 0.0);\n"
+    "    float specular = diffuse > 0.0 ? pow(max(dot(n, h), 0.0), gl_FrontMaterial.shininess) : 0.0;\n"
+    "    vec3 color = vertexColor * (gl_LightModel.ambient.rgb + gl_LightSource[0].ambient.rgb)\n"
+    "        + vertexColor * gl_LightSource[0].diffuse.rgb * diffuse\n"
+    "        + gl_FrontMaterial.specular.rgb * gl_LightSource[0].specular.rgb * specular;\n"
+    "    litColor = vec4(color, 1.0);\n"
+    "}\n";
+
+const char* instanceFragmentShader =
+    "#version 120\n"
+    "varying vec4 litColor;\n"
+    "void main() {\n"
+    "    gl_FragColor = litColor;\n"
+    "}\n";
+
+void initInstancing() {
+    if (!hasInstancing) return;
+
+    const char* attribs[] = { "vertexPosition", NULL, "vertexNormal", "vertexColor", "instanceMatrix" };
+    instanceProgram = linkProgram(instanceVertexShader, instanceFragmentShader, attribs, 5);
+    if (!instanceProgram) {
+        hasInstancing = false;
+        return;
+    }
+    pglGenBuffers(1, &instanceMatrixBuffer);
+}
 
-    
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
+// Batches are keyed by shape * lodLevelCount + level
+const int drawBatchCount = shapeTypeCount * lodLevelCount;
+
+// GL 3.3 core pipeline (--core): the 3D pass without immediate mode, client
+// arrays, fixed-function lighting or the matrix stack. Every mesh draw is an
+// instanced draw from a per-mesh VAO, using the same attribute slots as the
+// instancing shader; matrices and lighting come from one uniform buffer
+// (see initCorePipeline).
+struct CoreRenderer {
+    GLuint meshProgram = 0;
+    GLuint lineProgram = 0;
+    GLuint uniformBuffer = 0;
+    GLuint instanceBuffer = 0;
+    GLuint gridArray = 0;
+    GLuint gridBuffer = 0;
+    GLsizei gridLineVertices = 0;  // Followed by the 6 axis vertices
+};
 
-    // Enable lighting
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
-    glEnable(GL_COLOR_MATERIAL);
-    glColorMaterial(GL_FRONT, GL_AMBIENT_AND_DIFFUSE);
+CoreRenderer coreRenderer;
 
-    // Set up light
-    GLfloat light_position[] = { 10.0f, 10.0f, 10.0f, 1.0f };
-    GLfloat light_ambient[] = { 0.2f, 0.2f, 0.2f, 1.0f };
-    GLfloat light_diffuse[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    GLfloat light_specular[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+// Binds the mesh's VAO, creating it on first use. The instance matrix
+// pointers are left to the caller since they move with every batch.
+void bindCoreMeshArray(Mesh& mesh) {
+    if (mesh.vertexArray) {
+        pglBindVertexArray(mesh.vertexArray);
+        return;
+    }
 
-    glLightfv(GL_LIGHT0, GL_POSITION, light_position);
-    glLightfv(GL_LIGHT0, GL_AMBIENT, light_ambient);
-    glLightfv(GL_LIGHT0, GL_DIFFUSE, light_diffuse);
-    glLightfv(GL_LIGHT0, GL_SPECULAR, light_specular);
+    pglGenVertexArrays(1, &mesh.vertexArray);
+    pglBindVertexArray(mesh.vertexArray);
+    pglBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBuffer);
+    pglVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (const void*)offsetof(MeshVertex, position));
+    pglVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (const void*)offsetof(MeshVertex, normal));
+    pglVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (const void*)offsetof(MeshVertex, color));
+    pglEnableVertexAttribArray(0);
+    pglEnableVertexAttribArray(2);
+    pglEnableVertexAttribArray(3);
+    for (int col = 0; col < 4; col++) {
+        pglEnableVertexAttribArray(instanceMatrixAttrib + col);
+        pglVertexAttribDivisor(instanceMatrixAttrib + col, 1);
+    }
+    pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBuffer);
+}
 
-    
-    GLfloat mat_ambient[] = { 0.7f, 0.7f, 0.7f, 1.0f };
-    GLfloat mat_diffuse[] = { 0.8f, 0.8f, 0.8f, 1.0f };
-    GLfloat mat_specular[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    GLfloat mat_shininess[] = { 50.0f };
+void drawCoreBatches(const std::vector<float>& matrices, const size_t batchStart[drawBatchCount],
+    const size_t batchCount[drawBatchCount]) {
+    pglBindBuffer(GL_ARRAY_BUFFER, coreRenderer.instanceBuffer);
+    pglBufferData(GL_ARRAY_BUFFER, matrices.size() * sizeof(float), matrices.data(), GL_STREAM_DRAW);
+    pglUseProgram(coreRenderer.meshProgram);
+
+    for (int batch = 0; batch < drawBatchCount; batch++) {
+        if (batchCount[batch] == 0) continue;
+        pglBindVertexArray(0);  // A first-use upload rebinds GL_ELEMENT_ARRAY_BUFFER
+        Mesh& mesh = getShapeMesh((Shape)(batch / lodLevelCount), batch % lodLevelCount);
+        bindCoreMeshArray(mesh);
+
+        pglBindBuffer(GL_ARRAY_BUFFER, coreRenderer.instanceBuffer);
+        size_t offset = batchStart[batch] * 16 * sizeof(float);
+        for (int col = 0; col < 4; col++) {
+            pglVertexAttribPointer(instanceMatrixAttrib + col, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(float),
+                (const void*)(offset + col * 4 * sizeof(float)));
+        }
 
-    glMaterialfv(GL_FRONT, GL_AMBIENT, mat_ambient);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, mat_diffuse);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, mat_specular);
-    glMaterialfv(GL_FRONT, GL_SHININESS, mat_shininess);
+        pglDrawElementsInstanced(GL_TRIANGLES, (GLsizei)meshIndexCount(mesh), GL_UNSIGNED_INT, NULL,
+            (GLsizei)batchCount[batch]);
+        frameTriangles += batchCount[batch] * (meshIndexCount(mesh) / 3);
+    }
 
-    
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(45.0f, 800.0f / 700.0f, 0.1f, 100.0f);
-    glMatrixMode(GL_MODELVIEW);
+    pglBindVertexArray(0);
+    pglUseProgram(0);
+    pglBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-    // Modified button layout
-    float buttonWidth = 30;  // Increased width for better visibility
-    float buttonHeight = 30;
-    float padding = 10;
+// Draws column-major model matrices grouped by batch key: one instanced draw
+// call per Shape and level, or a per-matrix loop without instancing support
+void drawMatrixBatches(const std::vector<float>& matrices, const size_t batchStart[drawBatchCount],
+    const size_t batchCount[drawBatchCount]) {
+    if (corePipeline) {
+        drawCoreBatches(matrices, batchStart, batchCount);
+        return;
+    }
+    if (!hasInstancing) {
+        for (int batch = 0; batch < drawBatchCount; batch++) {
+            if (batchCount[batch] == 0) continue;
+            const Mesh& mesh = getShapeMesh((Shape)(batch / lodLevelCount), batch % lodLevelCount);
+            size_t end = batchStart[batch] + batchCount[batch];
+            for (size_t i = batchStart[batch]; i < end; i++) {
+                uploadCameraModelView(&matrices[i * 16]);
+                drawMesh(mesh);
+            }
+        }
+        return;
+    }
 
-    // Shape selection buttons - right side
-    float shapeStartX = 1550;
-    float shapeStartY = 1000;
+    pglBindBuffer(GL_ARRAY_BUFFER, instanceMatrixBuffer);
+    pglBufferData(GL_ARRAY_BUFFER, matrices.size() * sizeof(float), matrices.data(), GL_STREAM_DRAW);
+    pglUseProgram(instanceProgram);
+    pglEnableVertexAttribArray(0);
+    pglEnableVertexAttribArray(2);
+    pglEnableVertexAttribArray(3);
+    for (int col = 0; col < 4; col++) {
+        pglEnableVertexAttribArray(instanceMatrixAttrib + col);
+        pglVertexAttribDivisor(instanceMatrixAttrib + col, 1);
+    }
 
-    // Transformation buttons - left side
+    for (int batch = 0; batch < drawBatchCount; batch++) {
+        if (batchCount[batch] == 0) continue;
+        const Mesh& mesh = getShapeMesh((Shape)(batch / lodLevelCount), batch % lodLevelCount);
+
+        pglBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBuffer);
+        pglVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (const void*)offsetof(MeshVertex, position));
+        pglVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (const void*)offsetof(MeshVertex, normal));
+        pglVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (const void*)offsetof(MeshVertex, color));
+
+        pglBindBuffer(GL_ARRAY_BUFFER, instanceMatrixBuffer);
+        size_t offset = batchStart[batch] * 16 * sizeof(float);
+        for (int col = 0; col < 4; col++) {
+            pglVertexAttribPointer(instanceMatrixAttrib + col, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(float),
+                (const void*)(offset + col * 4 * sizeof(float)));
+        }
+
+        pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBuffer);
+        pglDrawElementsInstanced(GL_TRIANGLES, (GLsizei)meshIndexCount(mesh), GL_UNSIGNED_INT, NULL,
+            (GLsizei)batchCount[batch]);
+        frameTriangles += batchCount[batch] * (meshIndexCount(mesh) / 3);
+    }
+
+    for (int col = 0; col < 4; col++) {
+        pglVertexAttribDivisor(instanceMatrixAttrib + col, 0);
+        pglDisableVertexAttribArray(instanceMatrixAttrib + col);
+    }
+    pglDisableVertexAttribArray(3);
+    pglDisableVertexAttribArray(2);
+    pglDisableVertexAttribArray(0);
+    pglUseProgram(0);
+    pglBindBuffer(GL_ARRAY_BUFFER, 0);
+    pglBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+
+// Scene graph: nodes carry the same parameters the keyboard edits and cache
+// their local and world matrices. Nodes are stored in depth-first pre-order,
+// so a node's subtree is the contiguous range [index, index + subtreeSize)
+// and every parent precedes its children.
+struct SceneNode {
+    int parent;
+    int subtreeSize;
+    int depth;  // Root is 0
+    Shape shape;
+    float position[3];
+    float rotation[3];
+    float scale[3];
+    float shear[3];
+    bool reflection[3];
+    float local[4][4];
+    float world[4][4];
+    bool dirty;  // Local matrix stale; world matrices of the whole subtree stale
+};
+
+struct SceneGraph {
+    std::vector<SceneNode> nodes;
+    std::vector<int> dirtyRoots;  // Nodes marked dirty since the last update
+    std::vector<std::pair<int, int> > updatedRanges;  // [begin, end) refreshed by the last update
+    int selected = 0;
+
+    // Scratch for updateSceneWorldMatrices, kept to avoid per-frame allocations
+    std::vector<int> levelEnd;    // Per depth below the refreshed root
+    std::vector<int> levelNodes;  // Refreshed nodes grouped by depth
+    std::vector<Mat4> parentWorlds, locals, worlds;
+};
+
+SceneGraph scene;
+double sceneUpdateMs = 0.0;
+size_t sceneNodesUpdated = 0;
+
+void markSceneNodeDirty(int index) {
+    SceneNode& node = scene.nodes[index];
+    if (!node.dirty) {
+        node.dirty = true;
+        scene.dirtyRoots.push_back(index);
+    }
+}
+
+// Appends a node; nodes must be added in depth-first order, i.e. parent's
+// subtree must currently end at the back of the node array.
+int addSceneNode(int parent, Shape shape, const float pos[3], const float rot[3], const float scl[3]) {
+    SceneNode node = {};
+    node.parent = parent;
+    node.subtreeSize = 1;
+    node.depth = parent < 0 ? 0 : scene.nodes[parent].depth + 1;
+    node.shape = shape;
+    for (int k = 0; k < 3; k++) {
+        node.position[k] = pos[k];
+        node.rotation[k] = rot[k];
+        node.scale[k] = scl[k];
+    }
+    matrixIdentity(node.local);
+    matrixIdentity(node.world);
+
+    int index = (int)scene.nodes.size();
+    scene.nodes.push_back(node);
+    for (int p = parent; p >= 0; p = scene.nodes[p].parent) {
+        scene.nodes[p].subtreeSize++;
+    }
+    markSceneNodeDirty(index);
+    return index;
+}
+
+// Refreshes the subtree [root, end) one depth at a time. Nodes at the same
+// depth only depend on the level above, so each level is gathered into
+// contiguous arrays and multiplied in one matrixKernels->multiplyMany call.
+void updateSceneSubtree(int root, int end) {
+    int rootDepth = scene.nodes[root].depth;
+    int levels = 0;
+    for (int i = root; i < end; i++) {
+        SceneNode& node = scene.nodes[i];
+        if (node.dirty) {
+            composeTransformMatrix(node.position, node.rotation, node.scale, node.shear, node.reflection, node.local);
+            node.dirty = false;
+        }
+        levels = std::max(levels, node.depth - rootDepth + 1);
+    }
+
+    // Counting sort by depth; afterwards level l is [levelEnd[l - 1], levelEnd[l])
+    scene.levelEnd.assign(levels, 0);
+    for (int i = root; i < end; i++) scene.levelEnd[scene.nodes[i].depth - rootDepth]++;
+    for (int level = 1; level < levels; level++) scene.levelEnd[level] += scene.levelEnd[level - 1];
+    scene.levelNodes.resize(end - root);
+    for (int i = end - 1; i >= root; i--) scene.levelNodes[--scene.levelEnd[scene.nodes[i].depth - rootDepth]] = i;
+    for (int level = 0; level < levels; level++) {
+        scene.levelEnd[level] = level + 1 < levels ? scene.levelEnd[level + 1] : end - root;
+    }
+
+    SceneNode& top = scene.nodes[root];
+    if (top.parent < 0) {
+        memcpy(top.world, top.local, sizeof(top.world));
+    }
+    else {
+        matrixKernels->multiply(scene.nodes[top.parent].world, top.local, top.world);
+    }
+
+    for (int level = 1; level < levels; level++) {
+        int first = scene.levelEnd[level - 1];
+        size_t count = scene.levelEnd[level] - first;
+        scene.parentWorlds.resize(count);
+        scene.locals.resize(count);
+        scene.worlds.resize(count);
+        for (size_t n = 0; n < count; n++) {
+            const SceneNode& node = scene.nodes[scene.levelNodes[first + n]];
+            memcpy(scene.parentWorlds[n].m, scene.nodes[node.parent].world, sizeof(Mat4));
+            memcpy(scene.locals[n].m, node.local, sizeof(Mat4));
+        }
+        matrixKernels->multiplyMany(scene.parentWorlds.data(), scene.locals.data(), scene.worlds.data(), count);
+        for (size_t n = 0; n < count; n++) {
+            memcpy(scene.nodes[scene.levelNodes[first + n]].world, scene.worlds[n].m, sizeof(Mat4));
+        }
+    }
+}
+
+// Recomputes world matrices for dirty subtrees only. Called once per frame;
+// edits between frames just queue their node in dirtyRoots.
+void updateSceneWorldMatrices() {
+    auto start = std::chrono::steady_clock::now();
+    sceneNodesUpdated = 0;
+    scene.updatedRanges.clear();
+
+    std::sort(scene.dirtyRoots.begin(), scene.dirtyRoots.end());
+    int coveredEnd = 0;
+    for (int root : scene.dirtyRoots) {
+        if (root < coveredEnd) continue;  // Inside a subtree already refreshed
+        int end = root + scene.nodes[root].subtreeSize;
+        updateSceneSubtree(root, end);
+        sceneNodesUpdated += end - root;
+        scene.updatedRanges.push_back(std::make_pair(root, end));
+        coveredEnd = end;
+    }
+    scene.dirtyRoots.clear();
+
+    sceneUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The keyboard edits the global parameters; these keep them bound to the
+// selected node.
+void loadSelectedSceneNode() {
+    const SceneNode& node = scene.nodes[scene.selected];
+    for (int k = 0; k < 3; k++) {
+        position[k] = node.position[k];
+        rotation[k] = node.rotation[k];
+        scale[k] = node.scale[k];
+        shear[k] = node.shear[k];
+        reflection[k] = node.reflection[k];
+    }
+    markTransformDirty(DIRTY_ALL);
+}
+
+void storeSelectedSceneNode() {
+    SceneNode& node = scene.nodes[scene.selected];
+    for (int k = 0; k < 3; k++) {
+        node.position[k] = position[k];
+        node.rotation[k] = rotation[k];
+        node.scale[k] = scale[k];
+        node.shear[k] = shear[k];
+        node.reflection[k] = reflection[k];
+    }
+    markSceneNodeDirty(scene.selected);
+}
+
+void selectSceneNode(int index) {
+    int count = (int)scene.nodes.size();
+    scene.selected = ((index % count) + count) % count;
+    loadSelectedSceneNode();
+}
+
+// Demo hierarchy: every node has up to four children orbiting it at half scale
+void addDemoSubtree(int parent, int depth, size_t& remaining) {
+    const float offsets[4][3] = { {1.5f, 0, 0}, {-1.5f, 0, 0}, {0, 0, 1.5f}, {0, 0, -1.5f} };
+    const float childScale[3] = { 0.5f, 0.5f, 0.5f };
+    for (int c = 0; c < 4 && remaining > 0; c++) {
+        float rot[3] = { 0.0f, 45.0f * c, 0.0f };
+        int child = addSceneNode(parent, (Shape)((depth + c) % builtinShapeCount), offsets[c], rot, childScale);
+        remaining--;
+        if (depth > 1) addDemoSubtree(child, depth - 1, remaining);
+    }
+}
+
+void buildDemoScene(size_t count) {
+    scene = SceneGraph();
+    if (count == 0) {
+        sceneMode = false;
+        return;
+    }
+
+    // Smallest depth whose complete 4-ary tree holds count nodes
+    int depth = 0;
+    for (size_t capacity = 1; capacity < count; capacity = capacity * 4 + 1) depth++;
+
+    const float origin[3] = { 0.0f, 0.0f, 0.0f };
+    const float unit[3] = { 1.0f, 1.0f, 1.0f };
+    addSceneNode(-1, CUBE, origin, origin, unit);
+    size_t remaining = count - 1;
+    addDemoSubtree(0, depth, remaining);
+
+    sceneMode = true;
+    selectSceneNode(0);
+}
+
+
+// Frustum culling. Every instance or scene node gets a world-space AABB of
+// its transformed shape, kept in a BVH that is refit in place as objects move
+// and traversed against the camera frustum each frame.
+struct AABB {
+    float min[3];
+    float max[3];
+};
+
+struct BVHNode {
+    AABB bounds;
+    int parent;
+    int left, right;    // Children, -1 for leaves
+    int first, count;   // Range in BVH::objects for leaves
+};
+
+// Nodes are allocated parent-first, so iterating backwards visits children
+// before their parents.
+struct BVH {
+    std::vector<BVHNode> nodes;
+    std::vector<int> objects;     // Object indices, grouped by leaf
+    std::vector<int> objectLeaf;  // Leaf node holding each object
+};
+
+struct CullSet {
+    std::vector<AABB> objectBounds;
+    std::vector<unsigned char> objectShape;
+    BVH bvh;
+    bool built = false;
+    std::vector<unsigned char> objectLod;  // Last chosen level, for hysteresis
+    std::vector<int> visible;
+    std::vector<float> matrices;  // Column-major matrices of visible objects, grouped by batch
+    size_t batchStart[drawBatchCount] = {};
+    size_t batchCount[drawBatchCount] = {};
+    size_t lodCount[lodLevelCount] = {};
+    size_t drawn = 0;
+    size_t culled = 0;
+    double cullMs = 0.0;
+};
+
+CullSet culling;
+bool cullingEnabled = true;
+const int bvhLeafSize = 4;
+
+AABB importedMeshBounds = { { -0.5f, -0.5f, -0.5f }, { 0.5f, 0.5f, 0.5f } };
+
+// Object-space bounds of a Shape; all built-in shapes fit the unit cube and
+// an imported mesh is scaled to fit it on load
+AABB getShapeBounds(Shape shape) {
+    if (shape == IMPORTED) return importedMeshBounds;
+    AABB box = { { -0.5f, -0.5f, -0.5f }, { 0.5f, 0.5f, 0.5f } };
+    return box;
+}
+
+// Exact AABB of a transformed box: center maps through the matrix and each
+// half extent grows by |L| row-wise, so shear and reflection are covered.
+// m is row-major, or column-major when columnMajor is set.
+void transformBounds(const float* m, bool columnMajor, const AABB& local, AABB& result) {
+    for (int i = 0; i < 3; i++) {
+        float center = m[columnMajor ? 12 + i : i * 4 + 3];
+        float extent = 0.0f;
+        for (int j = 0; j < 3; j++) {
+            float l = m[columnMajor ? j * 4 + i : i * 4 + j];
+            float c = 0.5f * (local.min[j] + local.max[j]);
+            float e = 0.5f * (local.max[j] - local.min[j]);
+            center += l * c;
+            extent += fabs(l) * e;
+        }
+        result.min[i] = center - extent;
+        result.max[i] = center + extent;
+    }
+}
+
+void mergeBounds(AABB& a, const AABB& b) {
+    for (int k = 0; k < 3; k++) {
+        a.min[k] = std::min(a.min[k], b.min[k]);
+        a.max[k] = std::max(a.max[k], b.max[k]);
+    }
+}
+
+int buildBVHNode(BVH& bvh, const std::vector<AABB>& bounds, int first, int count, int parent) {
+    int index = (int)bvh.nodes.size();
+    bvh.nodes.push_back(BVHNode());
+    BVHNode node;
+    node.parent = parent;
+    node.left = node.right = -1;
+    node.first = first;
+    node.count = count;
+    node.bounds = bounds[bvh.objects[first]];
+    AABB centroids;
+    for (int k = 0; k < 3; k++) {
+        centroids.min[k] = centroids.max[k] = 0.5f * (node.bounds.min[k] + node.bounds.max[k]);
+    }
+    for (int i = first + 1; i < first + count; i++) {
+        const AABB& b = bounds[bvh.objects[i]];
+        mergeBounds(node.bounds, b);
+        for (int k = 0; k < 3; k++) {
+            float c = 0.5f * (b.min[k] + b.max[k]);
+            centroids.min[k] = std::min(centroids.min[k], c);
+            centroids.max[k] = std::max(centroids.max[k], c);
+        }
+    }
+
+    if (count > bvhLeafSize) {
+        // Median split along the longest centroid axis
+        int axis = 0;
+        for (int k = 1; k < 3; k++) {
+            if (centroids.max[k] - centroids.min[k] > centroids.max[axis] - centroids.min[axis]) axis = k;
+        }
+        int half = count / 2;
+        std::nth_element(bvh.objects.begin() + first, bvh.objects.begin() + first + half,
+            bvh.objects.begin() + first + count, [&](int a, int b) {
+                return bounds[a].min[axis] + bounds[a].max[axis] < bounds[b].min[axis] + bounds[b].max[axis];
+            });
+        node.count = 0;
+        node.left = buildBVHNode(bvh, bounds, first, half, index);
+        node.right = buildBVHNode(bvh, bounds, first + half, count - half, index);
+    }
+    else {
+        for (int i = first; i < first + count; i++) {
+            bvh.objectLeaf[bvh.objects[i]] = index;
+        }
+    }
+    bvh.nodes[index] = node;
+    return index;
+}
+
+void buildBVH(BVH& bvh, const std::vector<AABB>& bounds) {
+    bvh.nodes.clear();
+    bvh.objects.resize(bounds.size());
+    bvh.objectLeaf.resize(bounds.size());
+    for (size_t i = 0; i < bounds.size(); i++) bvh.objects[i] = (int)i;
+    if (!bounds.empty()) buildBVHNode(bvh, bounds, 0, (int)bounds.size(), -1);
+}
+
+void refitBVHNode(BVH& bvh, const std::vector<AABB>& bounds, int index) {
+    BVHNode& node = bvh.nodes[index];
+    if (node.left < 0) {
+        node.bounds = bounds[bvh.objects[node.first]];
+        for (int i = node.first + 1; i < node.first + node.count; i++) {
+            mergeBounds(node.bounds, bounds[bvh.objects[i]]);
+        }
+    }
+    else {
+        node.bounds = bvh.nodes[node.left].bounds;
+        mergeBounds(node.bounds, bvh.nodes[node.right].bounds);
+    }
+}
+
+void refitBVH(BVH& bvh, const std::vector<AABB>& bounds) {
+    for (int i = (int)bvh.nodes.size() - 1; i >= 0; i--) {
+        refitBVHNode(bvh, bounds, i);
+    }
+}
+
+// Refits the leaf of one moved object and its ancestors, stopping as soon as
+// a node's bounds come out unchanged
+void refitBVHObject(BVH& bvh, const std::vector<AABB>& bounds, int object) {
+    for (int index = bvh.objectLeaf[object]; index >= 0; index = bvh.nodes[index].parent) {
+        AABB before = bvh.nodes[index].bounds;
+        refitBVHNode(bvh, bounds, index);
+        if (memcmp(&before, &bvh.nodes[index].bounds, sizeof(AABB)) == 0) break;
+    }
+}
+
+// Frustum planes (a, b, c, d), inside when a*x + b*y + c*z + d >= 0, for the
+// current projection and camera times an optional model matrix
+void extractFrustumPlanes(const float model[4][4], float planes[6][4]) {
+    float clip[4][4];
+    updateCamera();
+    matrixKernels->multiply(camera.projection, camera.view, clip);
+    if (model) {
+        matrixKernels->multiply(clip, model, clip);
+    }
+
+    for (int p = 0; p < 6; p++) {
+        int row = p / 2;
+        float sign = (p % 2 == 0) ? 1.0f : -1.0f;
+        for (int k = 0; k < 4; k++) {
+            planes[p][k] = clip[3][k] + sign * clip[row][k];
+        }
+    }
+}
+
+// Plane test for a box: -1 outside, 0 intersecting, 1 fully inside
+int classifyBounds(const AABB& bounds, const float planes[6][4]) {
+    int result = 1;
+    for (int p = 0; p < 6; p++) {
+        const float* plane = planes[p];
+        float centerDist = plane[3];
+        float radius = 0.0f;
+        for (int k = 0; k < 3; k++) {
+            centerDist += plane[k] * 0.5f * (bounds.min[k] + bounds.max[k]);
+            radius += fabs(plane[k]) * 0.5f * (bounds.max[k] - bounds.min[k]);
+        }
+        if (centerDist + radius < 0.0f) return -1;
+        if (centerDist - radius < 0.0f) result = 0;
+    }
+    return result;
+}
+
+// Collects objects whose bounds intersect the frustum. Subtrees entirely
+// inside are accepted without testing their children; objects in partially
+// visible leaves are tested individually.
+void cullBVH(const BVH& bvh, const std::vector<AABB>& bounds, const float planes[6][4], std::vector<int>& visible) {
+    visible.clear();
+    if (bvh.nodes.empty()) return;
+
+    int stack[64];
+    bool insideStack[64];
+    int top = 0;
+    stack[top] = 0;
+    insideStack[top++] = false;
+    while (top > 0) {
+        top--;
+        const BVHNode& node = bvh.nodes[stack[top]];
+        bool inside = insideStack[top];
+
+        if (!inside) {
+            int classification = classifyBounds(node.bounds, planes);
+            if (classification < 0) continue;
+            inside = classification > 0;
+        }
+
+        if (node.left < 0) {
+            for (int i = node.first; i < node.first + node.count; i++) {
+                int object = bvh.objects[i];
+                if (inside || classifyBounds(bounds[object], planes) >= 0) {
+                    visible.push_back(object);
+                }
+            }
+        }
+        else {
+            stack[top] = node.right;
+            insideStack[top++] = inside;
+            stack[top] = node.left;
+            insideStack[top++] = inside;
+        }
+    }
+}
+
+// Screen-space level of detail: curved shapes pick a tessellation level from
+// their projected bounding-sphere radius in pixels. A level is entered only
+// once the radius clears its threshold by lodHysteresis and left only once it
+// falls the same margin below, so objects near a boundary do not pop.
+const float lodThresholds[lodLevelCount] = { 0.0f, 8.0f, 24.0f, 80.0f };  // Min pixel radius per level
+const float lodHysteresis = 0.15f;
+
+float lodViewMatrix[4][4];  // View times the objects' parent transform
+float lodPixelScale = 1.0f; // Pixels per unit of radius at unit distance
+
+void beginLodFrame(const float parent[4][4]) {
+    updateCamera();
+    if (parent) {
+        matrixKernels->multiply(camera.view, parent, lodViewMatrix);
+    }
+    else {
+        memcpy(lodViewMatrix, camera.view, sizeof(camera.view));
+    }
+    lodPixelScale = viewportHeight / (2.0f * tan(cameraFovy * M_PI / 360.0f));
+}
+
+int chooseLod(float pixelRadius, int current) {
+    int level = current;
+    while (level + 1 < lodLevelCount && pixelRadius > lodThresholds[level + 1] * (1.0f + lodHysteresis)) level++;
+    while (level > 0 && pixelRadius < lodThresholds[level] * (1.0f - lodHysteresis)) level--;
+    return level;
+}
+
+// Projected bounding-sphere radius of a shape drawn with model matrix m
+float projectedRadius(Shape shape, const float* m, bool columnMajor) {
+    AABB box = getShapeBounds(shape);
+    float radius = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        float half = 0.5f * (box.max[k] - box.min[k]);
+        radius += half * half;
+    }
+    radius = sqrt(radius);
+
+    // Largest column length of (view * parent * m) bounds the stretch
+    float eye[3], scale = 0.0f;
+    for (int col = 0; col < 4; col++) {
+        float v[3];
+        for (int i = 0; i < 3; i++) {
+            v[i] = 0.0f;
+            for (int k = 0; k < 4; k++) {
+                v[i] += lodViewMatrix[i][k] * m[columnMajor ? col * 4 + k : k * 4 + col];
+            }
+        }
+        if (col < 3) {
+            scale = std::max(scale, v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        }
+        else {
+            // Translation column with w = 1 lands on the object's eye-space center
+            for (int i = 0; i < 3; i++) eye[i] = v[i];
+        }
+    }
+    float distance = std::max(0.1f, (float)sqrt(eye[0] * eye[0] + eye[1] * eye[1] + eye[2] * eye[2]));
+    return radius * sqrt(scale) * lodPixelScale / distance;
+}
+
+void updateCurrentShapeLod() {
+    beginLodFrame(NULL);
+    if (shapeHasLod(currentShape)) {
+        currentShapeLod = chooseLod(projectedRadius(currentShape, transformMatrix[0], false), currentShapeLod);
+    }
+}
+
+// Gathers the visible objects' matrices grouped by Shape and level for
+// drawMatrixBatches; matrixOf(object) returns that object's 16 floats
+template <typename MatrixOf>
+void gatherVisibleMatrices(MatrixOf matrixOf, bool columnMajor) {
+    CullSet& c = culling;
+    for (int batch = 0; batch < drawBatchCount; batch++) c.batchCount[batch] = 0;
+    for (int level = 0; level < lodLevelCount; level++) c.lodCount[level] = 0;
+    for (int object : c.visible) {
+        Shape shape = (Shape)c.objectShape[object];
+        int level = 0;
+        if (shapeHasLod(shape)) {
+            level = chooseLod(projectedRadius(shape, matrixOf(object), columnMajor), c.objectLod[object]);
+            c.objectLod[object] = (unsigned char)level;
+            c.lodCount[level]++;
+        }
+        c.batchCount[shape * lodLevelCount + level]++;
+    }
+    size_t cursor[drawBatchCount];
+    size_t start = 0;
+    for (int batch = 0; batch < drawBatchCount; batch++) {
+        c.batchStart[batch] = cursor[batch] = start;
+        start += c.batchCount[batch];
+    }
+
+    c.matrices.resize(c.visible.size() * 16);
+    for (int object : c.visible) {
+        int batch = c.objectShape[object] * lodLevelCount + (shapeHasLod((Shape)c.objectShape[object]) ? c.objectLod[object] : 0);
+        float(*out)[4] = (float(*)[4])&c.matrices[cursor[batch]++ * 16];
+        const float(*in)[4] = (const float(*)[4])matrixOf(object);
+        if (columnMajor) {
+            memcpy(out, in, 16 * sizeof(float));
+        }
+        else {
+            matrixKernels->transpose(in, out);
+        }
+    }
+    c.drawn = c.visible.size();
+}
+
+void resizeCullObjects(size_t count) {
+    CullSet& c = culling;
+    if (c.objectShape.size() != count) {
+        c.objectBounds.resize(count);
+        c.objectShape.resize(count);
+        c.objectLod.assign(count, defaultLodLevel);
+        c.built = false;
+    }
+}
+
+void selectAllObjects(size_t count) {
+    culling.visible.resize(count);
+    for (size_t i = 0; i < count; i++) culling.visible[i] = (int)i;
+}
+
+// Instances move every frame, so when culling all bounds are recomputed and
+// the whole tree is refit; the keyboard transform is folded into the frustum.
+void drawInstances() {
+    auto start = std::chrono::steady_clock::now();
+    CullSet& c = culling;
+    resizeCullObjects(instances.count);
+    for (int shape = 0; shape < builtinShapeCount; shape++) {
+        for (size_t i = instances.shapeStart[shape]; i < instances.shapeStart[shape] + instances.shapeCount[shape]; i++) {
+            c.objectShape[i] = (unsigned char)shape;
+        }
+    }
+
+    if (cullingEnabled) {
+        for (size_t i = 0; i < instances.count; i++) {
+            transformBounds(&instances.matrices[i * 16], true, getShapeBounds((Shape)c.objectShape[i]), c.objectBounds[i]);
+        }
+        if (!c.built) {
+            buildBVH(c.bvh, c.objectBounds);
+            c.built = true;
+        }
+        else {
+            refitBVH(c.bvh, c.objectBounds);
+        }
+
+        float planes[6][4];
+        extractFrustumPlanes(transformMatrix, planes);
+        cullBVH(c.bvh, c.objectBounds, planes, c.visible);
+    }
+    else {
+        selectAllObjects(instances.count);
+    }
+
+    beginLodFrame(transformMatrix);
+    gatherVisibleMatrices([](int i) { return &instances.matrices[i * 16]; }, true);
+    c.culled = instances.count - c.drawn;
+    c.cullMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    drawMatrixBatches(c.matrices, c.batchStart, c.batchCount);
+}
+
+// Scene nodes only move when edited, so only the subtrees refreshed by
+// updateSceneWorldMatrices() get new bounds and an incremental refit.
+void drawScene() {
+    updateSceneWorldMatrices();
+
+    auto start = std::chrono::steady_clock::now();
+    CullSet& c = culling;
+    size_t count = scene.nodes.size();
+    resizeCullObjects(count);
+
+    if (cullingEnabled) {
+        if (!c.built) {
+            for (size_t i = 0; i < count; i++) {
+                c.objectShape[i] = (unsigned char)scene.nodes[i].shape;
+                transformBounds(scene.nodes[i].world[0], false, getShapeBounds(scene.nodes[i].shape), c.objectBounds[i]);
+            }
+            buildBVH(c.bvh, c.objectBounds);
+            c.built = true;
+        }
+        else {
+            size_t moved = 0;
+            for (const std::pair<int, int>& range : scene.updatedRanges) moved += range.second - range.first;
+            bool fullRefit = moved > count / 8;
+            for (const std::pair<int, int>& range : scene.updatedRanges) {
+                for (int i = range.first; i < range.second; i++) {
+                    transformBounds(scene.nodes[i].world[0], false, getShapeBounds(scene.nodes[i].shape), c.objectBounds[i]);
+                    if (!fullRefit) refitBVHObject(c.bvh, c.objectBounds, i);
+                }
+            }
+            if (fullRefit) refitBVH(c.bvh, c.objectBounds);
+        }
+
+        float planes[6][4];
+        extractFrustumPlanes(NULL, planes);
+        cullBVH(c.bvh, c.objectBounds, planes, c.visible);
+    }
+    else {
+        // Bounds are not maintained while culling is off; rebuild on re-enable
+        for (size_t i = 0; i < count; i++) c.objectShape[i] = (unsigned char)scene.nodes[i].shape;
+        c.built = false;
+        selectAllObjects(count);
+    }
+
+    beginLodFrame(NULL);
+    gatherVisibleMatrices([](int i) { return scene.nodes[i].world[0]; }, false);
+    c.culled = count - c.drawn;
+    c.cullMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    drawMatrixBatches(c.matrices, c.batchStart, c.batchCount);
+}
+
+
+// Frame timing for the HUD readout, smoothed over recent frames
+std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+std::chrono::steady_clock::time_point lastFrameTime = startTime;
+double frameMs = 0.0;
+
+void updateFrameTiming() {
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double, std::milli>(now - lastFrameTime).count();
+    lastFrameTime = now;
+    frameMs = (frameMs == 0.0) ? elapsed : frameMs * 0.9 + elapsed * 0.1;
+}
+
+// Input replay (--replay) runs input and animation on a virtual clock that
+// advances by a fixed step per frame instead of the wall clock
+bool replayClockActive = false;
+std::chrono::steady_clock::time_point replayClock;
+
+std::chrono::steady_clock::time_point inputClockNow() {
+    return replayClockActive ? replayClock : std::chrono::steady_clock::now();
+}
+
+float secondsSinceStart() {
+    return std::chrono::duration<float>(inputClockNow() - startTime).count();
+}
+
+
+
+
+// Fixed-function lighting shared by init() and the software rasterizer. The
+// light is specified with an identity modelview, so it is in eye space.
+const GLfloat lightPosition[] = { 10.0f, 10.0f, 10.0f, 1.0f };
+const GLfloat lightAmbient[] = { 0.2f, 0.2f, 0.2f, 1.0f };
+const GLfloat lightDiffuse[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+const GLfloat lightSpecular[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+const GLfloat sceneAmbient = 0.2f;  // GL_LIGHT_MODEL_AMBIENT default
+const GLfloat materialSpecular[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+const GLfloat materialShininess = 50.0f;
+
+// Work-stealing thread pool. parallelFor() splits tasks into contiguous
+// per-worker deques; each worker pops from the back of its own deque and
+// steals from the front of the others once it runs dry. The calling thread
+// is worker 0. The job is called through a plain function pointer and a
+// pointer to the caller's closure, so dispatching allocates nothing.
+struct WorkerQueue {
+    std::mutex lock;
+    std::deque<int> tasks;
+};
+
+struct ThreadPool {
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    void (*job)(const void* context, int task, int worker) = NULL;  // Set during parallelFor()
+    const void* jobContext = NULL;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    unsigned int generation = 0;
+    int activeWorkers = 0;
+    bool stopping = false;
+};
+
+ThreadPool rasterPool;
+
+bool popTask(int worker, int& task) {
+    int workerCount = (int)rasterPool.queues.size();
+    for (int i = 0; i < workerCount; i++) {
+        WorkerQueue& queue = *rasterPool.queues[(worker + i) % workerCount];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty()) continue;
+        if (i == 0) {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        }
+        else {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void runPoolTasks(int worker) {
+    int task;
+    while (popTask(worker, task)) {
+        rasterPool.job(rasterPool.jobContext, task, worker);
+    }
+}
+
+void poolWorker(int worker) {
+    unsigned int seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(rasterPool.lock);
+            rasterPool.wake.wait(guard, [&]() { return rasterPool.stopping || rasterPool.generation != seen; });
+            if (rasterPool.stopping) return;
+            seen = rasterPool.generation;
+        }
+        runPoolTasks(worker);
+        std::lock_guard<std::mutex> guard(rasterPool.lock);
+        if (--rasterPool.activeWorkers == 0) {
+            rasterPool.done.notify_one();
+        }
+    }
+}
+
+void stopThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(rasterPool.lock);
+        rasterPool.stopping = true;
+    }
+    rasterPool.wake.notify_all();
+    for (std::thread& thread : rasterPool.threads) thread.join();
+    rasterPool.threads.clear();
+    rasterPool.queues.clear();
+    rasterPool.stopping = false;
+}
+
+void startThreadPool(int workers) {
+    static bool registered = false;
+    if (!registered) {
+        atexit(stopThreadPool);  // Joinable threads must not outlive main
+        registered = true;
+    }
+    stopThreadPool();
+    for (int i = 0; i < std::max(1, workers); i++) {
+        rasterPool.queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+    }
+    for (int i = 1; i < workers; i++) {
+        rasterPool.threads.push_back(std::thread(poolWorker, i));
+    }
+}
+
+int poolWorkerCount() {
+    return (int)rasterPool.queues.size();
+}
+
+void runParallelFor(int taskCount, void (*job)(const void* context, int task, int worker), const void* context) {
+    if (rasterPool.queues.empty()) startThreadPool(1);
+    int workers = poolWorkerCount();
+    for (int w = 0; w < workers; w++) {
+        WorkerQueue& queue = *rasterPool.queues[w];
+        for (int task = taskCount * w / workers; task < taskCount * (w + 1) / workers; task++) {
+            queue.tasks.push_back(task);
+        }
+    }
+    rasterPool.job = job;
+    rasterPool.jobContext = context;
+    if (workers > 1) {
+        std::lock_guard<std::mutex> guard(rasterPool.lock);
+        rasterPool.activeWorkers = workers - 1;
+        rasterPool.generation++;
+    }
+    rasterPool.wake.notify_all();
+    runPoolTasks(0);
+
+    std::unique_lock<std::mutex> guard(rasterPool.lock);
+    rasterPool.done.wait(guard, []() { return rasterPool.activeWorkers == 0; });
+}
+
+// Runs job(task, worker) for each task in [0, taskCount) and returns once all are done
+template <typename Job>
+void parallelFor(int taskCount, const Job& job) {
+    runParallelFor(taskCount, [](const void* context, int task, int worker) {
+        (*(const Job*)context)(task, worker);
+    }, &job);
+}
+
+// Mesh import (--mesh FILE). OBJ and binary PLY files are memory-mapped and
+// parsed in parallel chunks straight into the MeshVertex/index layout of the
+// IMPORTED shape, then centered and scaled to fit the unit cube like the
+// built-in shapes. Bulk data is read in place, never copied into strings.
+std::string meshPath;
+const size_t objChunkBytes = 1 << 20;
+const size_t plyChunkRecords = 1 << 16;
+const float importedMeshColor[3] = { 0.8f, 0.8f, 0.8f };
+
+struct MappedFile {
+    const char* data = NULL;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#endif
+};
+
+void unmapFile(MappedFile& mapped) {
+#ifdef _WIN32
+    if (mapped.data) UnmapViewOfFile(mapped.data);
+    if (mapped.mapping) CloseHandle(mapped.mapping);
+    if (mapped.file != INVALID_HANDLE_VALUE) CloseHandle(mapped.file);
+#else
+    if (mapped.data) munmap((void*)mapped.data, mapped.size);
+#endif
+    mapped = MappedFile();
+}
+
+bool mapFile(const char* path, MappedFile& mapped) {
+#ifdef _WIN32
+    // Every failure path releases whatever handles were opened before it
+    mapped.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (mapped.file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mapped.file, &size) || size.QuadPart == 0) {
+        unmapFile(mapped);
+        return false;
+    }
+    mapped.size = (size_t)size.QuadPart;
+    mapped.mapping = CreateFileMappingA(mapped.file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapped.mapping) {
+        unmapFile(mapped);
+        return false;
+    }
+    mapped.data = (const char*)MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!mapped.data) {
+        unmapFile(mapped);
+        return false;
+    }
+    return true;
+#else
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) return false;
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 || info.st_size == 0) {
+        close(descriptor);
+        return false;
+    }
+    void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);  // The mapping keeps the file open
+    if (data == MAP_FAILED) return false;
+    mapped.data = (const char*)data;
+    mapped.size = (size_t)info.st_size;
+    return true;
+#endif
+}
+
+// Peak resident set size of the process in megabytes
+double peakResidentMB() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0.0;
+    return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;  // Kilobytes on Linux
+#endif
+}
+
+// Number parsing bounded by end, since mapped text is not NUL-terminated
+const char* skipMeshSpaces(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+const char* parseMeshInt(const char* p, const char* end, long long& value) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    const char* digits = p;
+    long long v = 0;
+    while (p < end && *p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+    if (p == digits) return NULL;
+    value = negative ? -v : v;
+    return p;
+}
+
+const char* parseMeshFloat(const char* p, const char* end, float& value) {
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    const char* digits = p;
+    unsigned long long mantissa = 0;
+    int significant = 0, exponent = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (significant < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa) significant++;
+        }
+        else {
+            exponent++;
+        }
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (significant < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa) significant++;
+                exponent--;
+            }
+            p++;
+        }
+    }
+    if (p == digits || (p == digits + 1 && *digits == '.')) return NULL;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        long long e;
+        const char* after = parseMeshInt(p + 1, end, e);
+        if (after) {
+            exponent += (int)std::max(-400LL, std::min(400LL, e));
+            p = after;
+        }
+    }
+    double v = (double)mantissa;
+    if (exponent >= 0) v *= exponent <= 22 ? powers[exponent] : pow(10.0, exponent);
+    else v /= exponent >= -22 ? powers[-exponent] : pow(10.0, -exponent);
+    value = (float)(negative ? -v : v);
+    return p;
+}
+
+// Area-weighted vertex normals from the triangles, for vertices flagged in
+// missing (every vertex when missing is empty)
+void computeMeshNormals(Mesh& mesh, const std::vector<unsigned char>& missing) {
+    std::vector<MeshVertex>& v = mesh.vertices;
+    for (size_t i = 0; i < v.size(); i++) {
+        if (missing.empty() || missing[i]) v[i].normal[0] = v[i].normal[1] = v[i].normal[2] = 0.0f;
+    }
+    for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+        const unsigned int* tri = &mesh.indices[t];
+        const float* a = v[tri[0]].position;
+        const float* b = v[tri[1]].position;
+        const float* c = v[tri[2]].position;
+        float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+        float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+        for (int k = 0; k < 3; k++) {
+            if (!missing.empty() && !missing[tri[k]]) continue;
+            for (int i = 0; i < 3; i++) v[tri[k]].normal[i] += n[i];
+        }
+    }
+    for (size_t i = 0; i < v.size(); i++) {
+        if (!missing.empty() && !missing[i]) continue;
+        float* n = v[i].normal;
+        float length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length > 0.0f) {
+            n[0] /= length;
+            n[1] /= length;
+            n[2] /= length;
+        }
+        else {
+            n[1] = 1.0f;
+        }
+    }
+}
+
+// One chunk of an OBJ file. Face corners are (position, normal) index pairs,
+// three per triangle with polygons fanned; normal is -1 when absent. Negative
+// (relative) OBJ indices resolve against the chunk's own counts, and the
+// entries listed in relative get the chunk base added once all are parsed.
+struct ObjChunk {
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<int> corners;
+    std::vector<size_t> relative;
+    size_t positionBase = 0;
+    size_t normalBase = 0;
+    const char* error = NULL;  // Start of the first bad line
+};
+
+struct ObjIndex {
+    int index;
+    bool relative;
+};
+
+bool resolveObjIndex(long long value, size_t localCount, ObjIndex& result) {
+    if (value == 0) return false;
+    result.index = (int)(value > 0 ? value - 1 : (long long)localCount + value);
+    result.relative = value < 0;
+    return true;
+}
+
+void addObjCorner(ObjChunk& chunk, const ObjIndex corner[2]) {
+    for (int k = 0; k < 2; k++) {
+        if (corner[k].relative) chunk.relative.push_back(chunk.corners.size());
+        chunk.corners.push_back(corner[k].index);
+    }
+}
+
+// Parses "f v v/vt v//vn v/vt/vn ..." and fans it into triangles
+bool parseObjFace(const char* p, const char* end, ObjChunk& chunk) {
+    ObjIndex first[2], previous[2];
+    int count = 0;
+    for (;;) {
+        p = skipMeshSpaces(p, end);
+        if (p >= end || *p == '#') break;
+        ObjIndex corner[2] = { { -1, false }, { -1, false } };
+        long long value;
+        p = parseMeshInt(p, end, value);
+        if (!p || !resolveObjIndex(value, chunk.positions.size() / 3, corner[0])) return false;
+        if (p < end && *p == '/') {
+            p++;
+            if (p < end && *p != '/') {
+                p = parseMeshInt(p, end, value);  // Texture coordinates are not used
+                if (!p) return false;
+            }
+            if (p < end && *p == '/') {
+                p = parseMeshInt(p + 1, end, value);
+                if (!p || !resolveObjIndex(value, chunk.normals.size() / 3, corner[1])) return false;
+            }
+        }
+        if (count == 0) {
+            first[0] = corner[0];
+            first[1] = corner[1];
+        }
+        else if (count >= 2) {
+            addObjCorner(chunk, first);
+            addObjCorner(chunk, previous);
+            addObjCorner(chunk, corner);
+        }
+        previous[0] = corner[0];
+        previous[1] = corner[1];
+        count++;
+    }
+    return count >= 3;
+}
+
+bool parseObjVector(const char* p, const char* end, std::vector<float>& out) {
+    for (int k = 0; k < 3; k++) {
+        float value;
+        p = parseMeshFloat(skipMeshSpaces(p, end), end, value);
+        if (!p) return false;
+        out.push_back(value);
+    }
+    return true;
+}
+
+void parseObjChunk(const char* p, const char* end, ObjChunk& chunk) {
+    while (p < end) {
+        const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+        if (!lineEnd) lineEnd = end;
+        const char* line = skipMeshSpaces(p, lineEnd);
+        size_t length = lineEnd - line;
+        bool ok = true;
+        if (length > 1 && line[0] == 'v' && (line[1] == ' ' || line[1] == '\t')) {
+            ok = parseObjVector(line + 2, lineEnd, chunk.positions);
+        }
+        else if (length > 2 && line[0] == 'v' && line[1] == 'n' && (line[2] == ' ' || line[2] == '\t')) {
+            ok = parseObjVector(line + 3, lineEnd, chunk.normals);
+        }
+        else if (length > 1 && line[0] == 'f' && (line[1] == ' ' || line[1] == '\t')) {
+            ok = parseObjFace(line + 2, lineEnd, chunk);
+        }
+        if (!ok) {
+            chunk.error = p;
+            return;
+        }
+        p = lineEnd + 1;
+    }
+}
+
+// Start of the first line at or after offset
+size_t objLineStart(const MappedFile& file, size_t offset) {
+    if (offset == 0 || offset >= file.size) return std::min(offset, file.size);
+    const char* newline = (const char*)memchr(file.data + offset - 1, '\n', file.size - offset + 1);
+    return newline ? (size_t)(newline - file.data) + 1 : file.size;
+}
+
+bool loadObjMesh(const MappedFile& file, Mesh& mesh, const char* path) {
+    int chunkCount = (int)std::max<size_t>(1, std::min(file.size / objChunkBytes, (size_t)poolWorkerCount() * 8));
+    std::vector<ObjChunk> chunks(chunkCount);
+    parallelFor(chunkCount, [&](int chunk, int) {
+        size_t begin = objLineStart(file, file.size * chunk / chunkCount);
+        size_t end = objLineStart(file, file.size * (chunk + 1) / chunkCount);
+        parseObjChunk(file.data + begin, file.data + end, chunks[chunk]);
+    });
+
+    size_t positionCount = 0, normalCount = 0, cornerCount = 0;
+    for (ObjChunk& chunk : chunks) {
+        if (chunk.error) {
+            size_t line = 1 + std::count(file.data, chunk.error, '\n');
+            std::cerr << path << ":" << line << ": malformed OBJ line" << std::endl;
+            return false;
+        }
+        chunk.positionBase = positionCount;
+        chunk.normalBase = normalCount;
+        positionCount += chunk.positions.size() / 3;
+        normalCount += chunk.normals.size() / 3;
+        cornerCount += chunk.corners.size() / 2;
+    }
+    if (positionCount > 0xFFFFFFF0u || cornerCount == 0) {
+        std::cerr << path << ": no triangles, or too many vertices" << std::endl;
+        return false;
+    }
+
+    std::vector<float> positions(positionCount * 3), normals(normalCount * 3);
+    parallelFor(chunkCount, [&](int c, int) {
+        ObjChunk& chunk = chunks[c];
+        std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.positionBase * 3);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normalBase * 3);
+        for (size_t entry : chunk.relative) {
+            chunk.corners[entry] += (int)((entry & 1) ? chunk.normalBase : chunk.positionBase);
+        }
+        std::vector<float>().swap(chunk.positions);
+        std::vector<float>().swap(chunk.normals);
+    });
+
+    // Deduplicate (position, normal) pairs. Vertices sharing a position are
+    // chained from firstVertex, so the lookup needs no hash table.
+    const unsigned int none = 0xFFFFFFFFu;
+    std::vector<unsigned int> firstVertex(positionCount, none);
+    std::vector<unsigned int> nextVertex;
+    std::vector<int> vertexNormal;
+    mesh.vertices.reserve(positionCount);
+    mesh.indices.resize(cornerCount);
+    size_t cursor = 0;
+    for (ObjChunk& chunk : chunks) {
+        for (size_t i = 0; i < chunk.corners.size(); i += 2) {
+            int position = chunk.corners[i];
+            int normal = chunk.corners[i + 1];
+            if (position < 0 || (size_t)position >= positionCount || normal < -1 || (normal >= 0 && (size_t)normal >= normalCount)) {
+                std::cerr << path << ": face index out of range" << std::endl;
+                return false;
+            }
+            unsigned int vertex = firstVertex[position];
+            while (vertex != none && vertexNormal[vertex] != normal) vertex = nextVertex[vertex];
+            if (vertex == none) {
+                vertex = (unsigned int)mesh.vertices.size();
+                const float* p = &positions[position * 3];
+                MeshVertex v = { { p[0], p[1], p[2] }, { 0.0f, 0.0f, 0.0f },
+                    { importedMeshColor[0], importedMeshColor[1], importedMeshColor[2] } };
+                if (normal >= 0) memcpy(v.normal, &normals[normal * 3], sizeof(v.normal));
+                mesh.vertices.push_back(v);
+                nextVertex.push_back(firstVertex[position]);
+                vertexNormal.push_back(normal);
+                firstVertex[position] = vertex;
+            }
+            mesh.indices[cursor++] = vertex;
+        }
+        std::vector<int>().swap(chunk.corners);
+    }
+
+    std::vector<unsigned char> missing(mesh.vertices.size());
+    bool anyMissing = false;
+    for (size_t i = 0; i < missing.size(); i++) {
+        missing[i] = vertexNormal[i] < 0;
+        anyMissing = anyMissing || missing[i];
+    }
+    if (anyMissing) computeMeshNormals(mesh, normalCount == 0 ? std::vector<unsigned char>() : missing);
+    return true;
+}
+
+enum PlyType { PLY_INVALID, PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+
+struct PlyProperty {
+    std::string name;
+    PlyType type = PLY_INVALID;
+    PlyType countType = PLY_INVALID;  // Set for list properties
+    size_t offset = 0;                // Within the record, fixed-size elements only
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count = 0;
+    std::vector<PlyProperty> properties;
+    size_t stride = 0;
+    bool hasList = false;
+};
+
+PlyType plyTypeFromName(const char* name) {
+    const char* names[] = { "", "char", "uchar", "short", "ushort", "int", "uint", "float", "double" };
+    const char* sizedNames[] = { "", "int8", "uint8", "int16", "uint16", "int32", "uint32", "float32", "float64" };
+    for (int type = PLY_INT8; type <= PLY_FLOAT64; type++) {
+        if (strcmp(name, names[type]) == 0 || strcmp(name, sizedNames[type]) == 0) return (PlyType)type;
+    }
+    return PLY_INVALID;
+}
+
+size_t plyTypeSize(PlyType type) {
+    const size_t sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+    return sizes[type];
+}
+
+double readPlyValue(const char* p, PlyType type, bool swap) {
+    unsigned char bytes[8];
+    size_t size = plyTypeSize(type);
+    for (size_t i = 0; i < size; i++) bytes[i] = (unsigned char)p[swap ? size - 1 - i : i];
+    switch (type) {
+    case PLY_INT8: return (signed char)bytes[0];
+    case PLY_UINT8: return bytes[0];
+    case PLY_INT16: { short v; memcpy(&v, bytes, 2); return v; }
+    case PLY_UINT16: { unsigned short v; memcpy(&v, bytes, 2); return v; }
+    case PLY_INT32: { int v; memcpy(&v, bytes, 4); return v; }
+    case PLY_UINT32: { unsigned int v; memcpy(&v, bytes, 4); return v; }
+    case PLY_FLOAT32: { float v; memcpy(&v, bytes, 4); return v; }
+    case PLY_FLOAT64: { double v; memcpy(&v, bytes, 8); return v; }
+    default: return 0.0;
+    }
+}
+
+// Size of the record at p, or 0 if it runs past end
+size_t plyRecordSize(const PlyElement& element, const char* p, const char* end, bool swap) {
+    if (!element.hasList) return p + element.stride <= end ? element.stride : 0;
+    const char* q = p;
+    for (const PlyProperty& property : element.properties) {
+        if (property.countType != PLY_INVALID) {
+            if (q + plyTypeSize(property.countType) > end) return 0;
+            size_t n = (size_t)readPlyValue(q, property.countType, swap);
+            q += plyTypeSize(property.countType) + n * plyTypeSize(property.type);
+        }
+        else {
+            q += plyTypeSize(property.type);
+        }
+        if (q > end) return 0;
+    }
+    return q - p;
+}
+
+bool parsePlyHeader(const MappedFile& file, std::vector<PlyElement>& elements, bool& bigEndian, const char*& body, const char* path) {
+    const char* p = file.data;
+    const char* end = file.data + file.size;
+    bool binary = false;
+    while (p < end) {
+        const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+        if (!lineEnd) break;
+        char line[256];
+        size_t length = std::min((size_t)(lineEnd - p), sizeof(line) - 1);
+        memcpy(line, p, length);
+        line[length] = '\0';
+        if (length > 0 && line[length - 1] == '\r') line[length - 1] = '\0';
+        p = lineEnd + 1;
+
+        char word[4][64];
+        int words = sscanf(line, "%63s %63s %63s %63s", word[0], word[1], word[2], word[3]);
+        if (words <= 0) continue;
+        if (strcmp(word[0], "format") == 0 && words >= 2) {
+            binary = strcmp(word[1], "binary_little_endian") == 0 || strcmp(word[1], "binary_big_endian") == 0;
+            bigEndian = strcmp(word[1], "binary_big_endian") == 0;
+        }
+        else if (strcmp(word[0], "element") == 0 && words >= 3) {
+            PlyElement element;
+            element.name = word[1];
+            element.count = (size_t)strtoull(word[2], NULL, 10);
+            elements.push_back(element);
+        }
+        else if (strcmp(word[0], "property") == 0 && !elements.empty()) {
+            PlyElement& element = elements.back();
+            PlyProperty property;
+            if (strcmp(word[1], "list") == 0 && words >= 4) {
+                char name[64];
+                if (sscanf(line, "%*s %*s %*s %*s %63s", name) != 1) return false;
+                property.countType = plyTypeFromName(word[2]);
+                property.type = plyTypeFromName(word[3]);
+                property.name = name;
+                element.hasList = true;
+                if (property.countType == PLY_INVALID) property.type = PLY_INVALID;
+            }
+            else if (words >= 3) {
+                property.type = plyTypeFromName(word[1]);
+                property.name = word[2];
+                property.offset = element.stride;
+                element.stride += plyTypeSize(property.type);
+            }
+            if (property.type == PLY_INVALID) {
+                std::cerr << path << ": unsupported PLY property: " << line << std::endl;
+                return false;
+            }
+            element.properties.push_back(property);
+        }
+        else if (strcmp(word[0], "end_header") == 0) {
+            if (!binary) std::cerr << path << ": only binary PLY files are supported" << std::endl;
+            body = p;
+            return binary;
+        }
+    }
+    std::cerr << path << ": PLY header has no end_header" << std::endl;
+    return false;
+}
+
+const PlyProperty* findPlyProperty(const PlyElement& element, const char* name, const char* alternative = NULL) {
+    for (const PlyProperty& property : element.properties) {
+        if (property.name == name || (alternative && property.name == alternative)) return &property;
+    }
+    return NULL;
+}
+
+bool loadPlyVertices(const PlyElement& element, const char* data, bool swap, Mesh& mesh, bool& hasNormals, const char* path) {
+    const PlyProperty* coordinates[3] = { findPlyProperty(element, "x"), findPlyProperty(element, "y"), findPlyProperty(element, "z") };
+    const PlyProperty* normals[3] = { findPlyProperty(element, "nx"), findPlyProperty(element, "ny"), findPlyProperty(element, "nz") };
+    const PlyProperty* colors[3] = { findPlyProperty(element, "red", "r"), findPlyProperty(element, "green", "g"), findPlyProperty(element, "blue", "b") };
+    if (element.hasList || !coordinates[0] || !coordinates[1] || !coordinates[2]) {
+        std::cerr << path << ": PLY vertices need fixed-size x, y and z properties" << std::endl;
+        return false;
+    }
+    hasNormals = normals[0] && normals[1] && normals[2];
+    bool hasColors = colors[0] && colors[1] && colors[2];
+
+    mesh.vertices.resize(element.count);
+    int taskCount = (int)((element.count + plyChunkRecords - 1) / plyChunkRecords);
+    parallelFor(taskCount, [&](int task, int) {
+        size_t end = std::min(element.count, (task + 1) * plyChunkRecords);
+        for (size_t i = task * plyChunkRecords; i < end; i++) {
+            const char* record = data + i * element.stride;
+            MeshVertex& v = mesh.vertices[i];
+            for (int k = 0; k < 3; k++) {
+                v.position[k] = (float)readPlyValue(record + coordinates[k]->offset, coordinates[k]->type, swap);
+                v.normal[k] = hasNormals ? (float)readPlyValue(record + normals[k]->offset, normals[k]->type, swap) : 0.0f;
+                v.color[k] = importedMeshColor[k];
+                if (hasColors) {
+                    float value = (float)readPlyValue(record + colors[k]->offset, colors[k]->type, swap);
+                    v.color[k] = colors[k]->type >= PLY_FLOAT32 ? value : value / 255.0f;
+                }
+            }
+        }
+    });
+    return true;
+}
+
+// All-triangle faces with only an index list have a fixed stride and are
+// converted in parallel; anything else is walked and fanned in order.
+bool loadPlyFaces(const PlyElement& element, const char*& p, const char* end, bool swap, Mesh& mesh, const char* path) {
+    const PlyProperty* list = findPlyProperty(element, "vertex_indices", "vertex_index");
+    if (!list || list->countType == PLY_INVALID) {
+        std::cerr << path << ": PLY faces need a vertex_indices list" << std::endl;
+        return false;
+    }
+    size_t vertexCount = mesh.vertices.size();
+    size_t countSize = plyTypeSize(list->countType);
+    size_t indexSize = plyTypeSize(list->type);
+
+    size_t stride = countSize + 3 * indexSize;
+    if (element.properties.size() == 1 && p + element.count * stride <= end) {
+        std::atomic<bool> irregular(false);
+        mesh.indices.resize(element.count * 3);
+        int taskCount = (int)((element.count + plyChunkRecords - 1) / plyChunkRecords);
+        parallelFor(taskCount, [&](int task, int) {
+            size_t last = std::min(element.count, (task + 1) * plyChunkRecords);
+            for (size_t i = task * plyChunkRecords; i < last && !irregular.load(std::memory_order_relaxed); i++) {
+                const char* record = p + i * stride;
+                if (readPlyValue(record, list->countType, swap) != 3.0) {
+                    irregular = true;
+                    return;
+                }
+                for (int k = 0; k < 3; k++) {
+                    double index = readPlyValue(record + countSize + k * indexSize, list->type, swap);
+                    if (index < 0.0 || index >= (double)vertexCount) {
+                        irregular = true;
+                        return;
+                    }
+                    mesh.indices[i * 3 + k] = (unsigned int)index;
+                }
+            }
+        });
+        if (!irregular) {
+            p += element.count * stride;
+            return true;
+        }
+        mesh.indices.clear();
+    }
+
+    for (size_t face = 0; face < element.count; face++) {
+        if (plyRecordSize(element, p, end, swap) == 0) {
+            std::cerr << path << ": PLY face data is truncated" << std::endl;
+            return false;
+        }
+        for (const PlyProperty& property : element.properties) {
+            if (property.countType == PLY_INVALID) {
+                p += plyTypeSize(property.type);
+                continue;
+            }
+            size_t n = (size_t)readPlyValue(p, property.countType, swap);
+            p += countSize;
+            if (&property == list) {
+                unsigned int first = 0, previous = 0;
+                for (size_t k = 0; k < n; k++) {
+                    double index = readPlyValue(p + k * indexSize, property.type, swap);
+                    if (index < 0.0 || index >= (double)vertexCount) {
+                        std::cerr << path << ": face index out of range" << std::endl;
+                        return false;
+                    }
+                    unsigned int vertex = (unsigned int)index;
+                    if (k == 0) first = vertex;
+                    if (k >= 2) {
+                        mesh.indices.push_back(first);
+                        mesh.indices.push_back(previous);
+                        mesh.indices.push_back(vertex);
+                    }
+                    previous = vertex;
+                }
+            }
+            p += n * plyTypeSize(property.type);
+        }
+    }
+    return true;
+}
+
+bool loadPlyMesh(const MappedFile& file, Mesh& mesh, const char* path) {
+    std::vector<PlyElement> elements;
+    bool bigEndian = false;
+    const char* p = NULL;
+    if (!parsePlyHeader(file, elements, bigEndian, p, path)) return false;
+    const unsigned short probe = 1;
+    bool swap = bigEndian == (*(const unsigned char*)&probe == 1);
+    const char* end = file.data + file.size;
+
+    bool hasVertices = false, hasNormals = false;
+    for (const PlyElement& element : elements) {
+        if (element.name == "vertex" && !element.hasList) {
+            if (p + element.count * element.stride > end) {
+                std::cerr << path << ": PLY vertex data is truncated" << std::endl;
+                return false;
+            }
+            if (!loadPlyVertices(element, p, swap, mesh, hasNormals, path)) return false;
+            p += element.count * element.stride;
+            hasVertices = true;
+        }
+        else if (element.name == "face" && hasVertices) {
+            if (!loadPlyFaces(element, p, end, swap, mesh, path)) return false;
+        }
+        else {
+            for (size_t i = 0; i < element.count; i++) {
+                size_t size = plyRecordSize(element, p, end, swap);
+                if (size == 0) {
+                    std::cerr << path << ": PLY " << element.name << " data is truncated" << std::endl;
+                    return false;
+                }
+                p += size;
+            }
+        }
+    }
+    if (mesh.indices.empty()) {
+        std::cerr << path << ": no triangles" << std::endl;
+        return false;
+    }
+    if (!hasNormals) computeMeshNormals(mesh, std::vector<unsigned char>());
+    return true;
+}
+
+// Centers the mesh and scales its longest side to 1
+void fitMeshToUnitCube(Mesh& mesh, AABB& bounds) {
+    for (int k = 0; k < 3; k++) {
+        bounds.min[k] = INFINITY;
+        bounds.max[k] = -INFINITY;
+    }
+    for (const MeshVertex& v : mesh.vertices) {
+        for (int k = 0; k < 3; k++) {
+            bounds.min[k] = std::min(bounds.min[k], v.position[k]);
+            bounds.max[k] = std::max(bounds.max[k], v.position[k]);
+        }
+    }
+    float center[3], longest = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        center[k] = 0.5f * (bounds.min[k] + bounds.max[k]);
+        longest = std::max(longest, bounds.max[k] - bounds.min[k]);
+    }
+    float fit = longest > 0.0f ? 1.0f / longest : 1.0f;
+    for (MeshVertex& v : mesh.vertices) {
+        for (int k = 0; k < 3; k++) v.position[k] = (v.position[k] - center[k]) * fit;
+    }
+    for (int k = 0; k < 3; k++) {
+        bounds.min[k] = (bounds.min[k] - center[k]) * fit;
+        bounds.max[k] = (bounds.max[k] - center[k]) * fit;
+    }
+}
+
+// Binary mesh cache, written next to the source as FILE.meshcache. A header
+// is followed by page-aligned index and vertex blocks in the exact layout
+// uploadMesh sends to GL, so a hit maps the file and uploads straight from
+// the mapping. Triangles are stored in Morton order of their centroids and
+// vertices in first-use order, keeping vertex fetches and the post-transform
+// cache local. The source's size, modification time and sampled hash must
+// match or the cache is rebuilt.
+const unsigned int meshCacheVersion = 1;
+const char meshCacheMagic[8] = { 'T', 'F', 'M', 'E', 'S', 'H', '\0', '\0' };
+const size_t meshCacheAlignment = 4096;
+const int meshCacheHashBlocks = 16;
+const size_t meshCacheHashBlockSize = 4096;
+bool meshCacheEnabled = true;  // --no-mesh-cache
+
+struct MeshCacheHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int vertexSize;  // sizeof(MeshVertex), catches layout changes
+    unsigned long long sourceSize;
+    long long sourceTime;
+    unsigned long long sourceHash;
+    unsigned long long vertexCount;
+    unsigned long long indexCount;
+    unsigned long long vertexOffset;
+    unsigned long long indexOffset;
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+struct MeshSource {
+    unsigned long long size;
+    long long time;
+    unsigned long long hash;
+};
+
+MappedFile meshCacheFile;  // Stays mapped while the IMPORTED mesh points into it
+std::thread meshCacheWriter;
+
+// FNV-1a over evenly spaced blocks; hashing the whole source would cost as
+// much as parsing it
+unsigned long long sampleSourceHash(const MappedFile& file) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (int block = 0; block < meshCacheHashBlocks; block++) {
+        size_t offset = file.size > meshCacheHashBlockSize ?
+            (file.size - meshCacheHashBlockSize) * block / (meshCacheHashBlocks - 1) : 0;
+        size_t end = std::min(file.size, offset + meshCacheHashBlockSize);
+        for (size_t i = offset; i < end; i++) {
+            hash = (hash ^ (unsigned char)file.data[i]) * 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+bool getMeshSource(const char* path, const MappedFile& file, MeshSource& source) {
+    struct stat info;
+    if (stat(path, &info) != 0) return false;
+    source.size = file.size;
+    source.time = (long long)info.st_mtime;
+    source.hash = sampleSourceHash(file);
+    return true;
+}
+
+bool loadMeshCache(const std::string& cachePath, const MeshSource& source, Mesh& mesh) {
+    MappedFile cache;
+    MeshCacheHeader header;
+    bool valid = mapFile(cachePath.c_str(), cache) && cache.size >= sizeof(header);
+    if (valid) {
+        memcpy(&header, cache.data, sizeof(header));
+        valid = memcmp(header.magic, meshCacheMagic, sizeof(meshCacheMagic)) == 0 &&
+            header.version == meshCacheVersion && header.vertexSize == sizeof(MeshVertex) &&
+            header.sourceSize == source.size && header.sourceTime == source.time && header.sourceHash == source.hash &&
+            header.indexCount > 0 && header.vertexOffset % meshCacheAlignment == 0 && header.indexOffset % meshCacheAlignment == 0 &&
+            header.vertexCount <= cache.size / sizeof(MeshVertex) && header.indexCount <= cache.size / sizeof(unsigned int) &&
+            header.vertexOffset + header.vertexCount * sizeof(MeshVertex) <= cache.size &&
+            header.indexOffset + header.indexCount * sizeof(unsigned int) <= cache.size;
+    }
+    if (!valid) {
+        unmapFile(cache);
+        return false;
+    }
+
+    unmapFile(meshCacheFile);
+    meshCacheFile = cache;
+    mesh.mappedVertices = (const MeshVertex*)(cache.data + header.vertexOffset);
+    mesh.mappedIndices = (const unsigned int*)(cache.data + header.indexOffset);
+    mesh.mappedVertexCount = (size_t)header.vertexCount;
+    mesh.mappedIndexCount = (size_t)header.indexCount;
+    for (int k = 0; k < 3; k++) {
+        importedMeshBounds.min[k] = header.boundsMin[k];
+        importedMeshBounds.max[k] = header.boundsMax[k];
+    }
+    return true;
+}
+
+// Spreads the low 10 bits of v to every third bit
+unsigned long long spreadMortonBits(unsigned int v) {
+    unsigned long long x = v & 0x3FF;
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x << 8)) & 0x0300F00F;
+    x = (x | (x << 4)) & 0x030C30C3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+bool writeMeshCachePadding(FILE* file, unsigned long long& written, unsigned long long offset) {
+    static const char zeros[meshCacheAlignment] = {};
+    size_t padding = (size_t)(offset - written);
+    written = offset;
+    return fwrite(zeros, 1, padding, file) == padding;
+}
+
+unsigned long long alignMeshCacheOffset(unsigned long long offset) {
+    return (offset + meshCacheAlignment - 1) / meshCacheAlignment * meshCacheAlignment;
+}
+
+// Runs on meshCacheWriter while the freshly parsed mesh is drawn; only reads
+// the mesh. Streams into a temporary file that replaces the cache once
+// complete, so an interrupted write never leaves a cache that validates.
+void writeMeshCache(std::string cachePath, MeshSource source, const Mesh* mesh, AABB bounds) {
+    auto start = std::chrono::steady_clock::now();
+    size_t triangleCount = mesh->indices.size() / 3;
+    size_t vertexCount = mesh->vertices.size();
+
+    // Morton code in the top 30 bits, triangle index below
+    std::vector<unsigned long long> order(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++) {
+        unsigned long long code = 0;
+        for (int k = 0; k < 3; k++) {
+            float centroid = 0.0f;
+            for (int c = 0; c < 3; c++) centroid += mesh->vertices[mesh->indices[t * 3 + c]].position[k];
+            float extent = std::max(1e-6f, bounds.max[k] - bounds.min[k]);
+            float cell = (centroid / 3.0f - bounds.min[k]) / extent * 1023.0f;
+            code |= spreadMortonBits((unsigned int)std::max(0.0f, std::min(1023.0f, cell))) << k;
+        }
+        order[t] = (code << 34) | t;
+    }
+    std::sort(order.begin(), order.end());
+
+    std::string temporaryPath = cachePath + ".tmp";
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Cannot write mesh cache " << cachePath << std::endl;
+        return;
+    }
+    MeshCacheHeader header = {};
+    memcpy(header.magic, meshCacheMagic, sizeof(meshCacheMagic));
+    header.version = meshCacheVersion;
+    header.vertexSize = sizeof(MeshVertex);
+    header.sourceSize = source.size;
+    header.sourceTime = source.time;
+    header.sourceHash = source.hash;
+    header.indexCount = triangleCount * 3;
+    header.indexOffset = alignMeshCacheOffset(sizeof(header));
+    for (int k = 0; k < 3; k++) {
+        header.boundsMin[k] = bounds.min[k];
+        header.boundsMax[k] = bounds.max[k];
+    }
+
+    // Index block, renumbering vertices in first-use order as it goes
+    const unsigned int none = 0xFFFFFFFFu;
+    std::vector<unsigned int> remap(vertexCount, none);
+    std::vector<unsigned int> vertexOrder;
+    vertexOrder.reserve(vertexCount);
+    std::vector<unsigned int> block;
+    block.reserve(3 * plyChunkRecords);
+    unsigned long long written = 0;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    written = sizeof(header);
+    ok = ok && writeMeshCachePadding(file, written, header.indexOffset);
+    for (size_t i = 0; i < triangleCount && ok; i++) {
+        size_t t = (size_t)(order[i] & ((1ULL << 34) - 1));
+        for (int c = 0; c < 3; c++) {
+            unsigned int vertex = mesh->indices[t * 3 + c];
+            if (remap[vertex] == none) {
+                remap[vertex] = (unsigned int)vertexOrder.size();
+                vertexOrder.push_back(vertex);
+            }
+            block.push_back(remap[vertex]);
+        }
+        if (block.size() >= 3 * plyChunkRecords || i + 1 == triangleCount) {
+            ok = fwrite(block.data(), sizeof(unsigned int), block.size(), file) == block.size();
+            written += block.size() * sizeof(unsigned int);
+            block.clear();
+        }
+    }
+    std::vector<unsigned long long>().swap(order);
+
+    // Vertex block; vertices no triangle uses are dropped
+    header.vertexCount = vertexOrder.size();
+    header.vertexOffset = alignMeshCacheOffset(written);
+    ok = ok && writeMeshCachePadding(file, written, header.vertexOffset);
+    std::vector<MeshVertex> vertices;
+    vertices.reserve(plyChunkRecords);
+    for (size_t i = 0; i < vertexOrder.size() && ok; i++) {
+        vertices.push_back(mesh->vertices[vertexOrder[i]]);
+        if (vertices.size() == plyChunkRecords || i + 1 == vertexOrder.size()) {
+            ok = fwrite(vertices.data(), sizeof(MeshVertex), vertices.size(), file) == vertices.size();
+            vertices.clear();
+        }
+    }
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+
+    remove(cachePath.c_str());
+    if (!ok || rename(temporaryPath.c_str(), cachePath.c_str()) != 0) {
+        remove(temporaryPath.c_str());
+        std::cerr << "Cannot write mesh cache " << cachePath << std::endl;
+        return;
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Wrote mesh cache " << cachePath << " in " << ms << " ms" << std::endl;
+}
+
+void finishMeshCacheWrite() {
+    if (meshCacheWriter.joinable()) meshCacheWriter.join();
+}
+
+void startMeshCacheWrite(const std::string& cachePath, const MeshSource& source, const Mesh& mesh) {
+    static bool registered = false;
+    if (!registered) {
+        atexit(finishMeshCacheWrite);  // Exit waits for the cache to be complete
+        registered = true;
+    }
+    finishMeshCacheWrite();
+    meshCacheWriter = std::thread(writeMeshCache, cachePath, source, &mesh, importedMeshBounds);
+}
+
+// Loads path into the IMPORTED shape, from its mesh cache when that is
+// current, and reports load time and peak RSS
+bool loadImportedMesh(const char* path) {
+    auto start = std::chrono::steady_clock::now();
+    MappedFile file;
+    if (!mapFile(path, file)) {
+        std::cerr << "Cannot open mesh " << path << std::endl;
+        unmapFile(file);
+        return false;
+    }
+    Mesh& mesh = shapeMeshes[IMPORTED][0];
+    MeshSource source;
+    std::string cachePath = std::string(path) + ".meshcache";
+    bool cacheable = meshCacheEnabled && getMeshSource(path, file, source);
+    bool cached = cacheable && loadMeshCache(cachePath, source, mesh);
+    if (cached) {
+        unmapFile(file);
+        mesh.built = true;
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Loaded " << path << " from " << cachePath << ": " << meshVertexCount(mesh) << " vertices, "
+            << meshIndexCount(mesh) / 3 << " triangles in " << ms << " ms, peak RSS " << peakResidentMB() << " MB" << std::endl;
+        return true;
+    }
+
+    if (poolWorkerCount() < 2) {
+        startThreadPool(rasterThreads > 0 ? rasterThreads : std::max(1, (int)std::thread::hardware_concurrency()));
+    }
+    bool ply = file.size >= 4 && memcmp(file.data, "ply", 3) == 0 && (file.data[3] == '\n' || file.data[3] == '\r');
+    bool loaded = ply ? loadPlyMesh(file, mesh, path) : loadObjMesh(file, mesh, path);
+    unmapFile(file);
+    if (!loaded) {
+        mesh = Mesh();
+        return false;
+    }
+    fitMeshToUnitCube(mesh, importedMeshBounds);
+    mesh.built = true;
+    if (cacheable) {
+        startMeshCacheWrite(cachePath, source, mesh);
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Loaded " << path << ": " << mesh.vertices.size() << " vertices, " << mesh.indices.size() / 3
+        << " triangles in " << ms << " ms, peak RSS " << peakResidentMB() << " MB" << std::endl;
+    return true;
+}
+
+// Tile-based software rasterizer for the single-shape view. Vertices are lit
+// per vertex exactly like the fixed-function setup in init(), triangles are
+// clipped against the near plane, binned into tiles per submission chunk and
+// each tile is depth-tested and shaded on its own, four pixels at a time.
+const int rasterTileSize = 64;
+const int rasterVertexChunk = 1024;
+const int rasterTriangleChunk = 256;  // Smallest setup/binning chunk
+const int rasterChunksPerWorker = 4;
+
+struct ClipVertex {
+    float position[4];
+    float color[3];
+};
+
+// Edge functions a * (x - ox) + b * (y - oy) over window coordinates (pixel
+// centers), positive inside. The origin is the edge's lexicographically
+// smaller endpoint, so both triangles sharing an edge compute exact
+// negations (no cracks) and values stay small enough to interpolate with.
+// Attributes are sum(value[i] * edge[i]) with 1/area folded into the values.
+struct RasterTriangle {
+    float edge[3][2];
+    float origin[3][2];
+    float depth[3];        // Window depth / area
+    float invW[3];         // 1/w / area, for perspective-correct color
+    float color[3][3];     // [channel][vertex] color/w / area
+    int minX, minY, maxX, maxY;
+};
+
+// One setup/binning chunk: its triangles, binned as (tile, triangle) pairs
+// in submission order, then counting-sorted by tile so tile t's triangles
+// are binTriangles[binStart[t], binStart[t + 1])
+struct RasterChunk {
+    std::vector<RasterTriangle> triangles;
+    std::vector<std::pair<int, int>> binned;
+    std::vector<int> binStart;
+    std::vector<int> binTriangles;
+};
+
+struct SoftwareRasterizer {
+    int width = 0, height = 0;
+    int stride = 0, tilesX = 0, tilesY = 0;  // Buffers are padded to whole tiles
+    std::vector<unsigned int> color;          // RGBA8
+    std::vector<float> depth;
+
+    std::vector<ClipVertex> vertices;
+    std::vector<RasterChunk> chunks;  // A few per worker, however many triangles
+
+    float frameMs = 0.0f;
+    size_t triangles = 0;
+};
+
+SoftwareRasterizer raster;
+
+void resizeRasterTarget(int width, int height) {
+    if (raster.width == width && raster.height == height) return;
+    raster.width = width;
+    raster.height = height;
+    raster.tilesX = (width + rasterTileSize - 1) / rasterTileSize;
+    raster.tilesY = (height + rasterTileSize - 1) / rasterTileSize;
+    raster.stride = raster.tilesX * rasterTileSize;
+    raster.color.assign((size_t)raster.stride * raster.tilesY * rasterTileSize, 0);
+    raster.depth.assign(raster.color.size(), 1.0f);
+}
+
+// Same equation as GL lighting with one positional light, color material on
+// ambient and diffuse, a non-local viewer and GL_NORMALIZE disabled
+void lightVertex(const float p[3], const float n[3], const float c[3], float result[3]) {
+    float l[3] = { lightPosition[0] - p[0], lightPosition[1] - p[1], lightPosition[2] - p[2] };
+    float lLength = sqrt(l[0] * l[0] + l[1] * l[1] + l[2] * l[2]);
+    for (int k = 0; k < 3; k++) l[k] /= lLength;
+    float h[3] = { l[0], l[1], l[2] + 1.0f };
+    float hLength = sqrt(h[0] * h[0] + h[1] * h[1] + h[2] * h[2]);
+
+    float nDotL = n[0] * l[0] + n[1] * l[1] + n[2] * l[2];
+    float diffuse = std::max(nDotL, 0.0f);
+    float specular = 0.0f;
+    if (nDotL > 0.0f) {
+        float nDotH = (n[0] * h[0] + n[1] * h[1] + n[2] * h[2]) / hLength;
+        specular = pow(std::max(nDotH, 0.0f), materialShininess);
+    }
+    for (int k = 0; k < 3; k++) {
+        float value = c[k] * (sceneAmbient + lightAmbient[k] + diffuse * lightDiffuse[k]) +
+            specular * lightSpecular[k] * materialSpecular[k];
+        result[k] = std::min(std::max(value, 0.0f), 1.0f);
+    }
+}
+
+ClipVertex lerpClipVertex(const ClipVertex& a, const ClipVertex& b, float t) {
+    ClipVertex v;
+    for (int k = 0; k < 4; k++) v.position[k] = a.position[k] + (b.position[k] - a.position[k]) * t;
+    for (int k = 0; k < 3; k++) v.color[k] = a.color[k] + (b.color[k] - a.color[k]) * t;
+    return v;
+}
+
+// Clips against z >= -w; returns the polygon's vertex count (0, 3 or 4)
+int clipNearPlane(const ClipVertex in[3], ClipVertex out[4]) {
+    int count = 0;
+    for (int i = 0; i < 3; i++) {
+        const ClipVertex& a = in[i];
+        const ClipVertex& b = in[(i + 1) % 3];
+        float da = a.position[2] + a.position[3];
+        float db = b.position[2] + b.position[3];
+        if (da >= 0.0f) out[count++] = a;
+        if ((da >= 0.0f) != (db >= 0.0f)) out[count++] = lerpClipVertex(a, b, da / (da - db));
+    }
+    return count;
+}
+
+void setupRasterTriangle(const ClipVertex* v[3], std::vector<RasterTriangle>& triangles) {
+    float x[3], y[3], z[3], q[3];
+    for (int i = 0; i < 3; i++) {
+        q[i] = 1.0f / v[i]->position[3];
+        x[i] = (v[i]->position[0] * q[i] + 1.0f) * 0.5f * raster.width;
+        y[i] = (v[i]->position[1] * q[i] + 1.0f) * 0.5f * raster.height;
+        z[i] = (v[i]->position[2] * q[i] + 1.0f) * 0.5f;
+    }
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (fabs(area) < 1e-8f) return;
+
+    RasterTriangle t;
+    t.minX = std::max(0, (int)floor(std::min(x[0], std::min(x[1], x[2]))));
+    t.minY = std::max(0, (int)floor(std::min(y[0], std::min(y[1], y[2]))));
+    t.maxX = std::min(raster.width - 1, (int)ceil(std::max(x[0], std::max(x[1], x[2]))));
+    t.maxY = std::min(raster.height - 1, (int)ceil(std::max(y[0], std::max(y[1], y[2]))));
+    if (t.minX > t.maxX || t.minY > t.maxY) return;
+
+    // Edge opposite vertex i, equal to the area at vertex i
+    float sign = area > 0.0f ? 1.0f : -1.0f;
+    float invArea = 1.0f / fabs(area);
+    for (int i = 0; i < 3; i++) {
+        int b = (i + 1) % 3, c = (i + 2) % 3;
+        int o = (x[b] < x[c] || (x[b] == x[c] && y[b] < y[c])) ? b : c;
+        t.edge[i][0] = sign * (y[b] - y[c]);
+        t.edge[i][1] = sign * (x[c] - x[b]);
+        t.origin[i][0] = x[o];
+        t.origin[i][1] = y[o];
+        t.depth[i] = z[i] * invArea;
+        t.invW[i] = q[i] * invArea;
+        for (int channel = 0; channel < 3; channel++) {
+            t.color[channel][i] = v[i]->color[channel] * q[i] * invArea;
+        }
+    }
+    triangles.push_back(t);
+}
+
+void shadeTriangleInTile(const RasterTriangle& t, int tileX0, int tileY0) {
+    int x0 = std::max(t.minX, tileX0) & ~3;
+    int x1 = std::min(t.maxX, tileX0 + rasterTileSize - 1);
+    int y0 = std::max(t.minY, tileY0);
+    int y1 = std::min(t.maxY, tileY0 + rasterTileSize - 1);
+
+    for (int y = y0; y <= y1; y++) {
+        float py = y + 0.5f;
+        unsigned int* colorRow = &raster.color[(size_t)y * raster.stride];
+        float* depthRow = &raster.depth[(size_t)y * raster.stride];
+#ifdef MATRIX_SIMD_X86
+        __m128 rowE0 = _mm_set1_ps(t.edge[0][1] * (py - t.origin[0][1]));
+        __m128 rowE1 = _mm_set1_ps(t.edge[1][1] * (py - t.origin[1][1]));
+        __m128 rowE2 = _mm_set1_ps(t.edge[2][1] * (py - t.origin[2][1]));
+        __m128 zero = _mm_setzero_ps();
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 scale255 = _mm_set1_ps(255.0f);
+        for (int x = x0; x <= x1; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps(x + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+            __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.edge[0][0]), _mm_sub_ps(px, _mm_set1_ps(t.origin[0][0]))), rowE0);
+            __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.edge[1][0]), _mm_sub_ps(px, _mm_set1_ps(t.origin[1][0]))), rowE1);
+            __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.edge[2][0]), _mm_sub_ps(px, _mm_set1_ps(t.origin[2][0]))), rowE2);
+            __m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+            if (_mm_movemask_ps(inside) == 0) continue;
+
+            __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.depth[0]), e0), _mm_mul_ps(_mm_set1_ps(t.depth[1]), e1)),
+                _mm_mul_ps(_mm_set1_ps(t.depth[2]), e2));
+            __m128 oldDepth = _mm_loadu_ps(depthRow + x);
+            __m128 mask = _mm_and_ps(inside, _mm_cmplt_ps(z, oldDepth));
+            if (_mm_movemask_ps(mask) == 0) continue;
+            _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, oldDepth)));
+
+            __m128 w = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.invW[0]), e0),
+                _mm_mul_ps(_mm_set1_ps(t.invW[1]), e1)), _mm_mul_ps(_mm_set1_ps(t.invW[2]), e2)));
+            __m128i rgba = _mm_set1_epi32((int)0xFF000000);
+            for (int channel = 0; channel < 3; channel++) {
+                const float* c3 = t.color[channel];
+                __m128 c = _mm_mul_ps(w, _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(c3[0]), e0),
+                    _mm_mul_ps(_mm_set1_ps(c3[1]), e1)), _mm_mul_ps(_mm_set1_ps(c3[2]), e2)));
+                c = _mm_min_ps(_mm_max_ps(c, zero), one);
+                __m128i bytes = _mm_cvtps_epi32(_mm_mul_ps(c, scale255));
+                rgba = _mm_or_si128(rgba, _mm_slli_epi32(bytes, 8 * channel));
+            }
+            __m128i maskBits = _mm_castps_si128(mask);
+            __m128i oldColor = _mm_loadu_si128((const __m128i*)(colorRow + x));
+            _mm_storeu_si128((__m128i*)(colorRow + x), _mm_or_si128(_mm_and_si128(maskBits, rgba), _mm_andnot_si128(maskBits, oldColor)));
+        }
+#else
+        for (int x = x0; x <= x1; x++) {
+            float px = x + 0.5f;
+            float e0 = t.edge[0][0] * (px - t.origin[0][0]) + t.edge[0][1] * (py - t.origin[0][1]);
+            float e1 = t.edge[1][0] * (px - t.origin[1][0]) + t.edge[1][1] * (py - t.origin[1][1]);
+            float e2 = t.edge[2][0] * (px - t.origin[2][0]) + t.edge[2][1] * (py - t.origin[2][1]);
+            if (e0 < 0.0f || e1 < 0.0f || e2 < 0.0f) continue;
+
+            float z = t.depth[0] * e0 + t.depth[1] * e1 + t.depth[2] * e2;
+            if (!(z < depthRow[x])) continue;
+            depthRow[x] = z;
+
+            float w = 1.0f / (t.invW[0] * e0 + t.invW[1] * e1 + t.invW[2] * e2);
+            unsigned int rgba = 0xFF000000u;
+            for (int channel = 0; channel < 3; channel++) {
+                float c = w * (t.color[channel][0] * e0 + t.color[channel][1] * e1 + t.color[channel][2] * e2);
+                c = std::min(std::max(c, 0.0f), 1.0f);
+                rgba |= (unsigned int)(c * 255.0f + 0.5f) << (8 * channel);
+            }
+            colorRow[x] = rgba;
+        }
+#endif
+    }
+}
+
+// Rasterizes the current shape with the current camera and transformMatrix
+// into raster.color/raster.depth
+void rasterizeShape(int width, int height) {
+    auto start = std::chrono::steady_clock::now();
+    resizeRasterTarget(width, height);
+
+    float projection[4][4], modelView[4][4], inverse[4][4];
+    updateCamera();
+    buildPerspectiveMatrix(cameraFovy, (float)width / height, cameraNear, cameraFar, projection);
+    matrixKernels->multiply(camera.view, transformMatrix, modelView);
+    matrixKernels->affineInverse(modelView, inverse);
+
+    const Mesh& mesh = getShapeMesh(currentShape, currentShapeLod);
+    const MeshVertex* vertices = meshVertexData(mesh);
+    const unsigned int* indices = meshIndexData(mesh);
+    size_t vertexCount = meshVertexCount(mesh);
+    raster.vertices.resize(vertexCount);
+
+    // Vertex stage: eye-space lighting, then clip-space position
+    parallelFor((int)((vertexCount + rasterVertexChunk - 1) / rasterVertexChunk), [&](int chunk, int) {
+        size_t end = std::min(vertexCount, (size_t)(chunk + 1) * rasterVertexChunk);
+        for (size_t i = (size_t)chunk * rasterVertexChunk; i < end; i++) {
+            const MeshVertex& in = vertices[i];
+            ClipVertex& out = raster.vertices[i];
+            float eye[3], normal[3];
+            for (int r = 0; r < 3; r++) {
+                eye[r] = modelView[r][0] * in.position[0] + modelView[r][1] * in.position[1] +
+                    modelView[r][2] * in.position[2] + modelView[r][3];
+                normal[r] = inverse[0][r] * in.normal[0] + inverse[1][r] * in.normal[1] + inverse[2][r] * in.normal[2];
+            }
+            for (int r = 0; r < 4; r++) {
+                out.position[r] = projection[r][0] * eye[0] + projection[r][1] * eye[1] + projection[r][2] * eye[2] + projection[r][3];
+            }
+            lightVertex(eye, normal, in.color, out.color);
+        }
+    });
+
+    // Setup and binning, one output list per chunk so tiles see triangles in
+    // submission order whichever worker ran the chunk. Chunks are sized from
+    // the worker count, so bin storage grows with triangles, not chunks x tiles.
+    size_t triangleCount = meshIndexCount(mesh) / 3;
+    size_t targetChunks = (size_t)std::max(1, poolWorkerCount()) * rasterChunksPerWorker;
+    size_t chunkSize = std::max((size_t)rasterTriangleChunk, (triangleCount + targetChunks - 1) / targetChunks);
+    int chunkCount = (int)((triangleCount + chunkSize - 1) / chunkSize);
+    int tileCount = raster.tilesX * raster.tilesY;
+    raster.chunks.resize(chunkCount);
+    parallelFor(chunkCount, [&](int chunk, int) {
+        RasterChunk& out = raster.chunks[chunk];
+        std::vector<RasterTriangle>& triangles = out.triangles;
+        triangles.clear();
+        out.binned.clear();
+
+        size_t end = std::min(triangleCount, (size_t)(chunk + 1) * chunkSize);
+        for (size_t i = (size_t)chunk * chunkSize; i < end; i++) {
+            ClipVertex corners[3] = {
+                raster.vertices[indices[i * 3]],
+                raster.vertices[indices[i * 3 + 1]],
+                raster.vertices[indices[i * 3 + 2]]
+            };
+            ClipVertex polygon[4];
+            int count = clipNearPlane(corners, polygon);
+            for (int k = 2; k < count; k++) {
+                const ClipVertex* fan[3] = { &polygon[0], &polygon[k - 1], &polygon[k] };
+                size_t before = triangles.size();
+                setupRasterTriangle(fan, triangles);
+                if (triangles.size() == before) continue;
+
+                const RasterTriangle& t = triangles.back();
+                for (int ty = t.minY / rasterTileSize; ty <= t.maxY / rasterTileSize; ty++) {
+                    for (int tx = t.minX / rasterTileSize; tx <= t.maxX / rasterTileSize; tx++) {
+                        out.binned.push_back(std::make_pair(ty * raster.tilesX + tx, (int)before));
+                    }
+                }
+            }
+        }
+
+        // Stable counting sort by tile keeps each tile's triangles in order
+        out.binStart.assign(tileCount + 1, 0);
+        for (const std::pair<int, int>& entry : out.binned) out.binStart[entry.first + 1]++;
+        for (int tile = 0; tile < tileCount; tile++) out.binStart[tile + 1] += out.binStart[tile];
+        out.binTriangles.resize(out.binned.size());
+        for (const std::pair<int, int>& entry : out.binned) out.binTriangles[out.binStart[entry.first]++] = entry.second;
+        for (int tile = tileCount; tile > 0; tile--) out.binStart[tile] = out.binStart[tile - 1];
+        out.binStart[0] = 0;
+    });
+
+    // Tile stage: clear, then shade every binned triangle in order
+    parallelFor(tileCount, [&](int tile, int) {
+        int tileX0 = tile % raster.tilesX * rasterTileSize;
+        int tileY0 = tile / raster.tilesX * rasterTileSize;
+        for (int y = tileY0; y < tileY0 + rasterTileSize; y++) {
+            size_t row = (size_t)y * raster.stride + tileX0;
+            std::fill(raster.color.begin() + row, raster.color.begin() + row + rasterTileSize, 0xFF000000u);
+            std::fill(raster.depth.begin() + row, raster.depth.begin() + row + rasterTileSize, 1.0f);
+        }
+        for (int chunk = 0; chunk < chunkCount; chunk++) {
+            const RasterChunk& bins = raster.chunks[chunk];
+            for (int n = bins.binStart[tile]; n < bins.binStart[tile + 1]; n++) {
+                shadeTriangleInTile(bins.triangles[bins.binTriangles[n]], tileX0, tileY0);
+            }
+        }
+    });
+
+    raster.triangles = triangleCount;
+    frameTriangles += triangleCount;
+    raster.frameMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Copies the CPU frame into the GL framebuffer, depth included, so the grid
+// drawn afterwards is depth-tested against the rasterized shape
+void presentSoftwareFrame() {
+    glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+    glDisable(GL_LIGHTING);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_ALWAYS);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, raster.stride);
+    beginPixelOrtho(raster.width, raster.height);
+    glRasterPos2i(0, 0);
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDrawPixels(raster.width, raster.height, GL_DEPTH_COMPONENT, GL_FLOAT, raster.depth.data());
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_FALSE);
+    glDrawPixels(raster.width, raster.height, GL_RGBA, GL_UNSIGNED_BYTE, raster.color.data());
+
+    glPopClientAttrib();
+    glPopAttrib();
+}
+
+bool writeRasterPPM(const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+    fprintf(file, "P6\n%d %d\n255\n", raster.width, raster.height);
+    std::vector<unsigned char> row(raster.width * 3);
+    for (int y = raster.height - 1; y >= 0; y--) {
+        for (int x = 0; x < raster.width; x++) {
+            unsigned int rgba = raster.color[(size_t)y * raster.stride + x];
+            row[x * 3] = rgba & 0xFF;
+            row[x * 3 + 1] = (rgba >> 8) & 0xFF;
+            row[x * 3 + 2] = (rgba >> 16) & 0xFF;
+        }
+        fwrite(row.data(), 1, row.size(), file);
+    }
+    fclose(file);
+    return true;
+}
+
+// Uniform block shared by both core programs, std140 so CoreTransforms below
+// can be copied in as is. row_major lets the matrices stay in the row-major
+// layout used everywhere else.
+#define CORE_TRANSFORM_BLOCK \
+    "layout(std140, row_major) uniform Transforms {\n" \
+    "    mat4 projection;\n" \
+    "    mat4 view;\n" \
+    "    mat4 modelView;\n" \
+    "    vec4 lightPosition;\n" \
+    "    vec4 lightAmbient;\n" \
+    "    vec4 lightDiffuse;\n" \
+    "    vec4 lightSpecular;\n" \
+    "    vec4 shininess;\n" \
+    "};\n"
+
+struct CoreTransforms {
+    float projection[4][4];
+    float view[4][4];
+    float modelView[4][4];   // view * transformMatrix, or view for scene nodes
+    float lightPosition[4];  // Eye space
+    float lightAmbient[4];   // Light ambient plus the light model ambient
+    float lightDiffuse[4];
+    float lightSpecular[4];  // Already multiplied by the material specular
+    float shininess[4];      // x only
+};
+
+// Same per-vertex response as lightVertex() and the fixed-function setup in init()
+const char* coreMeshVertexShader =
+    "#version 330 core\n"
+    CORE_TRANSFORM_BLOCK
+    "layout(location = 0) in vec3 vertexPosition;\n"
+    "layout(location = 2) in vec3 vertexNormal;\n"
+    "layout(location = 3) in vec3 vertexColor;\n"
+    "layout(location = 4) in mat4 instanceMatrix;\n"
+    "out vec3 litColor;\n"
+    "void main() {\n"
+    "    vec4 eyePos = modelView * (instanceMatrix * vec4(vertexPosition, 1.0));\n"
+    "    gl_Position = projection * eyePos;\n"
+    "    mat3 m = mat3(modelView) * mat3(instanceMatrix);\n"
+    "    vec3 c0 = cross(m[1], m[2]);\n"
+    "    mat3 cofactor = mat3(c0, cross(m[2], m[0]), cross(m[0], m[1]));\n"
+    "    vec3 n = normalize(cofactor * vertexNormal) * sign(dot(m[0], c0));\n"
+    "    vec3 l = normalize(lightPosition.xyz - eyePos.xyz);\n"
+    "    vec3 h = normalize(l + vec3(0.0, 0.0, 1.0));\n"
+    "    float diffuse = max(dot(n, l), 0.0);\n"
+    "    float specular = diffuse > 0.0 ? pow(max(dot(n, h), 0.0), shininess.x) : 0.0;\n"
+    "    litColor = clamp(vertexColor * (lightAmbient.rgb + lightDiffuse.rgb * diffuse)\n"
+    "        + lightSpecular.rgb * specular, 0.0, 1.0);\n"
+    "}\n";
+
+// Unlit colored lines in world space, for the grid and axes
+const char* coreLineVertexShader =
+    "#version 330 core\n"
+    CORE_TRANSFORM_BLOCK
+    "layout(location = 0) in vec3 vertexPosition;\n"
+    "layout(location = 3) in vec3 vertexColor;\n"
+    "out vec3 litColor;\n"
+    "void main() {\n"
+    "    gl_Position = projection * (view * vec4(vertexPosition, 1.0));\n"
+    "    litColor = vertexColor;\n"
+    "}\n";
+
+const char* coreFragmentShader =
+    "#version 330 core\n"
+    "in vec3 litColor;\n"
+    "out vec4 fragColor;\n"
+    "void main() {\n"
+    "    fragColor = vec4(litColor, 1.0);\n"
+    "}\n";
+
+// Binds the program's Transforms block to uniform buffer binding 0
+bool bindTransformBlock(GLuint program) {
+    if (!program) return false;
+    GLuint block = pglGetUniformBlockIndex(program, "Transforms");
+    if (block == GL_INVALID_INDEX) return false;
+    pglUniformBlockBinding(program, block, 0);
+    return true;
+}
+
+// Builds the programs and buffers for --core, or falls back to the legacy
+// renderer when the context lacks VAOs, uniform buffers or GLSL 3.30
+void initCorePipeline() {
+    if (!corePipeline) return;
+
+    if (hasCoreObjects) {
+        coreRenderer.meshProgram = linkProgram(coreMeshVertexShader, coreFragmentShader, NULL, 0);
+        coreRenderer.lineProgram = linkProgram(coreLineVertexShader, coreFragmentShader, NULL, 0);
+    }
+    if (!hasCoreObjects || !bindTransformBlock(coreRenderer.meshProgram) || !bindTransformBlock(coreRenderer.lineProgram)) {
+        std::cerr << "GL 3.3 core pipeline unavailable, using the legacy renderer" << std::endl;
+        corePipeline = false;
+        return;
+    }
+
+    pglGenBuffers(1, &coreRenderer.uniformBuffer);
+    pglBindBuffer(GL_UNIFORM_BUFFER, coreRenderer.uniformBuffer);
+    pglBufferData(GL_UNIFORM_BUFFER, sizeof(CoreTransforms), NULL, GL_STREAM_DRAW);
+    pglBindBuffer(GL_UNIFORM_BUFFER, 0);
+    pglBindBufferBase(GL_UNIFORM_BUFFER, 0, coreRenderer.uniformBuffer);
+    pglGenBuffers(1, &coreRenderer.instanceBuffer);
+
+    // Same lines as drawGrid(), as MeshVertex so the attribute layout matches the meshes
+    std::vector<MeshVertex> lines;
+    const float grey[3] = { 0.3f, 0.3f, 0.3f };
+    for (float i = -20; i <= 20; i += 1.0f) {
+        lines.push_back({ { i, 0, -20 }, { 0, 0, 0 }, { grey[0], grey[1], grey[2] } });
+        lines.push_back({ { i, 0, 20 }, { 0, 0, 0 }, { grey[0], grey[1], grey[2] } });
+    }
+    for (float i = -20; i <= 20; i += 1.0f) {
+        lines.push_back({ { -20, 0, i }, { 0, 0, 0 }, { grey[0], grey[1], grey[2] } });
+        lines.push_back({ { 20, 0, i }, { 0, 0, 0 }, { grey[0], grey[1], grey[2] } });
+    }
+    coreRenderer.gridLineVertices = (GLsizei)lines.size();
+    for (int axis = 0; axis < 3; axis++) {
+        MeshVertex origin = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+        origin.color[axis] = 1.0f;
+        MeshVertex end = origin;
+        end.position[axis] = 4.0f;
+        lines.push_back(origin);
+        lines.push_back(end);
+    }
+
+    pglGenVertexArrays(1, &coreRenderer.gridArray);
+    pglBindVertexArray(coreRenderer.gridArray);
+    pglGenBuffers(1, &coreRenderer.gridBuffer);
+    pglBindBuffer(GL_ARRAY_BUFFER, coreRenderer.gridBuffer);
+    pglBufferData(GL_ARRAY_BUFFER, lines.size() * sizeof(MeshVertex), lines.data(), GL_STATIC_DRAW);
+    pglVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (const void*)offsetof(MeshVertex, position));
+    pglVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (const void*)offsetof(MeshVertex, color));
+    pglEnableVertexAttribArray(0);
+    pglEnableVertexAttribArray(3);
+    pglBindVertexArray(0);
+    pglBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Writes this frame's camera, projection and model into the uniform buffer.
+// model is transformMatrix, or NULL when nodes carry their own transforms.
+void updateCoreTransforms(const float model[4][4]) {
+    CoreTransforms transforms;
+    updateCamera();
+    memcpy(transforms.projection, camera.projection, sizeof(camera.projection));
+    memcpy(transforms.view, camera.view, sizeof(camera.view));
+    if (model) {
+        matrixKernels->multiply(transforms.view, model, transforms.modelView);
+    }
+    else {
+        memcpy(transforms.modelView, transforms.view, sizeof(transforms.view));
+    }
+    for (int k = 0; k < 4; k++) {
+        transforms.lightPosition[k] = lightPosition[k];
+        transforms.lightAmbient[k] = lightAmbient[k] + sceneAmbient;
+        transforms.lightDiffuse[k] = lightDiffuse[k];
+        transforms.lightSpecular[k] = lightSpecular[k] * materialSpecular[k];
+        transforms.shininess[k] = materialShininess;
+    }
+
+    pglBindBuffer(GL_UNIFORM_BUFFER, coreRenderer.uniformBuffer);
+    pglBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CoreTransforms), &transforms);
+    pglBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// The single shape is one identity instance; the model matrix is in the block
+void drawCoreShape() {
+    static const std::vector<float> identity = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+    size_t batchStart[drawBatchCount] = {};
+    size_t batchCount[drawBatchCount] = {};
+    batchCount[currentShape * lodLevelCount + currentShapeLod] = 1;
+    drawCoreBatches(identity, batchStart, batchCount);
+}
+
+void drawCoreGrid() {
+    pglUseProgram(coreRenderer.lineProgram);
+    pglBindVertexArray(coreRenderer.gridArray);
+    glDrawArrays(GL_LINES, 0, coreRenderer.gridLineVertices);
+    glLineWidth(2.0f);
+    glDrawArrays(GL_LINES, coreRenderer.gridLineVertices, 6);
+    glLineWidth(1.0f);
+    pglBindVertexArray(0);
+    pglUseProgram(0);
+}
+
+
+// Per-frame arena for transient render data. display() resets it at the
+// start of each frame and everything allocated from it is released at once,
+// so nothing allocated here may outlive the frame. Allocation bumps a
+// pointer through one block; a request that doesn't fit gets its own
+// overflow block from the heap, and the next reset replaces the main block
+// with one big enough for the frame's high-water mark. After a frame or two
+// of warm-up a frame makes no heap allocations. GLUT thread only.
+const size_t frameArenaInitialBytes = 64 << 10;
+
+struct FrameArenaOverflow {
+    FrameArenaOverflow* next;
+};
+
+struct FrameArena {
+    char* block = NULL;
+    size_t capacity = 0;
+    size_t used = 0;
+    FrameArenaOverflow* overflow = NULL;  // Freed by the next reset
+    size_t frameBytes = 0;                // Requested this frame, overflow included
+    size_t highWater = 0;                 // Largest frameBytes so far
+    size_t overflowCount = 0;             // Allocations that missed the main block
+};
+
+FrameArena frameArena;
+
+void resetFrameArena() {
+    FrameArena& a = frameArena;
+    while (a.overflow) {
+        FrameArenaOverflow* next = a.overflow->next;
+        operator delete(a.overflow);
+        a.overflow = next;
+    }
+    // Alignment padding means a frame can need slightly more than it requested
+    size_t wanted = a.highWater + a.highWater / 8;
+    if (!a.block || a.capacity < wanted) {
+        size_t capacity = std::max(frameArenaInitialBytes, a.capacity);
+        while (capacity < wanted) capacity *= 2;
+        operator delete(a.block);
+        a.block = (char*)operator new(capacity);
+        a.capacity = capacity;
+    }
+    a.used = 0;
+    a.frameBytes = 0;
+}
+
+void* frameAllocate(size_t size, size_t alignment) {
+    FrameArena& a = frameArena;
+    a.frameBytes += size;
+    a.highWater = std::max(a.highWater, a.frameBytes);
+    size_t offset = (a.used + alignment - 1) & ~(alignment - 1);
+    if (a.block && offset + size <= a.capacity) {
+        a.used = offset + size;
+        return a.block + offset;
+    }
+    // operator new memory is aligned for any fundamental type
+    size_t header = (sizeof(FrameArenaOverflow) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+    FrameArenaOverflow* overflow = (FrameArenaOverflow*)operator new(header + size);
+    overflow->next = a.overflow;
+    a.overflow = overflow;
+    a.overflowCount++;
+    return (char*)overflow + header;
+}
+
+// STL adapter, e.g. FrameVector<float>. Freeing is a no-op; the memory goes
+// back with the next resetFrameArena().
+template <typename T>
+struct FrameAllocator {
+    typedef T value_type;
+
+    FrameAllocator() {}
+    template <typename U> FrameAllocator(const FrameAllocator<U>&) {}
+
+    T* allocate(size_t count) {
+        return (T*)frameAllocate(count * sizeof(T), alignof(T));
+    }
+    void deallocate(T*, size_t) {}
+};
+
+template <typename T, typename U>
+bool operator==(const FrameAllocator<T>&, const FrameAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const FrameAllocator<T>&, const FrameAllocator<U>&) { return false; }
+
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+
+// Per-stage frame profiler. CPU time comes from steady_clock, GPU time from
+// GL_TIME_ELAPSED queries. Queries are read back gpuQueryFrames frames later,
+// when their slot comes round again, and only if GL reports the results
+// available; a frame whose GPU results are late is committed with its GPU
+// times missing (NaN, an empty CSV field) rather than stalling. Each frame
+// also records its streamed vertex bytes and, in builds that count heap
+// allocations (COUNT_ALLOCATIONS), the allocations made on any thread from
+// beginProfileFrame() to endProfileFrame().
+enum ProfileStage {
+    STAGE_GRID,
+    STAGE_SHAPE,
+    STAGE_BUTTONS,
+    STAGE_TEXT,
+    STAGE_SWAP,
+    STAGE_FRAME,
+    STAGE_COUNT
+};
+
+const char* profileStageNames[STAGE_COUNT] = { "grid", "shape", "buttons", "text", "swap", "frame" };
+const int profileHistory = 240;  // Rolling window for min/avg/p99
+const int gpuQueryFrames = 3;
+
+struct Profiler {
+    float cpuMs[STAGE_COUNT][profileHistory];
+    float gpuMs[STAGE_COUNT][profileHistory];
+    float allocations[profileHistory];
+    int samples = 0;  // Committed frames
+    long frameIndex = 0;
+
+    // Per in-flight frame slot
+    std::chrono::steady_clock::time_point stageStart[STAGE_COUNT];
+    size_t allocationsBefore;
+    float pendingCpuMs[gpuQueryFrames][STAGE_COUNT];
+    size_t pendingAllocations[gpuQueryFrames];
+    size_t pendingStreamBytes[gpuQueryFrames];
+    size_t pendingStreamStalls[gpuQueryFrames];  // Running total at the end of the frame
+    GLuint queries[gpuQueryFrames][STAGE_COUNT];
+    bool queryIssued[gpuQueryFrames][STAGE_COUNT];
+    long pendingFrame[gpuQueryFrames];
+    bool pending[gpuQueryFrames];
+
+    bool gpuTimers = false;
+    long gpuMissed = 0;  // Frames committed before their GPU results were available
+    FILE* csv = NULL;
+};
+
+Profiler profiler;
+bool showProfiler = false;
+std::string profileCsvPath;
+
+bool stageHasGpuTime(int stage) {
+    return stage != STAGE_SWAP && stage != STAGE_FRAME;
+}
+
+void initProfiler() {
+    profiler.gpuTimers = hasTimerQueries;
+    if (profiler.gpuTimers) {
+        pglGenQueries(gpuQueryFrames * STAGE_COUNT, profiler.queries[0]);
+    }
+    for (int slot = 0; slot < gpuQueryFrames; slot++) {
+        profiler.pending[slot] = false;
+    }
+
+    if (!profileCsvPath.empty()) {
+        profiler.csv = fopen(profileCsvPath.c_str(), "w");
+        if (!profiler.csv) {
+            std::cerr << "Cannot open profile CSV " << profileCsvPath << std::endl;
+            return;
+        }
+        fprintf(profiler.csv, "frame");
+        for (int stage = 0; stage < STAGE_COUNT; stage++) fprintf(profiler.csv, ",%s_cpu_ms", profileStageNames[stage]);
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            if (stageHasGpuTime(stage)) fprintf(profiler.csv, ",%s_gpu_ms", profileStageNames[stage]);
+        }
+        fprintf(profiler.csv, ",allocations,stream_bytes,stream_stalls\n");
+    }
+}
+
+// Moves a finished slot into the rolling history and the CSV. GPU results
+// are only read once available, so this never waits on the GPU.
+void commitProfileSlot(int slot) {
+    bool gpuReady = true;
+    for (int stage = 0; stage < STAGE_COUNT && gpuReady; stage++) {
+        if (profiler.gpuTimers && profiler.queryIssued[slot][stage]) {
+            unsigned long long available = 0;
+            pglGetQueryObjectui64v(profiler.queries[slot][stage], GL_QUERY_RESULT_AVAILABLE, &available);
+            gpuReady = available != 0;
+        }
+    }
+
+    float gpuMs[STAGE_COUNT];
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        gpuMs[stage] = gpuReady ? 0.0f : NAN;
+    }
+    for (int stage = 0; stage < STAGE_COUNT && gpuReady; stage++) {
+        if (profiler.gpuTimers && profiler.queryIssued[slot][stage]) {
+            unsigned long long ns = 0;
+            pglGetQueryObjectui64v(profiler.queries[slot][stage], GL_QUERY_RESULT, &ns);
+            gpuMs[stage] = ns / 1.0e6f;
+            gpuMs[STAGE_FRAME] += gpuMs[stage];
+        }
+    }
+    if (!gpuReady) profiler.gpuMissed++;
+
+    int index = profiler.samples % profileHistory;
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        profiler.cpuMs[stage][index] = profiler.pendingCpuMs[slot][stage];
+        profiler.gpuMs[stage][index] = gpuMs[stage];
+    }
+    profiler.allocations[index] = countingAllocations ? (float)profiler.pendingAllocations[slot] : NAN;
+    profiler.samples++;
+
+    if (profiler.csv) {
+        fprintf(profiler.csv, "%ld", profiler.pendingFrame[slot]);
+        for (int stage = 0; stage < STAGE_COUNT; stage++) fprintf(profiler.csv, ",%.4f", profiler.pendingCpuMs[slot][stage]);
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            if (!stageHasGpuTime(stage)) continue;
+            if (gpuReady) fprintf(profiler.csv, ",%.4f", gpuMs[stage]);
+            else fprintf(profiler.csv, ",");
+        }
+        if (countingAllocations) fprintf(profiler.csv, ",%zu", profiler.pendingAllocations[slot]);
+        else fprintf(profiler.csv, ",");
+        fprintf(profiler.csv, ",%zu,%zu\n", profiler.pendingStreamBytes[slot], profiler.pendingStreamStalls[slot]);
+    }
+    profiler.pending[slot] = false;
+}
+
+void beginProfileFrame() {
+    int slot = profiler.frameIndex % gpuQueryFrames;
+    if (profiler.pending[slot]) {
+        commitProfileSlot(slot);
+    }
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        profiler.pendingCpuMs[slot][stage] = 0.0f;
+        profiler.queryIssued[slot][stage] = false;
+    }
+    profiler.stageStart[STAGE_FRAME] = std::chrono::steady_clock::now();
+    profiler.allocationsBefore = heapAllocationCount();
+}
+
+void beginProfileStage(ProfileStage stage) {
+    int slot = profiler.frameIndex % gpuQueryFrames;
+    if (profiler.gpuTimers && stageHasGpuTime(stage)) {
+        pglBeginQuery(GL_TIME_ELAPSED, profiler.queries[slot][stage]);
+        profiler.queryIssued[slot][stage] = true;
+    }
+    profiler.stageStart[stage] = std::chrono::steady_clock::now();
+}
+
+void endProfileStage(ProfileStage stage) {
+    int slot = profiler.frameIndex % gpuQueryFrames;
+    profiler.pendingCpuMs[slot][stage] += std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - profiler.stageStart[stage]).count();
+    if (profiler.gpuTimers && stageHasGpuTime(stage)) {
+        pglEndQuery(GL_TIME_ELAPSED);
+    }
+}
+
+void endProfileFrame() {
+    int slot = profiler.frameIndex % gpuQueryFrames;
+    profiler.pendingCpuMs[slot][STAGE_FRAME] = std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - profiler.stageStart[STAGE_FRAME]).count();
+    profiler.pendingAllocations[slot] = heapAllocationCount() - profiler.allocationsBefore;
+    profiler.pendingStreamBytes[slot] = stream.frameBytes;
+    profiler.pendingStreamStalls[slot] = stream.stalls;
+    profiler.pendingFrame[slot] = profiler.frameIndex;
+    profiler.pending[slot] = true;
+    profiler.frameIndex++;
+}
+
+void closeProfiler() {
+    if (profiler.gpuTimers) glFinish();  // Lets the last frames' results arrive
+    for (int i = 0; i < gpuQueryFrames; i++) {
+        int slot = (profiler.frameIndex + i) % gpuQueryFrames;
+        if (profiler.pending[slot]) commitProfileSlot(slot);
+    }
+    if (profiler.csv) {
+        fclose(profiler.csv);
+        profiler.csv = NULL;
+    }
+}
+
+struct StageSummary {
+    float min, avg, p99;
+};
+
+// history is a profileHistory ring holding samples entries so far; missing
+// (NaN) samples are skipped
+StageSummary summarizeSamples(const float* history, int samples) {
+    StageSummary summary = { 0.0f, 0.0f, 0.0f };
+    float sorted[profileHistory];
+    float total = 0.0f;
+    int count = 0;
+    for (int i = 0; i < std::min(samples, profileHistory); i++) {
+        if (std::isnan(history[i])) continue;
+        sorted[count++] = history[i];
+        total += history[i];
+    }
+    if (count == 0) return summary;
+    std::sort(sorted, sorted + count);
+    summary.min = sorted[0];
+    summary.avg = total / count;
+    summary.p99 = sorted[std::min(count - 1, (int)(count * 0.99f))];
+    return summary;
+}
+
+
+const int maxSavedOrientations = 8;
+const float slerpSegmentSeconds = 1.0f;  // Per pair of saved orientations
+
+// Input/render handoff. Input is applied to a private FrameState, inline in
+// the GLUT callbacks or on the input thread (--input-thread), and published
+// through a lock-free triple buffer. display() takes the newest published
+// state at the start of a frame and never waits on input.
+struct FrameState {
+    float transformMatrix[4][4];
+    // Parts of transformMatrix edited since the last publish, and the 3x3s
+    // they were last composed from, as in updateTransformMatrix()
+    unsigned int transformDirty = DIRTY_ALL;
+    float rotation3[3][3];
+    float scaleShearReflect3[3][3];
+    float position[3];
+    float rotation[3];
+    float scale[3];
+    float shear[3];
+    bool reflection[3];
+    float cameraPos[3];
+    float cameraFront[3];
+    Shape currentShape;
+    TransformationMode currentMode;
+    bool cameraControlMode;
+    bool showProfiler;
+    bool cullingEnabled;
+
+    // Mouse look, only used on the input side
+    float lastX = 400, lastY = 350;  // Last mouse position
+    float yaw = -90.0f;              // Camera yaw angle (horizontal rotation)
+    float pitch = 0.0f;              // Camera pitch angle (vertical rotation)
+    bool firstMouse = true;          // Flag for first mouse movement
+    bool mouseRightDown = false;     // Track right mouse button state
+
+    bool quaternionMode;
+    float orientation[4];  // Unit quaternion, authoritative in quaternion mode
+    float savedOrientations[maxSavedOrientations][4];
+    int savedCount = 0;
+    float playTime = -1.0f;  // Seconds into playback, negative when stopped
+
+    // Held keys and playback move the state continuously; lastStep is how
+    // far that motion has been integrated
+    bool keyDown[256] = {};
+    std::chrono::steady_clock::time_point lastStep = std::chrono::steady_clock::now();
+    bool changed = false;  // Edited since the last publish
+
+    unsigned long long inputSequence = 0;        // Events applied so far
+    std::chrono::steady_clock::time_point inputTime;  // Arrival of the newest one
+};
+
+// Single producer, single consumer. Each side owns one slot and trades it
+// for the shared middle slot with one atomic exchange; freshBit marks a
+// middle slot the reader has not taken yet.
+template <typename T>
+struct TripleBuffer {
+    static const unsigned freshBit = 4;
+    T slots[3];
+    std::atomic<unsigned> middle{ 1 };
+    unsigned back = 0;   // Writer's slot
+    unsigned front = 2;  // Reader's slot
+
+    T& writeSlot() {
+        return slots[back];
+    }
+
+    void publish() {
+        back = middle.exchange(back | freshBit, std::memory_order_acq_rel) & ~freshBit;
+    }
+
+    bool pending() const {
+        return (middle.load(std::memory_order_acquire) & freshBit) != 0;
+    }
+
+    // Moves the newest published value to readSlot(); false if nothing is new
+    bool acquire() {
+        if (!pending()) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & ~freshBit;
+        return true;
+    }
+
+    const T& readSlot() const {
+        return slots[front];
+    }
+};
+
+TripleBuffer<FrameState> frameStates;
+FrameState inputState;  // Owned by whichever thread applies input
+
+// Input-to-present latency: from an event's arrival in its GLUT callback to
+// the end of the buffer swap of the first frame that shows it
+struct InputLatency {
+    float ms[profileHistory];
+    int samples = 0;
+    unsigned long long presentedSequence = 0;
+    bool pending = false;
+    std::chrono::steady_clock::time_point inputTime;
+};
+
+InputLatency inputLatency;
+
+// Copies the render-side globals the input code edits into s
+void captureFrameState(FrameState& s) {
+    memcpy(s.transformMatrix, transformMatrix, sizeof(transformMatrix));
+    for (int k = 0; k < 3; k++) {
+        s.position[k] = position[k];
+        s.rotation[k] = rotation[k];
+        s.scale[k] = scale[k];
+        s.shear[k] = shear[k];
+        s.reflection[k] = reflection[k];
+        s.cameraPos[k] = cameraPos[k];
+        s.cameraFront[k] = cameraFront[k];
+    }
+    s.currentShape = currentShape;
+    s.currentMode = currentMode;
+    s.cameraControlMode = cameraControlMode;
+    s.showProfiler = showProfiler;
+    s.cullingEnabled = cullingEnabled;
+    s.quaternionMode = quaternionRotation;
+    quaternionFromEuler(rotation, s.orientation);
+    s.transformDirty = DIRTY_ALL;  // The render-side caches may be stale
+}
+
+void applyFrameState(const FrameState& s) {
+    memcpy(transformMatrix, s.transformMatrix, sizeof(transformMatrix));
+    for (int k = 0; k < 3; k++) {
+        position[k] = s.position[k];
+        rotation[k] = s.rotation[k];
+        scale[k] = s.scale[k];
+        shear[k] = s.shear[k];
+        reflection[k] = s.reflection[k];
+        cameraPos[k] = s.cameraPos[k];
+        cameraFront[k] = s.cameraFront[k];
+    }
+    // The caches transformMatrix was composed from come along with it
+    memcpy(cachedRotation3, s.rotation3, sizeof(cachedRotation3));
+    memcpy(cachedScaleShearReflect3, s.scaleShearReflect3, sizeof(cachedScaleShearReflect3));
+    transformDirty = 0;
+    currentShape = s.currentShape;
+    currentMode = s.currentMode;
+    cameraControlMode = s.cameraControlMode;
+    showProfiler = s.showProfiler;
+    cullingEnabled = s.cullingEnabled;
+    quaternionRotation = s.quaternionMode;
+    savedOrientationCount = s.savedCount;
+    orientationPlayback = s.playTime >= 0.0f;
+
+    selectWidgetInGroup(widgetRegistry.shapeWidgets, shapeTypeCount, currentShape);
+    selectWidgetInGroup(widgetRegistry.modeWidgets, transformationModeCount, currentMode);
+    setWidgetSelected(widgetRegistry.cameraWidget, cameraControlMode);
+    if (sceneMode) {
+        storeSelectedSceneNode();
+    }
+}
+
+// Rates for held keys. At a typical 30 Hz key repeat they match the old
+// fixed steps per keypress (0.1 units, 5 degrees).
+const float moveRate = 3.0f;     // Units per second
+const float rotateRate = 150.0f; // Degrees per second
+const float scaleRate = 3.0f;    // Scale units per second
+const float shearRate = 3.0f;    // Shear units per second
+const float maxInputStep = 0.25f;  // Seconds; caps the jump after a stall
+
+bool motionKeysHeld(const FrameState& s) {
+    return s.keyDown['w'] || s.keyDown['s'] || s.keyDown['a'] || s.keyDown['d'] || s.keyDown['q'] || s.keyDown['e'];
+}
+
+// True while the state changes without further input
+bool inputAnimating(const FrameState& s) {
+    return motionKeysHeld(s) || s.playTime >= 0.0f;
+}
+
+// Slerps through the saved orientations, one segment per slerpSegmentSeconds
+void advancePlayback(FrameState& s, float dt) {
+    if (s.playTime < 0.0f) return;
+    s.playTime += dt;
+    float t = s.playTime / slerpSegmentSeconds;
+    int last = s.savedCount - 1;
+    if (t >= last) {
+        memcpy(s.orientation, s.savedOrientations[last], sizeof(s.orientation));
+        s.playTime = -1.0f;
+    }
+    else {
+        int segment = (int)t;
+        quaternionSlerp(s.savedOrientations[segment], s.savedOrientations[segment + 1], t - segment, s.orientation);
+    }
+    s.transformDirty |= DIRTY_ROTATION;
+    s.changed = true;
+}
+
+// Moves the state by the held keys over dt seconds
+void integrateHeldKeys(FrameState& s, float dt) {
+    if (!motionKeysHeld(s)) return;
+
+    // +1 / -1 / 0 per key pair
+    float ws = (s.keyDown['w'] ? 1.0f : 0.0f) - (s.keyDown['s'] ? 1.0f : 0.0f);
+    float da = (s.keyDown['d'] ? 1.0f : 0.0f) - (s.keyDown['a'] ? 1.0f : 0.0f);
+    float eq = (s.keyDown['e'] ? 1.0f : 0.0f) - (s.keyDown['q'] ? 1.0f : 0.0f);
+
+    if (s.cameraControlMode) {
+        float right[] = {
+            s.cameraFront[1] * cameraUp[2] - s.cameraFront[2] * cameraUp[1],
+            s.cameraFront[2] * cameraUp[0] - s.cameraFront[0] * cameraUp[2],
+            s.cameraFront[0] * cameraUp[1] - s.cameraFront[1] * cameraUp[0]
+        };
+        float length = sqrt(right[0] * right[0] + right[1] * right[1] + right[2] * right[2]);
+        float step = cameraSpeed * dt;
+        for (int k = 0; k < 3; k++) {
+            s.cameraPos[k] += (s.cameraFront[k] * ws + right[k] / length * da) * step;
+        }
+        s.cameraPos[1] -= eq * step;  // q moves up, e moves down
+        s.changed = true;
+        return;
+    }
+
+    switch (s.currentMode) {
+    case TRANSLATE:
+        s.position[0] += da * moveRate * dt;
+        s.position[1] += ws * moveRate * dt;
+        s.position[2] += eq * moveRate * dt;
+        s.transformDirty |= DIRTY_POSITION;
+        break;
+    case ROTATE:
+        if (s.quaternionMode) {
+            // One rotation about the world-space axis of the combined keys
+            float axis[3] = { ws, da, eq };
+            float length = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+            if (length == 0.0f) return;
+            for (int k = 0; k < 3; k++) axis[k] /= length;
+            float delta[4], rotated[4];
+            quaternionFromAxisAngle(axis, length * rotateRate * dt, delta);
+            quaternionMultiply(delta, s.orientation, rotated);
+            quaternionNormalize(rotated);
+            memcpy(s.orientation, rotated, sizeof(rotated));
+        }
+        else {
+            s.rotation[0] += ws * rotateRate * dt;
+            s.rotation[1] += da * rotateRate * dt;
+            s.rotation[2] += eq * rotateRate * dt;
+        }
+        s.transformDirty |= DIRTY_ROTATION;
+        break;
+    case SCALE:
+        s.scale[0] = std::max(0.1f, s.scale[0] + da * scaleRate * dt);
+        s.scale[1] = std::max(0.1f, s.scale[1] + ws * scaleRate * dt);
+        s.scale[2] = std::max(0.1f, s.scale[2] + eq * scaleRate * dt);
+        s.transformDirty |= DIRTY_SCALE;
+        break;
+    case SHEAR:
+        s.shear[0] += ws * shearRate * dt;
+        s.shear[1] -= da * shearRate * dt;
+        s.shear[2] -= eq * shearRate * dt;
+        s.transformDirty |= DIRTY_SHEAR;
+        break;
+    case REFLECT:
+        return;  // Reflection only toggles
+    }
+    s.changed = true;
+}
+
+// Runs playback and held keys from s.lastStep up to until, so motion
+// depends only on elapsed time, not on the frame or event rate
+void advanceInput(FrameState& s, std::chrono::steady_clock::time_point until) {
+    float dt = std::chrono::duration<float>(until - s.lastStep).count();
+    if (dt <= 0.0f) return;
+    s.lastStep = until;
+    dt = std::min(dt, maxInputStep);
+    advancePlayback(s, dt);
+    integrateHeldKeys(s, dt);
+}
+
+// Rebuilds the parts of s.transformMatrix marked in s.transformDirty, the
+// same way updateTransformMatrix() does for the globals. The translation
+// column is linear * position, so it follows any linear change.
+void composeFrameTransform(FrameState& s) {
+    bool linearDirty = false;
+    if (s.transformDirty & DIRTY_ROTATION) {
+        if (s.quaternionMode) {
+            // One quaternion to matrix conversion; the Euler angles are
+            // derived for the HUD and scene nodes
+            quaternionToRotation3(s.orientation, s.rotation3);
+            rotation3ToEuler(s.rotation3, s.rotation);
+        }
+        else {
+            composeRotation3(s.rotation, s.rotation3);
+        }
+        linearDirty = true;
+    }
+    if (s.transformDirty & (DIRTY_SCALE | DIRTY_SHEAR | DIRTY_REFLECTION)) {
+        composeScaleShearReflect3(s.scale, s.shear, s.reflection, s.scaleShearReflect3);
+        linearDirty = true;
+    }
+    if (linearDirty) {
+        composeLinear(s.scaleShearReflect3, s.rotation3, s.transformMatrix);
+    }
+    if (linearDirty || (s.transformDirty & DIRTY_POSITION)) {
+        composeTranslation(s.position, s.transformMatrix);
+    }
+    s.transformDirty = 0;
+}
+
+// Composes the transform once for everything applied since the last
+// publish and hands the state to the render thread. Camera-only edits
+// leave transformDirty clear and skip the compose.
+void publishInputState(FrameState& s) {
+    if (s.transformDirty) {
+        composeFrameTransform(s);
+    }
+    s.changed = false;
+    frameStates.writeSlot() = s;
+    frameStates.publish();
+}
+
+// Brings held-key motion up to now and publishes if anything changed. Runs
+// once per rendered frame, so any number of events in between costs a
+// single transform update.
+void stepInput(FrameState& s) {
+    advanceInput(s, inputClockNow());
+    if (s.changed) {
+        publishInputState(s);
+    }
+}
+
+// Called at the start of display()
+void acquireFrameState() {
+    if (!frameStates.acquire()) return;
+    const FrameState& s = frameStates.readSlot();
+    applyFrameState(s);
+    if (s.inputSequence != inputLatency.presentedSequence) {
+        inputLatency.presentedSequence = s.inputSequence;
+        inputLatency.inputTime = s.inputTime;
+        inputLatency.pending = true;
+    }
+}
+
+// Called once the frame is swapped
+void recordInputLatency() {
+    if (!inputLatency.pending) return;
+    inputLatency.ms[inputLatency.samples % profileHistory] = std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - inputLatency.inputTime).count();
+    inputLatency.samples++;
+    inputLatency.pending = false;
+}
+
+// startInputThread() keeps input inline in scene mode
+bool inputOnThread() {
+    return useInputThread && !sceneMode;
+}
+
+const char* inputModeName() {
+    return inputOnThread() ? "input thread" : "inline";
+}
+
+void reportInputLatency() {
+    if (inputLatency.samples == 0) return;
+    StageSummary latency = summarizeSamples(inputLatency.ms, inputLatency.samples);
+    printf("Input latency (%s): min %.2f ms, avg %.2f ms, p99 %.2f ms over the last %d inputs\n",
+        inputModeName(), latency.min, latency.avg, latency.p99,
+        std::min(inputLatency.samples, profileHistory));
+}
+
+// Input recordings (--record FILE): a header with the starting state, then
+// one tagged entry per input event as it reaches postInput() and one per
+// rendered frame with the state it showed. Times are microseconds since
+// the recording started.
+const char inputRecordMagic[8] = { 'T', 'F', 'I', 'N', 'P', 'U', 'T', '\0' };
+const unsigned int inputRecordVersion = 1;
+const unsigned char recordEventTag = 'E';
+const unsigned char recordFrameTag = 'F';
+
+struct RecordedState {
+    float position[3], rotation[3], scale[3], shear[3];
+    float cameraPos[3], cameraFront[3];
+    float orientation[4];
+    unsigned char reflection;  // Bit per axis
+    unsigned char shape;
+    unsigned char mode;
+    unsigned char flags;       // 1 = camera control, 2 = quaternion rotation
+};
+
+struct InputRecordHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int stateSize;  // sizeof(RecordedState)
+    RecordedState initial;
+};
+
+struct RecordedEvent {
+    unsigned long long micros;
+    unsigned char type;  // InputEventType
+    unsigned char key;
+    unsigned char button;
+    unsigned char state;
+    short x, y;
+};
+
+struct RecordedFrame {
+    unsigned long long micros;
+    RecordedState state;
+};
+
+struct InputRecorder {
+    FILE* file = NULL;
+    std::chrono::steady_clock::time_point start;
+    size_t events = 0;
+    size_t frames = 0;
+};
+
+InputRecorder inputRecorder;
+std::string recordPath;
+
+void captureRecordedState(const FrameState& s, RecordedState& r) {
+    memset(&r, 0, sizeof(r));
+    for (int k = 0; k < 3; k++) {
+        r.position[k] = s.position[k];
+        r.rotation[k] = s.rotation[k];
+        r.scale[k] = s.scale[k];
+        r.shear[k] = s.shear[k];
+        r.cameraPos[k] = s.cameraPos[k];
+        r.cameraFront[k] = s.cameraFront[k];
+        r.reflection |= s.reflection[k] ? 1 << k : 0;
+    }
+    memcpy(r.orientation, s.orientation, sizeof(r.orientation));
+    r.shape = (unsigned char)s.currentShape;
+    r.mode = (unsigned char)s.currentMode;
+    r.flags = (s.cameraControlMode ? 1 : 0) | (s.quaternionMode ? 2 : 0);
+}
+
+void applyRecordedState(const RecordedState& r, FrameState& s) {
+    for (int k = 0; k < 3; k++) {
+        s.position[k] = r.position[k];
+        s.rotation[k] = r.rotation[k];
+        s.scale[k] = r.scale[k];
+        s.shear[k] = r.shear[k];
+        s.cameraPos[k] = r.cameraPos[k];
+        s.cameraFront[k] = r.cameraFront[k];
+        s.reflection[k] = (r.reflection >> k) & 1;
+    }
+    memcpy(s.orientation, r.orientation, sizeof(s.orientation));
+    s.currentShape = (Shape)std::min((int)r.shape, shapeTypeCount - 1);
+    s.currentMode = (TransformationMode)std::min((int)r.mode, (int)REFLECT);
+    s.cameraControlMode = (r.flags & 1) != 0;
+    s.quaternionMode = (r.flags & 2) != 0;
+    s.transformDirty = DIRTY_ALL;
+    s.changed = true;
+}
+
+// FNV-1a over the state; equal checksums mean bit-identical transforms
+unsigned long long hashRecordedState(const RecordedState& r) {
+    unsigned long long hash = 14695981039346656037ULL;
+    const unsigned char* bytes = (const unsigned char*)&r;
+    for (size_t i = 0; i < sizeof(r); i++) hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    return hash;
+}
+
+unsigned long long recordMicros(std::chrono::steady_clock::time_point time) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(time - inputRecorder.start).count();
+    return elapsed > 0 ? (unsigned long long)elapsed : 0;
+}
+
+void closeInputRecording() {
+    if (!inputRecorder.file) return;
+    fclose(inputRecorder.file);
+    inputRecorder.file = NULL;
+    printf("Recorded %zu input events and %zu frames to %s\n", inputRecorder.events, inputRecorder.frames, recordPath.c_str());
+}
+
+// Starts recording from the state in s, after init() and captureFrameState()
+bool openInputRecording(const FrameState& s) {
+    inputRecorder.file = fopen(recordPath.c_str(), "wb");
+    if (!inputRecorder.file) {
+        std::cerr << "Cannot write input recording " << recordPath << std::endl;
+        return false;
+    }
+    InputRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, inputRecordMagic, sizeof(inputRecordMagic));
+    header.version = inputRecordVersion;
+    header.stateSize = sizeof(RecordedState);
+    captureRecordedState(s, header.initial);
+    fwrite(&header, sizeof(header), 1, inputRecorder.file);
+    inputRecorder.start = std::chrono::steady_clock::now();
+    atexit(closeInputRecording);
+    return true;
+}
+
+// Called by display() once the frame's state is applied
+void recordFrameState() {
+    if (!inputRecorder.file) return;
+    FrameState shown;
+    captureFrameState(shown);
+    RecordedFrame frame;
+    frame.micros = recordMicros(std::chrono::steady_clock::now());
+    captureRecordedState(shown, frame.state);
+    fwrite(&recordFrameTag, 1, 1, inputRecorder.file);
+    fwrite(&frame, sizeof(frame), 1, inputRecorder.file);
+    inputRecorder.frames++;
+}
+
+
+void init() {
+    loadGLExtensions();
+
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+
+    // Enable lighting
+    glEnable(GL_LIGHTING);
+    glEnable(GL_LIGHT0);
+    glEnable(GL_COLOR_MATERIAL);
+    glColorMaterial(GL_FRONT, GL_AMBIENT_AND_DIFFUSE);
+
+    // Set up light
+    glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
+    glLightfv(GL_LIGHT0, GL_AMBIENT, lightAmbient);
+    glLightfv(GL_LIGHT0, GL_DIFFUSE, lightDiffuse);
+    glLightfv(GL_LIGHT0, GL_SPECULAR, lightSpecular);
+
+    // Ambient and diffuse follow glColor through GL_COLOR_MATERIAL
+    GLfloat mat_ambient[] = { 0.7f, 0.7f, 0.7f, 1.0f };
+    GLfloat mat_diffuse[] = { 0.8f, 0.8f, 0.8f, 1.0f };
+
+    glMaterialfv(GL_FRONT, GL_AMBIENT, mat_ambient);
+    glMaterialfv(GL_FRONT, GL_DIFFUSE, mat_diffuse);
+    glMaterialfv(GL_FRONT, GL_SPECULAR, materialSpecular);
+    glMaterialf(GL_FRONT, GL_SHININESS, materialShininess);
+
+    // Modified button layout
+    float buttonWidth = 30;  // Increased width for better visibility
+    float buttonHeight = 30;
+    float padding = 10;
+
+    // Shape selection buttons - right side
+    float shapeStartX = 1550;
+    float shapeStartY = 1000;
+
+    // Transformation buttons - left side
     float transformStartX = 10;
     float transformStartY = 500;
 
-    buttons.clear();
+    clearWidgets();
 
     // Shape selection buttons (right side)
-    buttons.push_back(Button(shapeStartX, shapeStartY - 0 * (buttonHeight + padding), buttonWidth, buttonHeight, "Cube", true, CUBE, currentShape == CUBE));
-    buttons.push_back(Button(shapeStartX, shapeStartY - 1 * (buttonHeight + padding), buttonWidth, buttonHeight, "Sphere", true, SPHERE, currentShape == SPHERE));
-    buttons.push_back(Button(shapeStartX, shapeStartY - 2 * (buttonHeight + padding), buttonWidth, buttonHeight, "Pyramid", true, PYRAMID, currentShape == PYRAMID));
-    buttons.push_back(Button(shapeStartX, shapeStartY - 3 * (buttonHeight + padding), buttonWidth, buttonHeight, "Cylinder", true, CYLINDER, currentShape == CYLINDER));
+    const char* shapeLabels[shapeTypeCount] = { "Cube", "Sphere", "Pyramid", "Cylinder", "Mesh" };
+    int shapeButtons = shapeMeshes[IMPORTED][0].built ? shapeTypeCount : builtinShapeCount;
+    for (int shape = 0; shape < shapeButtons; shape++) {
+        addWidget(shapeStartX, shapeStartY - shape * (buttonHeight + padding), buttonWidth, buttonHeight,
+            shapeLabels[shape], WIDGET_SELECT_SHAPE, shape, currentShape == shape);
+    }
 
     // Transformation mode buttons (left side)
-    buttons.push_back(Button(transformStartX, transformStartY - 0 * (buttonHeight + padding), buttonWidth, buttonHeight, "Translate", false, TRANSLATE, currentMode == TRANSLATE));
-    buttons.push_back(Button(transformStartX, transformStartY - 1 * (buttonHeight + padding), buttonWidth, buttonHeight, "Rotate", false, ROTATE, currentMode == ROTATE));
-    buttons.push_back(Button(transformStartX, transformStartY - 2 * (buttonHeight + padding), buttonWidth, buttonHeight, "Scale", false, SCALE, currentMode == SCALE));
-    buttons.push_back(Button(transformStartX, transformStartY - 3 * (buttonHeight + padding), buttonWidth, buttonHeight, "Shear", false, SHEAR, currentMode == SHEAR));
-    buttons.push_back(Button(transformStartX, transformStartY - 4 * (buttonHeight + padding), buttonWidth, buttonHeight, "Reflect", false, REFLECT, currentMode == REFLECT));
+    const char* modeLabels[transformationModeCount] = { "Translate", "Rotate", "Scale", "Shear", "Reflect" };
+    for (int mode = 0; mode < transformationModeCount; mode++) {
+        addWidget(transformStartX, transformStartY - mode * (buttonHeight + padding), buttonWidth, buttonHeight,
+            modeLabels[mode], WIDGET_SELECT_MODE, mode, currentMode == mode);
+    }
 
     // Add camera control button
     float cameraButtonX = 10;
     float cameraButtonY = 550;
     float buttonWidth2 = 30;  // Wider button for better visibility
     float buttonHeight2 = 30;
+    addWidget(cameraButtonX, cameraButtonY, buttonWidth2, buttonHeight2, "Camera Control", WIDGET_TOGGLE_CAMERA, 0, cameraControlMode);
+    buildWidgetGrid();
+
+    initInstancing();
+    initCorePipeline();
+    initStreamBuffer();
+    initProfiler();
+    if (softwareRaster) {
+        startThreadPool(rasterThreads > 0 ? rasterThreads : std::max(1, (int)std::thread::hardware_concurrency()));
+    }
+}
+
+
+
+void renderProfilerOverlay() {
+    char buffer[256];
+    float x = 430, y = 670;
+    int header = snprintf(buffer, sizeof(buffer), "Stage     CPU min/avg/p99 ms%s", profiler.gpuTimers ? "   GPU avg/p99 ms" : "");
+    if (profiler.gpuMissed > 0) {
+        snprintf(buffer + header, sizeof(buffer) - header, " (%ld late)", profiler.gpuMissed);
+    }
+    renderText(x, y, buffer);
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        StageSummary cpu = summarizeSamples(profiler.cpuMs[stage], profiler.samples);
+        int length = snprintf(buffer, sizeof(buffer), "%-8s  %5.2f/%5.2f/%5.2f", profileStageNames[stage], cpu.min, cpu.avg, cpu.p99);
+        if (profiler.gpuTimers && stage != STAGE_SWAP) {
+            StageSummary gpu = summarizeSamples(profiler.gpuMs[stage], profiler.samples);
+            snprintf(buffer + length, sizeof(buffer) - length, "   %5.2f/%5.2f", gpu.avg, gpu.p99);
+        }
+        renderText(x, y - 20 * (stage + 1), buffer);
+    }
+    StageSummary latency = summarizeSamples(inputLatency.ms, inputLatency.samples);
+    snprintf(buffer, sizeof(buffer), "input     %5.2f/%5.2f/%5.2f   (%s)", latency.min, latency.avg, latency.p99,
+        inputModeName());
+    renderText(x, y - 20 * (STAGE_COUNT + 1), buffer);
+    StageSummary allocations = summarizeSamples(profiler.allocations, profiler.samples);
+    int length = countingAllocations ?
+        snprintf(buffer, sizeof(buffer), "allocs    %.0f/%.1f/%.0f", allocations.min, allocations.avg, allocations.p99) :
+        snprintf(buffer, sizeof(buffer), "allocs    not counted");
+    snprintf(buffer + length, sizeof(buffer) - length, "   arena %zu/%zu KB, %zu overflows",
+        frameArena.highWater >> 10, frameArena.capacity >> 10, frameArena.overflowCount);
+    renderText(x, y - 20 * (STAGE_COUNT + 2), buffer);
+    snprintf(buffer, sizeof(buffer), "stream    %.1f KB/frame  %.2f MB/s  %zu stalls  %zu overflows  (%s)",
+        stream.frameBytes / 1024.0, streamMegabytesPerSecond(), stream.stalls, stream.overflows, streamModeNames[stream.mode]);
+    renderText(x, y - 20 * (STAGE_COUNT + 3), buffer);
+}
+
+// Layered rendering. The 3D scene and the HUD (buttons, instructions and the
+// mode lines) render into their own framebuffer objects and are redrawn only
+// when the state they show changes: each layer keeps a signature of its
+// inputs and is reused while the signature matches. Each frame blits the
+// scene layer and draws the HUD's non-empty rectangles over it as textured
+// quads in one batch, then draws the per-frame status text (transform
+// readout, timings) straight into the window. A full-window blit costs more
+// than redrawing a small mesh, so the scene layer is only used when the 3D
+// pass is expensive: the software rasterizer or a large mesh. Instances and
+// scene nodes animate or carry per-node state, so those modes draw the 3D
+// part directly every frame and only the HUD layer is cached.
+struct RenderLayer {
+    GLuint framebuffer = 0;
+    GLuint color = 0;
+    GLuint depth = 0;     // Renderbuffer, scene layer only
+    int width = 0, height = 0;
+    bool valid = false;   // Contents match signature
+    std::vector<unsigned char> signature;
+    std::vector<float> regions;  // x0, y0, x1, y1 of each drawn area, HUD only
+};
+
+RenderLayer sceneLayer, hudLayer;
+bool layersEnabled = true;  // --no-layers draws everything every frame
+const size_t sceneLayerMinTriangles = 100000;
+size_t sceneLayerTriangles = 0;
+
+void appendSignature(FrameVector<unsigned char>& signature, const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    signature.insert(signature.end(), bytes, bytes + size);
+}
+
+// (Re)allocates the layer's attachments for the window size. Returns false
+// and turns layers off if the framebuffer cannot be completed.
+bool resizeLayer(RenderLayer& layer, int width, int height, bool withDepth) {
+    if (layer.framebuffer && layer.width == width && layer.height == height) return true;
+    if (!layer.framebuffer) {
+        pglGenFramebuffers(1, &layer.framebuffer);
+        glGenTextures(1, &layer.color);
+        if (withDepth) pglGenRenderbuffers(1, &layer.depth);
+    }
+    glBindTexture(GL_TEXTURE_2D, layer.color);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    pglBindFramebuffer(GL_FRAMEBUFFER, layer.framebuffer);
+    pglFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, layer.color, 0);
+    if (withDepth) {
+        pglBindRenderbuffer(GL_RENDERBUFFER, layer.depth);
+        pglRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        pglBindRenderbuffer(GL_RENDERBUFFER, 0);
+        pglFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, layer.depth);
+    }
+    GLenum status = pglCheckFramebufferStatus(GL_FRAMEBUFFER);
+    pglBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Layer framebuffer incomplete (0x" << std::hex << status << std::dec << "), drawing without layers" << std::endl;
+        layersEnabled = false;
+        return false;
+    }
+    layer.width = width;
+    layer.height = height;
+    layer.valid = false;
+    return true;
+}
+
+// Returns true with the layer's framebuffer bound and cleared when its
+// contents are stale; false when the cached contents can be reused
+bool beginLayer(RenderLayer& layer, int width, int height, bool withDepth, const FrameVector<unsigned char>& signature) {
+    if (!resizeLayer(layer, width, height, withDepth)) return false;
+    if (layer.valid && signature.size() == layer.signature.size() &&
+        memcmp(signature.data(), layer.signature.data(), signature.size()) == 0) {
+        return false;
+    }
+    layer.signature.assign(signature.begin(), signature.end());
+    layer.valid = true;
+    pglBindFramebuffer(GL_FRAMEBUFFER, layer.framebuffer);
+    return true;
+}
+
+void endLayer() {
+    pglBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+bool sceneWorthCaching() {
+    if (sceneMode || instanceMode) return false;
+    return softwareRaster || meshIndexCount(getShapeMesh(currentShape, currentShapeLod)) / 3 >= sceneLayerMinTriangles;
+}
+
+// Everything the single-shape scene draws from: camera, model, shape and level
+bool beginSceneLayer(int width, int height) {
+    FrameVector<unsigned char> signature;
+    signature.reserve(sizeof(camera.view) + sizeof(camera.projection) + sizeof(transformMatrix) + 16);
+    appendSignature(signature, camera.view, sizeof(camera.view));
+    appendSignature(signature, camera.projection, sizeof(camera.projection));
+    appendSignature(signature, transformMatrix, sizeof(transformMatrix));
+    appendSignature(signature, &currentShape, sizeof(currentShape));
+    appendSignature(signature, &currentShapeLod, sizeof(currentShapeLod));
+    if (!beginLayer(sceneLayer, width, height, true, signature)) return false;
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    return true;
+}
+
+// Buttons and the text queued so far for the HUD, button labels included.
+// Text regions are whole glyph cells per character, which covers any
+// glyph's advance.
+bool beginHudLayer(int width, int height) {
+    FrameVector<unsigned char> signature;
+    FrameVector<float> regions;
+    signature.reserve(sizeof(widgetRegistry.revision) + textBatch.chars.size() + textBatch.runs.size() * 16);
+    regions.reserve((widgetRegistry.widgets.size() + textBatch.runs.size()) * 4);
+    appendSignature(signature, &widgetRegistry.revision, sizeof(widgetRegistry.revision));
+    for (const Widget& w : widgetRegistry.widgets) {
+        float rect[4] = { w.x, w.y, w.x + w.width, w.y + w.height };
+        regions.insert(regions.end(), rect, rect + 4);
+    }
+    float scaleX = width / 800.0f, scaleY = height / 700.0f;
+    for (const TextRun& run : textBatch.runs) {
+        float origin[2] = { run.x, run.y };
+        appendSignature(signature, origin, sizeof(origin));
+        appendSignature(signature, &run.virtualSpace, sizeof(run.virtualSpace));
+        appendSignature(signature, &textBatch.chars[run.start], run.length);
+        appendSignature(signature, "", 1);
+        float x = floor(run.virtualSpace ? run.x * scaleX : run.x) - glyphOriginX;
+        float y = floor(run.virtualSpace ? run.y * scaleY : run.y) - glyphOriginY;
+        float rect[4] = { x, y, x + run.length * glyphCellWidth, y + glyphCellHeight };
+        regions.insert(regions.end(), rect, rect + 4);
+    }
+    if (!beginLayer(hudLayer, width, height, false, signature)) return false;
+    hudLayer.regions.assign(regions.begin(), regions.end());
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);  // Transparent where nothing is drawn
+    glClear(GL_COLOR_BUFFER_BIT);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    return true;
+}
+
+// The scene layer is copied with a blit. The HUD quads map texels one to
+// one onto pixels and are alpha tested rather than blended, matching the
+// alpha test its glyphs were drawn with, so both copies are exact.
+void compositeLayers(int width, int height, bool withScene) {
+    if (withScene) {
+        pglBindFramebuffer(GL_READ_FRAMEBUFFER, sceneLayer.framebuffer);
+        pglBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        pglBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        pglBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT | GL_TEXTURE_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_TEXTURE_2D);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    glEnable(GL_ALPHA_TEST);
+    glAlphaFunc(GL_GREATER, 0.5f);
+    beginPixelOrtho(width, height);
+    glBindTexture(GL_TEXTURE_2D, hudLayer.color);
+    TextVertex* out = (TextVertex*)mapStreamVertices(hudLayer.regions.size() * sizeof(TextVertex));
+    GLsizei vertexCount = 0;
+    for (size_t i = 0; i < hudLayer.regions.size(); i += 4) {
+        float x0 = std::max(0.0f, hudLayer.regions[i]), y0 = std::max(0.0f, hudLayer.regions[i + 1]);
+        float x1 = std::min((float)width, hudLayer.regions[i + 2]), y1 = std::min((float)height, hudLayer.regions[i + 3]);
+        if (x0 >= x1 || y0 >= y1) continue;
+        TextVertex quad[4] = {
+            { x0, y0, x0 / width, y0 / height }, { x1, y0, x1 / width, y0 / height },
+            { x1, y1, x1 / width, y1 / height }, { x0, y1, x0 / width, y1 / height }
+        };
+        memcpy(out + vertexCount, quad, sizeof(quad));
+        vertexCount += 4;
+    }
+    const char* base = commitStreamVertices();
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glVertexPointer(2, GL_FLOAT, sizeof(TextVertex), base + offsetof(TextVertex, x));
+    glTexCoordPointer(2, GL_FLOAT, sizeof(TextVertex), base + offsetof(TextVertex, u));
+    unbindStreamBuffer();
+    glDrawArrays(GL_QUADS, 0, vertexCount);
+    glPopClientAttrib();
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPopAttrib();
+}
+
+// The shape, instances or scene nodes with the camera already loaded
+void drawShapePass() {
+    if (corePipeline) {
+        // Scene nodes carry their own transforms; otherwise transformMatrix is the model
+        updateCoreTransforms(sceneMode ? NULL : transformMatrix);
+    }
+    if (sceneMode) {
+        // transformMatrix is the selected node's local matrix; nodes carry their own
+        drawScene();
+    }
+    else if (instanceMode) {
+        // The keyboard transform acts as a parent of the whole instance set
+        pushCameraMatrix();
+        multiplyCameraMatrix(transformMatrix);
+        uploadCameraModelView();
+        composeInstanceMatrices(secondsSinceStart());
+        drawInstances();
+        popCameraMatrix();
+    }
+    else if (softwareRaster) {
+        rasterizeShape(windowWidth(), windowHeight());
+        presentSoftwareFrame();
+    }
+    else if (corePipeline) {
+        drawCoreShape();
+    }
+    else {
+        pushCameraMatrix();
+        multiplyCameraMatrix(transformMatrix);
+        uploadCameraModelView();
+        drawShape();
+        popCameraMatrix();
+    }
+}
+
+// HUD lines that change only with the mode or a button, cached with the buttons
+void renderHudText() {
+    char buffer[256];
+
+    // Camera Control 
+    snprintf(buffer, sizeof(buffer), "Camera Control: %s", cameraControlMode ? "ON" : "OFF");
+    renderText(10, 570, buffer);
+
+    renderText(700, 10, "Love Dewangan 500109339");
+
+    
+    const char* modeText;
+    switch (currentMode) {
+    case TRANSLATE: modeText = "TRANSLATE"; break;
+    case ROTATE: modeText = "ROTATE"; break;
+    case SCALE: modeText = "SCALE"; break;
+    case SHEAR: modeText = "SHEAR"; break;
+    case REFLECT: modeText = "REFLECT"; break;
+    default: modeText = "UNKNOWN"; break;
+    }
+
+    snprintf(buffer, sizeof(buffer), "Current Mode: %s", modeText);
+    renderText(10, 550, buffer);
+
+    renderInstructions();
+}
+
+void display() {
+    beginProfileFrame();
+    resetFrameArena();  // After the profiler so a growing block is counted
+    beginStreamFrame();
+    if (!inputOnThread()) {
+        stepInput(inputState);
+    }
+    acquireFrameState();
+    recordFrameState();
+    if (!textBatch.atlasTried) {
+        buildTextAtlas();  // Needs the back buffer, so before the clear
+    }
+    int width = windowWidth();
+    int height = windowHeight();
+    bool layered = layersEnabled && hasFramebuffers && resizeLayer(hudLayer, width, height, false);
+    updateCamera();
+    if (!sceneMode && !instanceMode) {
+        updateCurrentShapeLod();
+    }
+    bool sceneCached = layered && sceneWorthCaching() && resizeLayer(sceneLayer, width, height, true);
+    bool drawObjects = !sceneCached || beginSceneLayer(width, height);
+    if (!sceneCached) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+    frameTriangles = 0;
+
+    // Objects first: a software frame replaces the clear, and the grid is
+    // depth-tested against whatever the object pass left
+    beginProfileStage(STAGE_SHAPE);
+    if (drawObjects) {
+        beginCameraPass();
+        drawShapePass();
+    }
+    endProfileStage(STAGE_SHAPE);
+
+    beginProfileStage(STAGE_GRID);
+    if (drawObjects) {
+        // The view is cached; only what the shape pass changed is uploaded again
+        beginCameraPass();
+        if (corePipeline) {
+            drawCoreGrid();
+        }
+        else {
+            drawGrid();
+        }
+    }
+    if (sceneCached && drawObjects) {
+        sceneLayerTriangles = frameTriangles;
+        endLayer();
+    }
+    else if (sceneCached) {
+        frameTriangles = sceneLayerTriangles;
+    }
+    endProfileStage(STAGE_GRID);
 
-    // Add camera control button to buttons vector
-    buttons.push_back(Button(cameraButtonX, cameraButtonY, buttonWidth2, buttonHeight2, "Camera Control", cameraControlMode));
+    beginProfileStage(STAGE_BUTTONS);
+    renderHudText();
+    queueWidgetLabels();
+    if (!layered) {
+        drawButtons();
+    }
+    else {
+        if (beginHudLayer(width, height)) {
+            drawButtons();
+            flushText();
+            endLayer();
+        }
+        else {
+            discardText();
+        }
+        compositeLayers(width, height, sceneCached);
+    }
+    endProfileStage(STAGE_BUTTONS);
+
+    beginProfileStage(STAGE_TEXT);
+
+    char buffer[256];
+
+    // Position
+    snprintf(buffer, sizeof(buffer), "Position: (%.1f, %.1f, %.1f)", position[0], position[1], position[2]);
+    renderText(10, 670, buffer);
+
+    // Rotation
+    int length = snprintf(buffer, sizeof(buffer), "Rotation: (%.1f, %.1f, %.1f)", rotation[0], rotation[1], rotation[2]);
+    if (quaternionRotation) {
+        snprintf(buffer + length, sizeof(buffer) - length, "  quaternion, %d saved%s", savedOrientationCount,
+            orientationPlayback ? ", playing" : "");
+    }
+    renderText(10, 650, buffer);
+
+    // Scale
+    snprintf(buffer, sizeof(buffer), "Scale: (%.1f, %.1f, %.1f)", scale[0], scale[1], scale[2]);
+    renderText(10, 630, buffer);
+
+    // Shear
+    snprintf(buffer, sizeof(buffer), "Shear XY: %.1f  XZ: %.1f  YZ: %.1f", shear[0], shear[1], shear[2]);
+    renderText(10, 610, buffer);
+
+    // Reflection
+    snprintf(buffer, sizeof(buffer), "Reflection: X: %s  Y: %s  Z: %s",
+        reflection[0] ? "ON" : "OFF",
+        reflection[1] ? "ON" : "OFF",
+        reflection[2] ? "ON" : "OFF");
+    renderText(10, 590, buffer);
+
+    // Frame time
+    updateFrameTiming();
+    if (sceneMode) {
+        snprintf(buffer, sizeof(buffer), "Node %d / %zu  Frame: %.2f ms (%.0f fps)  World update: %.3f ms (%zu nodes)",
+            scene.selected, scene.nodes.size(), frameMs, frameMs > 0.0 ? 1000.0 / frameMs : 0.0,
+            sceneUpdateMs, sceneNodesUpdated);
+    }
+    else if (instanceMode) {
+        snprintf(buffer, sizeof(buffer), "Instances: %zu  Frame: %.2f ms (%.0f fps)  Compose: %.2f ms  %s",
+            instances.count, frameMs, frameMs > 0.0 ? 1000.0 / frameMs : 0.0, instanceComposeMs,
+            corePipeline ? "core" : hasInstancing ? "instanced" : "per-instance");
+    }
+    else {
+        snprintf(buffer, sizeof(buffer), "Frame: %.2f ms (%.0f fps)%s", frameMs, frameMs > 0.0 ? 1000.0 / frameMs : 0.0,
+            corePipeline ? "  GL 3.3 core" : "");
+    }
+    renderText(10, 530, buffer);
+
+    if ((sceneMode || instanceMode) && cullingEnabled) {
+        snprintf(buffer, sizeof(buffer), "Culling: drawn %zu  culled %zu  (cull+LOD %.3f ms, BVH %zu nodes)",
+            culling.drawn, culling.culled, culling.cullMs, culling.bvh.nodes.size());
+        renderText(10, 510, buffer);
+    }
+
+    // Level of detail
+    if (sceneMode || instanceMode) {
+        snprintf(buffer, sizeof(buffer), "Triangles: %zu  Curved LOD 0/1/2/3: %zu/%zu/%zu/%zu", frameTriangles,
+            culling.lodCount[0], culling.lodCount[1], culling.lodCount[2], culling.lodCount[3]);
+    }
+    else {
+        snprintf(buffer, sizeof(buffer), "Triangles: %zu  LOD: %d", frameTriangles,
+            shapeHasLod(currentShape) ? currentShapeLod : 0);
+    }
+    renderText(10, 490, buffer);
+
+    if (softwareRaster && !sceneMode && !instanceMode) {
+        snprintf(buffer, sizeof(buffer), "Software raster: %d threads, %.2f ms", poolWorkerCount(), raster.frameMs);
+        renderText(10, 470, buffer);
+    }
+
+    if (showProfiler) {
+        renderProfilerOverlay();
+    }
+    flushText();
+    endProfileStage(STAGE_TEXT);
+
+    endStreamFrame();
+    beginProfileStage(STAGE_SWAP);
+    if (headless) {
+        glFinish();  // Nothing to present; wait so frame times include the GPU work
+    }
+    else {
+        glutSwapBuffers();
+    }
+    endProfileStage(STAGE_SWAP);
+    recordInputLatency();
+    endProfileFrame();
+
+    if (!headless && !inputOnThread() && inputAnimating(inputState)) {
+        glutPostRedisplay();  // Keep integrating while a key is held or playback runs
+    }
+}
+
+void reshape(int w, int h) {
+    if (h == 0) h = 1;
+    glViewport(0, 0, w, h);
+    // The perspective projection is uploaded by the next beginCameraPass()
+    setCameraViewport(w, h);
+}
+
+// Input events as the GLUT callbacks saw them. Clicks carry y measured from
+// the bottom of the window, like the button rectangles; motion keeps GLUT's
+// top-down y.
+enum InputEventType {
+    INPUT_KEY,
+    INPUT_KEY_UP,
+    INPUT_MOUSE_BUTTON,
+    INPUT_MOUSE_MOTION
+};
+
+struct InputEvent {
+    InputEventType type;
+    unsigned char key;
+    int button, state;
+    int x, y;
+    std::chrono::steady_clock::time_point time;  // Arrival in the callback
+};
+
+void applyMouseMotion(FrameState& s, int x, int y) {
+    if (!s.mouseRightDown || !s.cameraControlMode) return;
+
+    if (s.firstMouse) {
+        s.lastX = x;
+        s.lastY = y;
+        s.firstMouse = false;
+        return;
+    }
+
+    // Calculate mouse movement since last frame
+    float xoffset = x - s.lastX;
+    float yoffset = s.lastY - y;  // Reversed since y-coordinates go from bottom to top
+    s.lastX = x;
+    s.lastY = y;
+
+    float sensitivity = 0.1f;
+    xoffset *= sensitivity;
+    yoffset *= sensitivity;
+
+    s.yaw += xoffset;
+    s.pitch += yoffset;
+
+    // Constrain pitch to avoid camera flipping
+    if (s.pitch > 89.0f)
+        s.pitch = 89.0f;
+    if (s.pitch < -89.0f)
+        s.pitch = -89.0f;
+
+    // Update camera front vector
+    float radYaw = s.yaw * M_PI / 180.0f;
+    float radPitch = s.pitch * M_PI / 180.0f;
+
+    s.cameraFront[0] = cos(radYaw) * cos(radPitch);
+    s.cameraFront[1] = sin(radPitch);
+    s.cameraFront[2] = sin(radYaw) * cos(radPitch);
+
+    // Normalize the front vector
+    float length = sqrt(s.cameraFront[0] * s.cameraFront[0] +
+        s.cameraFront[1] * s.cameraFront[1] +
+        s.cameraFront[2] * s.cameraFront[2]);
+    s.cameraFront[0] /= length;
+    s.cameraFront[1] /= length;
+    s.cameraFront[2] /= length;
+}
+
+// Widget rectangles and the hit-test grid are fixed after init(), so reading
+// them off the GLUT thread is safe; the highlight follows in applyFrameState()
+void applyMouseButton(FrameState& s, int button, int state, int x, int y) {
+    if (button == GLUT_RIGHT_BUTTON) {
+        s.mouseRightDown = (state == GLUT_DOWN);
+        if (state == GLUT_DOWN) {
+            s.firstMouse = true;
+        }
+    }
+    else if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN) {
+        int id = hitTestWidget((float)x, (float)y);
+        if (id < 0) return;
+        const Widget& widget = widgetRegistry.widgets[id];
+        switch (widget.action) {
+        case WIDGET_TOGGLE_CAMERA:
+            s.cameraControlMode = !s.cameraControlMode;
+            break;
+        case WIDGET_SELECT_SHAPE:
+            s.currentShape = (Shape)widget.value;
+            break;
+        case WIDGET_SELECT_MODE:
+            // Only allow transformation mode changes when not in camera control mode
+            if (!s.cameraControlMode) {
+                s.currentMode = (TransformationMode)widget.value;
+            }
+            break;
+        }
+    }
+}
+
+// Key presses. Motion keys (w/s/a/d/q/e) are only marked held here and
+// move the state through advanceInput(); everything else acts once.
+void applyKey(FrameState& s, unsigned char key) {
+    // Global controls that work in any mode
+    switch (key) {
+    case 'c':  // Toggle camera control mode
+        s.cameraControlMode = !s.cameraControlMode;
+        return;
+    case 'p':  // Toggle profiler overlay
+        s.showProfiler = !s.showProfiler;
+        return;
+    case 'f':  // Toggle frustum culling
+        s.cullingEnabled = !s.cullingEnabled;
+        return;
+    case '[':  // Select previous scene node
+    case ']':  // Select next scene node
+        if (sceneMode) {
+            // Scene mode always applies input inline (see startInputThread),
+            // so the nodes and the render-side globals can be touched here
+            selectSceneNode(scene.selected + (key == ']' ? 1 : -1));
+            updateTransformMatrix();
+            captureFrameState(s);
+        }
+        return;
+    case 'w': case 's': case 'a': case 'd': case 'q': case 'e':
+        s.keyDown[key] = true;
+        return;
+    case 'o':  // Toggle quaternion rotation
+        s.quaternionMode = !s.quaternionMode;
+        if (s.quaternionMode) {
+            quaternionFromEuler(s.rotation, s.orientation);
+        }
+        s.playTime = -1.0f;
+        s.transformDirty |= DIRTY_ROTATION;
+        return;
+    case 'k':  // Save the current orientation
+        if (s.quaternionMode && s.savedCount < maxSavedOrientations) {
+            memcpy(s.savedOrientations[s.savedCount++], s.orientation, sizeof(s.orientation));
+        }
+        return;
+    case 'l':  // Play back the saved orientations, or stop
+        if (s.playTime >= 0.0f) {
+            s.playTime = -1.0f;
+        }
+        else if (s.quaternionMode && s.savedCount >= 2) {
+            memcpy(s.orientation, s.savedOrientations[0], sizeof(s.orientation));
+            s.playTime = 0.0f;
+            s.transformDirty |= DIRTY_ROTATION;
+        }
+        return;
+    case 'j':  // Clear the saved orientations
+        s.savedCount = 0;
+        s.playTime = -1.0f;
+        return;
+    }
+
+    if (s.cameraControlMode) {
+        if (key == ' ') {  // Reset camera position
+            s.cameraPos[0] = 0.0f;
+            s.cameraPos[1] = 0.0f;
+            s.cameraPos[2] = 5.0f;
+            s.cameraFront[0] = 0.0f;
+            s.cameraFront[1] = 0.0f;
+            s.cameraFront[2] = -1.0f;
+        }
+    }
+    else if (key == ' ') {
+        // Reset the current transformation
+        switch (s.currentMode) {
+        case TRANSLATE:
+            s.position[0] = s.position[1] = s.position[2] = 0.0f;
+            s.transformDirty |= DIRTY_POSITION;
+            break;
+        case ROTATE:
+            s.rotation[0] = s.rotation[1] = s.rotation[2] = 0.0f;
+            quaternionFromEuler(s.rotation, s.orientation);
+            s.playTime = -1.0f;
+            s.transformDirty |= DIRTY_ROTATION;
+            break;
+        case SCALE:
+            s.scale[0] = s.scale[1] = s.scale[2] = 1.0f;
+            s.transformDirty |= DIRTY_SCALE;
+            break;
+        case SHEAR:
+            s.shear[0] = s.shear[1] = s.shear[2] = 0.0f;
+            s.transformDirty |= DIRTY_SHEAR;
+            break;
+        case REFLECT:
+            s.reflection[0] = s.reflection[1] = s.reflection[2] = false;
+            s.transformDirty |= DIRTY_REFLECTION;
+            break;
+        }
+    }
+    else if (s.currentMode == REFLECT) {
+        switch (key) {
+        case 'x': s.reflection[0] = !s.reflection[0]; break;
+        case 'y': s.reflection[1] = !s.reflection[1]; break;
+        case 'z': s.reflection[2] = !s.reflection[2]; break;
+        default: return;
+        }
+        s.transformDirty |= DIRTY_REFLECTION;
+    }
 }
 
+void applyInputEvent(FrameState& s, const InputEvent& event) {
+    // Motion from keys already held runs up to the moment of this event
+    advanceInput(s, event.time);
+    switch (event.type) {
+    case INPUT_KEY: applyKey(s, event.key); break;
+    case INPUT_KEY_UP: s.keyDown[event.key] = false; break;
+    case INPUT_MOUSE_BUTTON: applyMouseButton(s, event.button, event.state, event.x, event.y); break;
+    case INPUT_MOUSE_MOTION: applyMouseMotion(s, event.x, event.y); break;
+    }
+    s.changed = true;
+    s.inputSequence++;
+    s.inputTime = event.time;
+}
 
+void recordInputEvent(const InputEvent& event) {
+    RecordedEvent entry = { recordMicros(event.time), (unsigned char)event.type, event.key,
+        (unsigned char)event.button, (unsigned char)event.state, (short)event.x, (short)event.y };
+    fwrite(&recordEventTag, 1, 1, inputRecorder.file);
+    fwrite(&entry, sizeof(entry), 1, inputRecorder.file);
+    inputRecorder.events++;
+}
 
-void display() {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// Replay (--replay FILE). Frame n runs at virtual time (n + 1) * step: the
+// events recorded before it are applied at their own timestamps, then
+// display() steps input to that time. The result depends only on the
+// recording and the step, never on how fast frames render, so the final
+// state checksum is repeatable across runs and builds.
+struct InputReplay {
+    bool active = false;
+    bool fast = false;  // Windowed replays run in real time unless --replay-fast
+    float stepMs = 1000.0f / 60.0f;
+    std::vector<RecordedEvent> events;
+    RecordedState initial;
+    RecordedState recordedFinal;  // State of the last recorded frame
+    bool hasRecordedFinal = false;
+    unsigned long long durationMicros = 0;
+    size_t nextEvent = 0;
+    int frame = 0;
+    int frameCount = 0;
+    std::chrono::steady_clock::time_point base;
+    std::chrono::steady_clock::time_point wallStart;
+    std::vector<double> frameMs;  // Windowed replays only; headless times its own loop
+};
 
-    glLoadIdentity();
-    
-    //Setup of Camera Position Using LookAt Function
-    gluLookAt(cameraPos[0], cameraPos[1], cameraPos[2],
-        cameraPos[0] + cameraFront[0], cameraPos[1] + cameraFront[1], cameraPos[2] + cameraFront[2],
-        cameraUp[0], cameraUp[1], cameraUp[2]);
+InputReplay inputReplay;
+std::string replayPath;
 
-    drawGrid();
+bool loadInputReplay(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        std::cerr << "Cannot open input recording " << path << std::endl;
+        return false;
+    }
+    InputRecordHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, inputRecordMagic, sizeof(inputRecordMagic)) != 0 ||
+        header.version != inputRecordVersion || header.stateSize != sizeof(RecordedState)) {
+        std::cerr << path << " is not an input recording of this version" << std::endl;
+        fclose(file);
+        return false;
+    }
+    inputReplay.initial = header.initial;
+
+    unsigned char tag;
+    while (fread(&tag, 1, 1, file) == 1) {
+        if (tag == recordEventTag) {
+            RecordedEvent event;
+            if (fread(&event, sizeof(event), 1, file) != 1) break;
+            inputReplay.events.push_back(event);
+            inputReplay.durationMicros = std::max(inputReplay.durationMicros, event.micros);
+        }
+        else if (tag == recordFrameTag) {
+            RecordedFrame frame;
+            if (fread(&frame, sizeof(frame), 1, file) != 1) break;
+            inputReplay.recordedFinal = frame.state;
+            inputReplay.hasRecordedFinal = true;
+            inputReplay.durationMicros = std::max(inputReplay.durationMicros, frame.micros);
+        }
+        else {
+            std::cerr << path << ": corrupt entry, replaying what was read" << std::endl;
+            break;
+        }
+    }
+    fclose(file);
 
-    glLoadIdentity();
-    gluLookAt(cameraPos[0], cameraPos[1], cameraPos[2],
-        cameraPos[0] + cameraFront[0], cameraPos[1] + cameraFront[1], cameraPos[2] + cameraFront[2],
-        cameraUp[0], cameraUp[1], cameraUp[2]);
+    double stepMicros = inputReplay.stepMs * 1000.0;
+    inputReplay.frameCount = std::max(1, (int)ceil(inputReplay.durationMicros / stepMicros));
+    return true;
+}
 
-    applyTransformMatrix();
-    drawShape();
-    drawButtons();
+// Puts the recorded starting state in place; after init() and captureFrameState()
+bool startInputReplay() {
+    if (!loadInputReplay(replayPath.c_str())) return false;
+    inputReplay.active = true;
+    inputReplay.base = std::chrono::steady_clock::now();
+    inputReplay.wallStart = inputReplay.base;
+    replayClock = inputReplay.base;
+    replayClockActive = true;
+    startTime = inputReplay.base;
+
+    applyRecordedState(inputReplay.initial, inputState);
+    inputState.lastStep = inputReplay.base;
+    publishInputState(inputState);
+    printf("Replaying %s: %zu events over %.2f s in %d frames of %.3f ms\n", replayPath.c_str(),
+        inputReplay.events.size(), inputReplay.durationMicros / 1.0e6, inputReplay.frameCount, inputReplay.stepMs);
+    return true;
+}
 
+// Feeds the events up to the next frame's time; false once the replay is done
+bool advanceInputReplay() {
+    if (inputReplay.frame >= inputReplay.frameCount) return false;
+    inputReplay.frame++;
+    auto offset = std::chrono::microseconds((long long)(inputReplay.frame * (double)inputReplay.stepMs * 1000.0));
+    replayClock = inputReplay.base + offset;
+    while (inputReplay.nextEvent < inputReplay.events.size() &&
+        inputReplay.events[inputReplay.nextEvent].micros <= (unsigned long long)offset.count()) {
+        const RecordedEvent& recorded = inputReplay.events[inputReplay.nextEvent++];
+        InputEvent event = { (InputEventType)recorded.type, recorded.key, recorded.button, recorded.state,
+            recorded.x, recorded.y, inputReplay.base + std::chrono::microseconds(recorded.micros) };
+        applyInputEvent(inputState, event);
+    }
+    if (!inputReplay.fast && !headless) {
+        std::this_thread::sleep_until(inputReplay.wallStart + offset);
+    }
+    return true;
+}
 
-    char buffer[256];
+// Prints frame timing and the final state checksum
+void finishInputReplay(const std::vector<double>& frameMs) {
+    FrameState shown;
+    captureFrameState(shown);
+    RecordedState final;
+    captureRecordedState(shown, final);
+    if (!frameMs.empty()) {
+        std::vector<double> sorted = frameMs;
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.0;
+        for (double ms : frameMs) total += ms;
+        printf("Replay frames: %zu, avg %.3f ms, min %.3f ms, median %.3f ms, p99 %.3f ms, max %.3f ms\n",
+            sorted.size(), total / sorted.size(), sorted.front(), sorted[sorted.size() / 2],
+            sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)], sorted.back());
+    }
+    printf("Replay final state checksum: %016llx\n", hashRecordedState(final));
+    if (inputReplay.hasRecordedFinal) {
+        // The live session stepped at its own frame times, so expect float-level drift only
+        const RecordedState& recorded = inputReplay.recordedFinal;
+        float drift = 0.0f;
+        auto compare = [&](const float* a, const float* b, int count) {
+            for (int i = 0; i < count; i++) drift = std::max(drift, fabsf(a[i] - b[i]));
+        };
+        compare(final.position, recorded.position, 3);
+        compare(final.rotation, recorded.rotation, 3);
+        compare(final.scale, recorded.scale, 3);
+        compare(final.shear, recorded.shear, 3);
+        compare(final.cameraPos, recorded.cameraPos, 3);
+        compare(final.cameraFront, recorded.cameraFront, 3);
+        printf("Largest difference from the recorded final state: %g\n", drift);
+    }
+}
 
-    // Position
-    snprintf(buffer, sizeof(buffer), "Position: (%.1f, %.1f, %.1f)", position[0], position[1], position[2]);
-    renderText(10, 670, buffer);
+// Windowed replay drives frames from the idle callback
+void replayIdle() {
+    if (!advanceInputReplay()) {
+        finishInputReplay(inputReplay.frameMs);
+        closeProfiler();
+        exit(0);
+    }
+    auto start = std::chrono::steady_clock::now();
+    display();
+    inputReplay.frameMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+}
 
-    // Rotation
-    snprintf(buffer, sizeof(buffer), "Rotation: (%.1f, %.1f, %.1f)", rotation[0], rotation[1], rotation[2]);
-    renderText(10, 650, buffer);
+// Input thread (--input-thread). The GLUT callbacks only queue events; this
+// thread drains the queue in batches and steps the state once the renderer
+// has taken the previous one, so it still publishes at most once per frame.
+struct InputThread {
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::vector<InputEvent> queue;
+    bool running = false;
+    bool stopping = false;
+};
 
-    // Scale
-    snprintf(buffer, sizeof(buffer), "Scale: (%.1f, %.1f, %.1f)", scale[0], scale[1], scale[2]);
-    renderText(10, 630, buffer);
+InputThread inputThread;
 
-    // Shear
-    snprintf(buffer, sizeof(buffer), "Shear XY: %.1f  XZ: %.1f  YZ: %.1f", shear[0], shear[1], shear[2]);
-    renderText(10, 610, buffer);
+void inputThreadMain() {
+    std::vector<InputEvent> batch;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(inputThread.lock);
+            auto ready = [] { return inputThread.stopping || !inputThread.queue.empty(); };
+            if (inputState.changed || inputAnimating(inputState)) {
+                // Work is waiting on the renderer; poll for it taking the last state
+                inputThread.wake.wait_for(guard, std::chrono::milliseconds(1), ready);
+            }
+            else {
+                inputThread.wake.wait(guard, ready);
+            }
+            if (inputThread.stopping) return;
+            batch.swap(inputThread.queue);
+        }
+        for (const InputEvent& event : batch) {
+            applyInputEvent(inputState, event);
+        }
+        batch.clear();
+        if (!frameStates.pending()) {
+            stepInput(inputState);
+        }
+    }
+}
 
-    // Reflection
-    snprintf(buffer, sizeof(buffer), "Reflection: X: %s  Y: %s  Z: %s",
-        reflection[0] ? "ON" : "OFF",
-        reflection[1] ? "ON" : "OFF",
-        reflection[2] ? "ON" : "OFF");
-    renderText(10, 590, buffer);
+void stopInputThread() {
+    if (!inputThread.running) return;
+    {
+        std::lock_guard<std::mutex> guard(inputThread.lock);
+        inputThread.stopping = true;
+    }
+    inputThread.wake.notify_one();
+    inputThread.thread.join();
+    inputThread.running = false;
+}
 
-    // Camera Control 
-    snprintf(buffer, sizeof(buffer), "Camera Control: %s", cameraControlMode ? "ON" : "OFF");
-    renderText(10, 570, buffer);
+// GLUT cannot be called from the input thread, so the render thread polls
+// for published states and schedules its own redisplay
+void pollFrameStates(int) {
+    if (frameStates.pending()) {
+        glutPostRedisplay();
+    }
+    glutTimerFunc(1, pollFrameStates, 0);
+}
 
-    renderText(700, 10, "Love Dewangan 500109339");
+void startInputThread() {
+    if (sceneMode) {
+        // Node selection loads the node into the edit state, which needs the render thread
+        std::cerr << "--input-thread is not supported with --scene, applying input inline" << std::endl;
+        return;
+    }
+    inputThread.running = true;
+    inputThread.thread = std::thread(inputThreadMain);
+    atexit(stopInputThread);
+    glutTimerFunc(1, pollFrameStates, 0);
+}
 
-    
-    const char* modeText;
-    switch (currentMode) {
-    case TRANSLATE: modeText = "TRANSLATE"; break;
-    case ROTATE: modeText = "ROTATE"; break;
-    case SCALE: modeText = "SCALE"; break;
-    case SHEAR: modeText = "SHEAR"; break;
-    case REFLECT: modeText = "REFLECT"; break;
-    default: modeText = "UNKNOWN"; break;
+void postInput(const InputEvent& event) {
+    if (inputReplay.active) return;  // The recording is the only input source
+    if (inputRecorder.file) {
+        recordInputEvent(event);
+    }
+    if (inputThread.running) {
+        {
+            std::lock_guard<std::mutex> guard(inputThread.lock);
+            inputThread.queue.push_back(event);
+        }
+        inputThread.wake.notify_one();
+        return;
     }
+    applyInputEvent(inputState, event);
+    glutPostRedisplay();  // display() steps and publishes
+}
 
-    snprintf(buffer, sizeof(buffer), "Current Mode: %s", modeText);
-    renderText(10, 550, buffer);
+void mouseMotion(int x, int y) {
+    InputEvent event = { INPUT_MOUSE_MOTION, 0, 0, 0, x, y, std::chrono::steady_clock::now() };
+    postInput(event);
+}
 
-    
-    renderInstructions();
+void mouse(int button, int state, int x, int y) {
+    InputEvent event = { INPUT_MOUSE_BUTTON, 0, button, state, x, glutGet(GLUT_WINDOW_HEIGHT) - y,
+        std::chrono::steady_clock::now() };
+    postInput(event);
+}
 
-    glutSwapBuffers();
+void keyboard(unsigned char key, int x, int y) {
+    if (key == 27) {  // ESC key - exit program
+        closeProfiler();
+        reportInputLatency();
+        exit(0);
+    }
+    // Held-key tracking must see the same key on release whatever Shift did
+    InputEvent event = { INPUT_KEY, (unsigned char)tolower(key), 0, 0, x, y, std::chrono::steady_clock::now() };
+    postInput(event);
 }
 
-void reshape(int w, int h) {
-    if (h == 0) h = 1;
-    float ratio = (float)w / (float)h;
+void keyboardUp(unsigned char key, int x, int y) {
+    InputEvent event = { INPUT_KEY_UP, (unsigned char)tolower(key), 0, 0, x, y, std::chrono::steady_clock::now() };
+    postInput(event);
+}
 
-    glViewport(0, 0, w, h);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
 
-    //This set the window for Orthographic mode to perspective (Field of View angle, Aspect Ratio, Near Clipping Plane, Far Clipping Plane)
-    gluPerspective(45.0f, ratio, 0.1f, 100.0f);
+#ifdef HEADLESS_EGL
+// Creates a pbuffer-backed context, trying the default display first and
+// then Mesa's surfaceless platform for machines with no display server.
+bool createHeadlessContext(int width, int height) {
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        display = getPlatformDisplay ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL) : EGL_NO_DISPLAY;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+            std::cerr << "No EGL display available" << std::endl;
+            return false;
+        }
+    }
 
-    glMatrixMode(GL_MODELVIEW);
-}
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(display, configAttribs, &config, 1, &configCount) || configCount == 0) {
+        std::cerr << "No EGL config with an RGB8/depth24 pbuffer" << std::endl;
+        return false;
+    }
 
-void toggleCameraControl() {
-    cameraControlMode = !cameraControlMode;
-    // Update camera control button selection state
-    for (Button& btn : buttons) {
-        if (btn.label == "Camera Control") {
-            btn.selected = cameraControlMode;
-        }
+    eglBindAPI(EGL_OPENGL_API);
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+    const EGLint surfaceAttribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+    EGLSurface surface = eglCreatePbufferSurface(display, config, surfaceAttribs);
+    if (context == EGL_NO_CONTEXT || surface == EGL_NO_SURFACE || !eglMakeCurrent(display, surface, surface, context)) {
+        std::cerr << "Cannot create EGL context (error 0x" << std::hex << eglGetError() << std::dec << ")" << std::endl;
+        return false;
+    }
+    std::cout << "Headless EGL " << major << "." << minor << ": " << glGetString(GL_RENDERER) << std::endl;
+    return true;
+}
+#endif
+
+// Writes the current framebuffer as a binary PPM, top row first
+bool writeFramePPM(const char* path, int width, int height) {
+    std::vector<unsigned char> pixels(width * height * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for (int y = height - 1; y >= 0; y--) {
+        fwrite(&pixels[y * width * 3], 1, width * 3, file);
     }
+    fclose(file);
+    return true;
 }
 
+// Renders headlessFrames frames through display() and reports frame times.
+// Returns the process exit code.
+int runHeadless() {
+#ifdef HEADLESS_EGL
+    if (!createHeadlessContext(headlessWidth, headlessHeight)) return 1;
 
-float lastX = 400, lastY = 350;  // Last mouse position
-float yaw = -90.0f;   // Camera yaw angle (horizontal rotation)
-float pitch = 0.0f;   // Camera pitch angle (vertical rotation)
-bool firstMouse = true;  // Flag for first mouse movement
-bool mouseRightDown = false;  // Track right mouse button state
+    init();
+    reshape(headlessWidth, headlessHeight);
+    updateTransformMatrix();
+    captureFrameState(inputState);
+    if (!replayPath.empty()) {
+        if (!startInputReplay()) return 1;
+        inputReplay.fast = true;
+        headlessFrames = inputReplay.frameCount;
+    }
 
+    std::vector<double> frameTimes;
+    frameTimes.reserve(headlessFrames);
+    for (int frame = 0; frame < headlessFrames; frame++) {
+        if (inputReplay.active) {
+            advanceInputReplay();
+        }
+        auto start = std::chrono::steady_clock::now();
+        display();
+        frameTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+        if (!headlessOutput.empty()) {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s%04d.ppm", headlessOutput.c_str(), frame);
+            if (!writeFramePPM(path, headlessWidth, headlessHeight)) {
+                std::cerr << "Cannot write " << path << std::endl;
+                return 1;
+            }
+        }
+    }
+    closeProfiler();
+
+    std::vector<double> sorted = frameTimes;
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0.0;
+    for (double ms : frameTimes) total += ms;
+    printf("Rendered %d frames at %dx%d: avg %.3f ms, min %.3f ms, median %.3f ms, max %.3f ms\n",
+        headlessFrames, headlessWidth, headlessHeight, total / headlessFrames,
+        sorted.front(), sorted[sorted.size() / 2], sorted.back());
+    if (inputReplay.active) {
+        finishInputReplay(frameTimes);
+    }
+    return 0;
+#else
+    std::cerr << "--headless needs a build with -DHEADLESS_EGL (link with -lEGL)" << std::endl;
+    return 1;
+#endif
+}
 
-void mouseMotion(int x, int y) {
-    if (!mouseRightDown || !cameraControlMode) return;
+// Renders the current shape on the CPU at every thread count from 1 up to
+// the hardware thread count and prints frames/sec as JSON. Needs no GL
+// context. Returns the process exit code.
+int runRasterBenchmark() {
+    setCameraViewport(headlessWidth, headlessHeight);
+    updateTransformMatrix();
+    updateCurrentShapeLod();
+
+    int maxThreads = rasterThreads > 0 ? rasterThreads : std::max(1, (int)std::thread::hardware_concurrency());
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < maxThreads; threads *= 2) threadCounts.push_back(threads);
+    threadCounts.push_back(maxThreads);
+
+    double baseMs = 0.0;
+    printf("{\n  \"shape\": %d, \"width\": %d, \"height\": %d, \"frames\": %d,\n  \"results\": [\n",
+        (int)currentShape, headlessWidth, headlessHeight, rasterBenchFrames);
+    for (size_t i = 0; i < threadCounts.size(); i++) {
+        startThreadPool(threadCounts[i]);
+        rasterizeShape(headlessWidth, headlessHeight);  // Warm-up, sizes the buffers
+
+        auto start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < rasterBenchFrames; frame++) {
+            rasterizeShape(headlessWidth, headlessHeight);
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / rasterBenchFrames;
+        if (i == 0) baseMs = ms;
+        printf("    { \"threads\": %d, \"ms_per_frame\": %.3f, \"fps\": %.1f, \"speedup\": %.2f }%s\n",
+            threadCounts[i], ms, 1000.0 / ms, baseMs / ms, i + 1 < threadCounts.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
 
-    if (firstMouse) {
-        lastX = x;
-        lastY = y;
-        firstMouse = false;
-        return;
+    if (!headlessOutput.empty()) {
+        std::string path = headlessOutput + "raster.ppm";
+        if (!writeRasterPPM(path.c_str())) {
+            std::cerr << "Cannot write " << path << std::endl;
+            return 1;
+        }
     }
+    return 0;
+}
 
-    // Calculate mouse movement since last frame
-    float xoffset = x - lastX;
-    float yoffset = lastY - y;  // Reversed since y-coordinates go from bottom to top
-    lastX = x;
-    lastY = y;
+// Point cloud transform (--transform-points IN OUT). Streams float32 x, y, z
+// records through transformMatrix: either a raw packed file or the leading
+// vertex element of a binary little-endian PLY, whose header and any later
+// elements are copied unchanged. A reader thread fills chunks, the pool
+// transforms them with the SIMD kernel and a writer thread drains them, so
+// memory use is a few chunks however large the file is.
+std::string pointInputPath, pointOutputPath;
+const size_t pointChunkBytes = 16 << 20;
+const int pointChunkCount = 3;  // One each being read, transformed and written
+const size_t pointTaskRecords = 1 << 16;
+const size_t pointHeaderBytes = 1 << 16;
+
+struct PointChunk {
+    std::vector<char> data;
+    size_t bytes = 0;
+};
 
-    float sensitivity = 0.1f;
-    xoffset *= sensitivity;
-    yoffset *= sensitivity;
+// Hand-off between pipeline stages; NULL marks the end of the stream
+struct PointChunkQueue {
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<PointChunk*> chunks;
+};
 
-    yaw += xoffset;
-    pitch += yoffset;
+void pushPointChunk(PointChunkQueue& queue, PointChunk* chunk) {
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.chunks.push_back(chunk);
+    }
+    queue.ready.notify_one();
+}
 
-    // Constrain pitch to avoid camera flipping
-    if (pitch > 89.0f)
-        pitch = 89.0f;
-    if (pitch < -89.0f)
-        pitch = -89.0f;
+PointChunk* popPointChunk(PointChunkQueue& queue) {
+    std::unique_lock<std::mutex> guard(queue.lock);
+    queue.ready.wait(guard, [&]() { return !queue.chunks.empty(); });
+    PointChunk* chunk = queue.chunks.front();
+    queue.chunks.pop_front();
+    return chunk;
+}
 
-    // Update camera front vector
-    float radYaw = yaw * M_PI / 180.0f;
-    float radPitch = pitch * M_PI / 180.0f;
+struct PointLayout {
+    bool raw = true;             // Raw files are read to the end
+    unsigned long long count = 0;
+    size_t stride = 3 * sizeof(float);
+    size_t position = 0;
+    bool hasNormals = false;
+    size_t normal = 0;
+    std::string header;          // Copied verbatim ahead of the points
+};
 
-    cameraFront[0] = cos(radYaw) * cos(radPitch);
-    cameraFront[1] = sin(radPitch);
-    cameraFront[2] = sin(radYaw) * cos(radPitch);
+// Offset of three consecutive float32 properties, or false if they are
+// missing, of another type or not packed together
+bool findPlyFloat3(const PlyElement& element, const char* x, const char* y, const char* z, size_t& offset) {
+    const PlyProperty* properties[3] = { findPlyProperty(element, x), findPlyProperty(element, y), findPlyProperty(element, z) };
+    for (int k = 0; k < 3; k++) {
+        if (!properties[k] || properties[k]->type != PLY_FLOAT32) return false;
+        if (properties[k]->offset != properties[0]->offset + k * sizeof(float)) return false;
+    }
+    offset = properties[0]->offset;
+    return true;
+}
 
-    // Normalize the front vector
-    float length = sqrt(cameraFront[0] * cameraFront[0] +
-        cameraFront[1] * cameraFront[1] +
-        cameraFront[2] * cameraFront[2]);
-    cameraFront[0] /= length;
-    cameraFront[1] /= length;
-    cameraFront[2] /= length;
+// Leaves in positioned at the first point record
+bool readPointLayout(FILE* in, PointLayout& layout, const char* path) {
+    std::vector<char> buffer(pointHeaderBytes);
+    size_t length = fread(buffer.data(), 1, buffer.size(), in);
+    if (length < 4 || memcmp(buffer.data(), "ply", 3) != 0 || (buffer[3] != '\n' && buffer[3] != '\r')) {
+        rewind(in);
+        return true;
+    }
 
-    glutPostRedisplay();
+    MappedFile file;
+    file.data = buffer.data();
+    file.size = length;
+    std::vector<PlyElement> elements;
+    bool bigEndian = false;
+    const char* body = NULL;
+    if (!parsePlyHeader(file, elements, bigEndian, body, path)) return false;
+    if (bigEndian) {
+        std::cerr << path << ": only binary_little_endian PLY point files are supported" << std::endl;
+        return false;
+    }
+    if (elements.empty() || elements[0].name != "vertex" || elements[0].hasList ||
+        !findPlyFloat3(elements[0], "x", "y", "z", layout.position)) {
+        std::cerr << path << ": PLY points need a leading vertex element with packed float x, y and z" << std::endl;
+        return false;
+    }
+    layout.raw = false;
+    layout.count = elements[0].count;
+    layout.stride = elements[0].stride;
+    layout.hasNormals = findPlyFloat3(elements[0], "nx", "ny", "nz", layout.normal);
+    layout.header.assign(file.data, body);
+    return fseek(in, (long)layout.header.size(), SEEK_SET) == 0;
 }
 
-
-void mouse(int button, int state, int x, int y) {
-    if (button == GLUT_RIGHT_BUTTON) {
-        mouseRightDown = (state == GLUT_DOWN);
-        if (state == GLUT_DOWN) {
-            firstMouse = true;
+void normalizePointNormals(char* normals, size_t stride, size_t count) {
+    for (size_t n = 0; n < count; n++, normals += stride) {
+        float v[3];
+        memcpy(v, normals, sizeof(v));
+        float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        if (length > 0.0f) {
+            for (int k = 0; k < 3; k++) v[k] /= length;
         }
+        memcpy(normals, v, sizeof(v));
     }
-    else if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN) {
-        y = glutGet(GLUT_WINDOW_HEIGHT) - y;
+}
 
-        for (Button& btn : buttons) {
-            if (x >= btn.x && x <= btn.x + btn.width &&
-                y >= btn.y && y <= btn.y + btn.height) {
+// Returns the process exit code
+int runPointTransform() {
+    const char* inPath = pointInputPath.c_str();
+    const char* outPath = pointOutputPath.c_str();
+    FILE* in = fopen(inPath, "rb");
+    if (!in) {
+        std::cerr << "Cannot open " << inPath << std::endl;
+        return 1;
+    }
+    PointLayout layout;
+    if (!readPointLayout(in, layout, inPath)) {
+        fclose(in);
+        return 1;
+    }
+    FILE* out = fopen(outPath, "wb");
+    if (!out) {
+        std::cerr << "Cannot create " << outPath << std::endl;
+        fclose(in);
+        return 1;
+    }
 
-                if (btn.label == "Camera Control") {
-                    toggleCameraControl();
-                }
-                else if (btn.isShapeButton) {
-                    // Update all shape buttons
-                    for (Button& shapeBtn : buttons) {
-                        if (shapeBtn.isShapeButton) {
-                            shapeBtn.selected = (shapeBtn.shape == btn.shape);
-                        }
-                    }
-                    currentShape = btn.shape;
-                }
-                else {
-                    // Only allow transformation mode changes when not in camera control mode
-                    if (!cameraControlMode) {
-                        // Update all transform buttons
-                        for (Button& transformBtn : buttons) {
-                            if (!transformBtn.isShapeButton) {
-                                transformBtn.selected = (transformBtn.mode == btn.mode);
-                            }
-                        }
-                        currentMode = btn.mode;
-                    }
-                }
-                glutPostRedisplay();
-                break;
+    updateTransformMatrix();
+    // Normals take the inverse transpose so shear and non-uniform scale keep
+    // them perpendicular; the translation column comes out zero
+    float inverse[4][4], normalMatrix[4][4];
+    matrixKernels->affineInverse(transformMatrix, inverse);
+    matrixKernels->transpose(inverse, normalMatrix);
+    startThreadPool(rasterThreads > 0 ? rasterThreads : std::max(1, (int)std::thread::hardware_concurrency()));
+
+    auto start = std::chrono::steady_clock::now();
+    bool writeFailed = fwrite(layout.header.data(), 1, layout.header.size(), out) != layout.header.size();
+    size_t stride = layout.stride;
+    std::vector<PointChunk> chunks(pointChunkCount);
+    PointChunkQueue freeChunks, readChunks, doneChunks;
+    for (PointChunk& chunk : chunks) {
+        chunk.data.resize(std::max((size_t)1, pointChunkBytes / stride) * stride);
+        pushPointChunk(freeChunks, &chunk);
+    }
+
+    bool truncated = false;
+    std::thread reader([&]() {
+        unsigned long long remaining = layout.raw ? ~0ULL : layout.count * stride;
+        while (remaining > 0) {
+            PointChunk* chunk = popPointChunk(freeChunks);
+            size_t wanted = (size_t)std::min((unsigned long long)chunk->data.size(), remaining);
+            chunk->bytes = fread(chunk->data.data(), 1, wanted, in);
+            remaining -= chunk->bytes;
+            if (chunk->bytes < wanted) {
+                truncated = !layout.raw || chunk->bytes % stride != 0;
+                remaining = 0;
             }
+            pushPointChunk(readChunks, chunk);
         }
+        pushPointChunk(readChunks, NULL);
+    });
+    std::thread writer([&]() {
+        while (PointChunk* chunk = popPointChunk(doneChunks)) {
+            if (!writeFailed && fwrite(chunk->data.data(), 1, chunk->bytes, out) != chunk->bytes) writeFailed = true;
+            pushPointChunk(freeChunks, chunk);
+        }
+    });
+
+    unsigned long long points = 0, pointBytes = 0;
+    while (PointChunk* chunk = popPointChunk(readChunks)) {
+        size_t records = chunk->bytes / stride;
+        int taskCount = (int)((records + pointTaskRecords - 1) / pointTaskRecords);
+        parallelFor(taskCount, [&](int task, int) {
+            size_t first = task * pointTaskRecords;
+            size_t count = std::min(records, first + pointTaskRecords) - first;
+            char* record = chunk->data.data() + first * stride;
+            matrixKernels->transformPoints(transformMatrix, record + layout.position, stride, count);
+            if (layout.hasNormals) {
+                matrixKernels->transformPoints(normalMatrix, record + layout.normal, stride, count);
+                normalizePointNormals(record + layout.normal, stride, count);
+            }
+        });
+        points += records;
+        pointBytes += chunk->bytes;
+        pushPointChunk(doneChunks, chunk);
     }
-}
-
-
-void keyboard(unsigned char key, int x, int y) {
-    float moveSpeed = 0.1f;
-    float rotateSpeed = 5.0f;
-    float scaleSpeed = 0.1f;
-    float shearSpeed = 0.1f;
+    pushPointChunk(doneChunks, NULL);
+    reader.join();
+    writer.join();
+
+    // Faces and any other elements after the vertices pass through untouched
+    std::vector<char>& buffer = chunks[0].data;
+    for (size_t length; !layout.raw && (length = fread(buffer.data(), 1, buffer.size(), in)) > 0;) {
+        if (fwrite(buffer.data(), 1, length, out) != length) writeFailed = true;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fclose(in);
+    if (fclose(out) != 0) writeFailed = true;
 
-    // Global controls that work in any mode
-    switch (key) {
-    case 'c':  // Toggle camera control mode
-        toggleCameraControl();
-        glutPostRedisplay();
-        return;
-    case 27:  // ESC key - exit program
-        exit(0);
-        return;
+    if (truncated) {
+        std::cerr << inPath << (layout.raw ? ": size is not a whole number of x, y, z records" : ": PLY vertex data is truncated") << std::endl;
+        return 1;
     }
+    if (writeFailed) {
+        std::cerr << "Cannot write " << outPath << std::endl;
+        return 1;
+    }
+    printf("Transformed %llu points (%.1f MB%s) in %.3f s: %.2f GB/s, %s kernels, %d threads, peak RSS %.1f MB\n",
+        points, pointBytes / (1024.0 * 1024.0), layout.hasNormals ? ", with normals" : "", seconds,
+        pointBytes / seconds / 1e9, matrixKernels->name, poolWorkerCount(), peakResidentMB());
+    return 0;
+}
 
-    if (cameraControlMode) {
-        // Camera controls
-        switch (key) {
-        case 'w':  // Move forward
-            cameraPos[0] += cameraFront[0] * cameraSpeed;
-            cameraPos[1] += cameraFront[1] * cameraSpeed;
-            cameraPos[2] += cameraFront[2] * cameraSpeed;
-            break;
-        case 's':  // Move backward
-            cameraPos[0] -= cameraFront[0] * cameraSpeed;
-            cameraPos[1] -= cameraFront[1] * cameraSpeed;
-            cameraPos[2] -= cameraFront[2] * cameraSpeed;
-            break;
-        case 'a':  // Strafe left
-        {
-            float right[] = {
-                cameraFront[1] * cameraUp[2] - cameraFront[2] * cameraUp[1],
-                cameraFront[2] * cameraUp[0] - cameraFront[0] * cameraUp[2],
-                cameraFront[0] * cameraUp[1] - cameraFront[1] * cameraUp[0]
-            };
-            float length = sqrt(right[0] * right[0] + right[1] * right[1] + right[2] * right[2]);
-            right[0] /= length;
-            right[1] /= length;
-            right[2] /= length;
-            cameraPos[0] -= right[0] * cameraSpeed;
-            cameraPos[1] -= right[1] * cameraSpeed;
-            cameraPos[2] -= right[2] * cameraSpeed;
+// Parses counts such as 10000, 10k or 1M
+size_t parseCount(const char* text) {
+    char* end = NULL;
+    double value = strtod(text, &end);
+    if (end && (*end == 'k' || *end == 'K')) value *= 1000.0;
+    if (end && (*end == 'm' || *end == 'M')) value *= 1000000.0;
+    return value > 0.0 ? (size_t)value : 0;
+}
+
+void parseCommandLine(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--instances" && i + 1 < argc) {
+            spawnInstances(parseCount(argv[++i]));
+            instanceMode = instances.count > 0;
         }
-        break;
-        case 'd':  // Strafe right
-        {
-            float right[] = {
-                cameraFront[1] * cameraUp[2] - cameraFront[2] * cameraUp[1],
-                cameraFront[2] * cameraUp[0] - cameraFront[0] * cameraUp[2],
-                cameraFront[0] * cameraUp[1] - cameraFront[1] * cameraUp[0]
-            };
-            float length = sqrt(right[0] * right[0] + right[1] * right[1] + right[2] * right[2]);
-            right[0] /= length;
-            right[1] /= length;
-            right[2] /= length;
-            cameraPos[0] += right[0] * cameraSpeed;
-            cameraPos[1] += right[1] * cameraSpeed;
-            cameraPos[2] += right[2] * cameraSpeed;
+        else if (arg == "--scene" && i + 1 < argc) {
+            buildDemoScene(parseCount(argv[++i]));
         }
-        break;
-        case 'q':  // Move up
-            cameraPos[1] += cameraSpeed;
-            break;
-        case 'e':  // Move down
-            cameraPos[1] -= cameraSpeed;
-            break;
-        case ' ':  // Reset camera position
-            cameraPos[0] = 0.0f;
-            cameraPos[1] = 0.0f;
-            cameraPos[2] = 5.0f;
-            cameraFront[0] = 0.0f;
-            cameraFront[1] = 0.0f;
-            cameraFront[2] = -1.0f;
-            break;
+        else if (arg == "--profile-csv" && i + 1 < argc) {
+            profileCsvPath = argv[++i];
         }
-    }
-    else {
-        // Object transformation controls
-        switch (currentMode) {
-        case TRANSLATE:
-            switch (key) {
-            case 'w': position[1] += moveSpeed; break;
-            case 's': position[1] -= moveSpeed; break;
-            case 'a': position[0] -= moveSpeed; break;
-            case 'd': position[0] += moveSpeed; break;
-            case 'q': position[2] -= moveSpeed; break;
-            case 'e': position[2] += moveSpeed; break;
-            case ' ': position[0] = position[1] = position[2] = 0.0f; break;
+        else if (arg == "--headless") {
+            headless = true;
+        }
+        else if (arg == "--software") {
+            softwareRaster = true;
+        }
+        else if (arg == "--quaternion") {
+            quaternionRotation = true;
+        }
+        else if (arg == "--input-thread") {
+            useInputThread = true;
+        }
+        else if (arg == "--no-layers") {
+            layersEnabled = false;
+        }
+        else if (arg == "--stream" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "persistent") stream.mode = STREAM_PERSISTENT;
+            else if (mode == "orphan") stream.mode = STREAM_ORPHAN;
+            else if (mode == "client") stream.mode = STREAM_CLIENT;
+            else std::cerr << "Bad --stream " << mode << ", expected persistent, orphan or client" << std::endl;
+        }
+        else if (arg == "--core") {
+            corePipeline = true;
+        }
+        else if (arg == "--mesh" && i + 1 < argc) {
+            meshPath = argv[++i];
+        }
+        else if (arg == "--no-mesh-cache") {
+            meshCacheEnabled = false;
+        }
+        else if (arg == "--record" && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+        else if (arg == "--replay-step" && i + 1 < argc) {
+            inputReplay.stepMs = std::max(0.1f, (float)atof(argv[++i]));
+        }
+        else if (arg == "--replay-fast") {
+            inputReplay.fast = true;
+        }
+        else if (arg == "--transform-points" && i + 2 < argc) {
+            pointInputPath = argv[++i];
+            pointOutputPath = argv[++i];
+        }
+        else if (arg == "--reflect" && i + 1 < argc) {
+            const char* axes = argv[++i];
+            for (int k = 0; k < 3; k++) {
+                reflection[k] = strchr(axes, "xyz"[k]) != NULL;
             }
-            break;
-
-        case ROTATE:
-            switch (key) {
-            case 'w': rotation[0] += rotateSpeed; break;
-            case 's': rotation[0] -= rotateSpeed; break;
-            case 'a': rotation[1] -= rotateSpeed; break;
-            case 'd': rotation[1] += rotateSpeed; break;
-            case 'q': rotation[2] -= rotateSpeed; break;
-            case 'e': rotation[2] += rotateSpeed; break;
-            case ' ': rotation[0] = rotation[1] = rotation[2] = 0.0f; break;
+            markTransformDirty(DIRTY_REFLECTION);
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            rasterThreads = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--raster-bench") {
+            rasterBenchFrames = 100;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) {
+                rasterBenchFrames = std::max(1, atoi(argv[++i]));
             }
-            break;
-
-        case SCALE:
-            switch (key) {
-            case 'w': scale[1] += scaleSpeed; break;
-            case 's': scale[1] = std::max(0.1f, scale[1] - scaleSpeed); break;
-            case 'a': scale[0] = std::max(0.1f, scale[0] - scaleSpeed); break;
-            case 'd': scale[0] += scaleSpeed; break;
-            case 'q': scale[2] = std::max(0.1f, scale[2] - scaleSpeed); break;
-            case 'e': scale[2] += scaleSpeed; break;
-            case ' ': scale[0] = scale[1] = scale[2] = 1.0f; break;
+        }
+        else if (arg == "--frames" && i + 1 < argc) {
+            headlessFrames = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--size" && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &headlessWidth, &headlessHeight) != 2 || headlessWidth <= 0 || headlessHeight <= 0) {
+                std::cerr << "Bad --size " << argv[i] << ", expected WxH" << std::endl;
+                headlessWidth = 1280;
+                headlessHeight = 720;
             }
-            break;
-
-        case SHEAR:
-            switch (key) {
-            case 'w': shear[0] += shearSpeed; break;
-            case 's': shear[0] -= shearSpeed; break;
-            case 'a': shear[1] += shearSpeed; break;
-            case 'd': shear[1] -= shearSpeed; break;
-            case 'q': shear[2] += shearSpeed; break;
-            case 'e': shear[2] -= shearSpeed; break;
-            case ' ': shear[0] = shear[1] = shear[2] = 0.0f; break;
+        }
+        else if (arg == "--out" && i + 1 < argc) {
+            headlessOutput = argv[++i];
+        }
+        else if (arg == "--shape" && i + 1 < argc) {
+            const char* names[] = { "cube", "sphere", "pyramid", "cylinder", "mesh" };
+            std::string name = argv[++i];
+            for (int shape = 0; shape < shapeTypeCount; shape++) {
+                if (name == names[shape]) currentShape = (Shape)shape;
             }
-            break;
-
-        case REFLECT:
-            switch (key) {
-            case 'x': reflection[0] = !reflection[0]; break;
-            case 'y': reflection[1] = !reflection[1]; break;
-            case 'z': reflection[2] = !reflection[2]; break;
-            case ' ': reflection[0] = reflection[1] = reflection[2] = false; break;
+        }
+        else if ((arg == "--position" || arg == "--rotation" || arg == "--scale" || arg == "--shear") && i + 1 < argc) {
+            float* target = arg == "--position" ? position : arg == "--rotation" ? rotation : arg == "--scale" ? scale : shear;
+            float value[3];
+            if (sscanf(argv[++i], "%f,%f,%f", &value[0], &value[1], &value[2]) == 3) {
+                target[0] = value[0];
+                target[1] = value[1];
+                target[2] = value[2];
+                markTransformDirty(DIRTY_ALL);
             }
-            break;
+            else {
+                std::cerr << "Bad " << arg << " " << argv[i] << ", expected x,y,z" << std::endl;
+            }
+        }
+        else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            std::cerr << "Usage: " << argv[0] << " [--instances N] [--scene N] [--profile-csv FILE]   (N may use k/M suffix, e.g. 100k)" << std::endl;
+            std::cerr << "       [--headless] [--frames N] [--size WxH] [--out PREFIX] [--shape cube|sphere|pyramid|cylinder|mesh]" << std::endl;
+            std::cerr << "       [--position x,y,z] [--rotation x,y,z] [--scale x,y,z] [--shear x,y,z] [--reflect xyz]" << std::endl;
+            std::cerr << "       [--software] [--threads N] [--raster-bench [FRAMES]] [--core] [--input-thread] [--quaternion] [--no-layers]" << std::endl;
+            std::cerr << "       [--stream persistent|orphan|client]" << std::endl;
+            std::cerr << "       [--mesh FILE.obj|FILE.ply] [--no-mesh-cache]" << std::endl;
+            std::cerr << "       [--record FILE] [--replay FILE] [--replay-step MS] [--replay-fast]" << std::endl;
+            std::cerr << "       [--transform-points IN OUT]   (raw float32 x,y,z or binary PLY)" << std::endl;
         }
     }
+    if (!meshPath.empty()) {
+        loadImportedMesh(meshPath.c_str());
+    }
+    if (currentShape == IMPORTED && !shapeMeshes[IMPORTED][0].built) {
+        currentShape = CUBE;
+    }
+}
 
-    
-    updateTransformMatrix();
+void idle() {
     glutPostRedisplay();
 }
 
-
 int main(int argc, char** argv) {
+    selectMatrixKernels();
+
+    // --raster-bench and --transform-points run and exit without opening a window.
+    // The math and tessellation microbenchmarks are the separate Benchmarks program.
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--raster-bench") == 0) {
+            parseCommandLine(argc, argv);
+            return runRasterBenchmark();
+        }
+        if (strcmp(argv[i], "--transform-points") == 0) {
+            if (i + 2 >= argc) {
+                std::cerr << "Usage: " << argv[0] << " --transform-points IN OUT   (raw float32 x,y,z or binary PLY)" << std::endl;
+                return 1;
+            }
+            parseCommandLine(argc, argv);
+            return runPointTransform();
+        }
+    }
+
+    std::cout << "Matrix kernels: " << matrixKernels->name << std::endl;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            parseCommandLine(argc, argv);
+            return runHeadless();
+        }
+    }
+
     glutInit(&argc, argv);
+    parseCommandLine(argc, argv);
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
 
     
@@ -1058,12 +6294,32 @@ int main(int argc, char** argv) {
     glutFullScreen();
 
     init();
+    updateTransformMatrix();
+    captureFrameState(inputState);
+    if (!replayPath.empty()) {
+        if (!startInputReplay()) return 1;
+        useInputThread = false;  // Replay applies input inline on the virtual clock
+    }
+    else if (!recordPath.empty()) {
+        openInputRecording(inputState);
+    }
+    if (useInputThread) {
+        startInputThread();
+    }
 
     glutDisplayFunc(display);
     glutReshapeFunc(reshape);
     glutKeyboardFunc(keyboard);
+    glutKeyboardUpFunc(keyboardUp);
+    glutIgnoreKeyRepeat(1);  // Held keys are tracked through key-up events
     glutMouseFunc(mouse);
     glutMotionFunc(mouseMotion);
+    if (inputReplay.active) {
+        glutIdleFunc(replayIdle);
+    }
+    else if (instanceMode) {
+        glutIdleFunc(idle);  // Animate continuously so frame time is meaningful
+    }
 
     glutMainLoop();
     return 0;
@@ -0,0 +1,32 @@
+#include "AllocationCounter.h"
+
+#include <stdlib.h>
+#include <new>
+
+#ifdef _MSC_VER
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE __attribute__((noinline))
+#endif
+
+#ifdef COUNT_ALLOCATIONS
+std::atomic<size_t> allocationCount(0);
+std::atomic<size_t> allocationBytes(0);
+
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+// Out of line so GCC doesn't pair the inlined free() with a new-expression
+NOINLINE void operator delete(void* p) noexcept {
+    free(p);
+}
+
+NOINLINE void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+#endif
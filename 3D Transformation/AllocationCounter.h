@@ -0,0 +1,34 @@
+#pragma once
+
+// Heap allocation counter. Builds that define COUNT_ALLOCATIONS and link
+// AllocationCounter.cpp replace the global operator new, so every
+// allocation in the process is counted: the Benchmarks program always does,
+// for allocations per op, and the viewer's Debug configurations do, for the
+// allocations per frame in the profiler. Other builds keep the default
+// allocator and count nothing.
+#include <atomic>
+#include <stddef.h>
+
+#ifdef COUNT_ALLOCATIONS
+extern std::atomic<size_t> allocationCount;
+extern std::atomic<size_t> allocationBytes;
+const bool countingAllocations = true;
+#else
+const bool countingAllocations = false;
+#endif
+
+inline size_t heapAllocationCount() {
+#ifdef COUNT_ALLOCATIONS
+    return allocationCount.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+inline size_t heapAllocationBytes() {
+#ifdef COUNT_ALLOCATIONS
+    return allocationBytes.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,864 @@
+#include "Geometry.h"
+
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+
+float transformMatrix[4][4] = {
+    {1, 0, 0, 0},
+    {0, 1, 0, 0},
+    {0, 0, 1, 0},
+    {0, 0, 0, 1}
+};
+
+float position[3] = { 0.0f, 0.0f, 0.0f };
+float rotation[3] = { 0.0f, 0.0f, 0.0f };
+float scale[3] = { 1.0f, 1.0f, 1.0f };
+float shear[3] = { 0.0f, 0.0f, 0.0f };
+bool reflection[3] = { false, false, false };
+
+
+void matrixIdentity(float matrix[4][4]) {
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            matrix[i][j] = (i == j) ? 1.0f : 0.0f;
+        }
+    }
+
+}
+
+
+void scalarMultiply(const float a[4][4], const float b[4][4], float result[4][4]) {
+    float temp[4][4];
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            temp[i][j] = 0;
+            for (int k = 0; k < 4; k++) {
+                temp[i][j] += a[i][k] * b[k][j];
+            }
+        }
+    }
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            result[i][j] = temp[i][j];
+        }
+    }
+}
+
+void scalarTranspose(const float a[4][4], float result[4][4]) {
+    float temp[4][4];
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            temp[i][j] = a[j][i];
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            result[i][j] = temp[i][j];
+        }
+    }
+}
+
+void scalarTransformPoint(const float a[4][4], const float p[3], float result[3]) {
+    float x = p[0], y = p[1], z = p[2];
+    for (int i = 0; i < 3; i++) {
+        result[i] = a[i][0] * x + a[i][1] * y + a[i][2] * z + a[i][3];
+    }
+}
+
+// Inverse of [L t; 0 1] for any invertible L (shear and reflection included)
+void scalarAffineInverse(const float a[4][4], float result[4][4]) {
+    float c[3][3];
+    c[0][0] = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+    c[0][1] = a[0][2] * a[2][1] - a[0][1] * a[2][2];
+    c[0][2] = a[0][1] * a[1][2] - a[0][2] * a[1][1];
+    c[1][0] = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+    c[1][1] = a[0][0] * a[2][2] - a[0][2] * a[2][0];
+    c[1][2] = a[0][2] * a[1][0] - a[0][0] * a[1][2];
+    c[2][0] = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+    c[2][1] = a[0][1] * a[2][0] - a[0][0] * a[2][1];
+    c[2][2] = a[0][0] * a[1][1] - a[0][1] * a[1][0];
+
+    float det = a[0][0] * c[0][0] + a[0][1] * c[1][0] + a[0][2] * c[2][0];
+    float invDet = 1.0f / det;
+    float t[3] = { a[0][3], a[1][3], a[2][3] };
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            result[i][j] = c[i][j] * invDet;
+        }
+        result[i][3] = -(result[i][0] * t[0] + result[i][1] * t[1] + result[i][2] * t[2]);
+    }
+    result[3][0] = result[3][1] = result[3][2] = 0.0f;
+    result[3][3] = 1.0f;
+}
+
+void scalarMultiplyMany(const Mat4* a, const Mat4* b, Mat4* result, size_t count) {
+    for (size_t n = 0; n < count; n++) {
+        scalarMultiply(a[n].m, b[n].m, result[n].m);
+    }
+}
+
+void scalarTransformPoints(const float a[4][4], char* points, size_t stride, size_t count) {
+    for (size_t n = 0; n < count; n++, points += stride) {
+        float p[3], result[3];
+        memcpy(p, points, sizeof(p));  // Records need not be aligned
+        scalarTransformPoint(a, p, result);
+        memcpy(points, result, sizeof(result));
+    }
+}
+
+
+#ifdef MATRIX_SIMD_X86
+
+void sseMultiply(const float a[4][4], const float b[4][4], float result[4][4]) {
+    __m128 b0 = _mm_loadu_ps(b[0]);
+    __m128 b1 = _mm_loadu_ps(b[1]);
+    __m128 b2 = _mm_loadu_ps(b[2]);
+    __m128 b3 = _mm_loadu_ps(b[3]);
+    __m128 rows[4];
+    for (int i = 0; i < 4; i++) {
+        __m128 r = _mm_mul_ps(_mm_set1_ps(a[i][0]), b0);
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i][1]), b1));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i][2]), b2));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i][3]), b3));
+        rows[i] = r;
+    }
+    for (int i = 0; i < 4; i++) {
+        _mm_storeu_ps(result[i], rows[i]);
+    }
+}
+
+void sseTranspose(const float a[4][4], float result[4][4]) {
+    __m128 r0 = _mm_loadu_ps(a[0]);
+    __m128 r1 = _mm_loadu_ps(a[1]);
+    __m128 r2 = _mm_loadu_ps(a[2]);
+    __m128 r3 = _mm_loadu_ps(a[3]);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(result[0], r0);
+    _mm_storeu_ps(result[1], r1);
+    _mm_storeu_ps(result[2], r2);
+    _mm_storeu_ps(result[3], r3);
+}
+
+void sseTransformPoint(const float a[4][4], const float p[3], float result[3]) {
+    __m128 v = _mm_set_ps(1.0f, p[2], p[1], p[0]);
+    __m128 r0 = _mm_mul_ps(_mm_loadu_ps(a[0]), v);
+    __m128 r1 = _mm_mul_ps(_mm_loadu_ps(a[1]), v);
+    __m128 r2 = _mm_mul_ps(_mm_loadu_ps(a[2]), v);
+    __m128 r3 = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    __m128 sum = _mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3));
+    float out[4];
+    _mm_storeu_ps(out, sum);
+    result[0] = out[0];
+    result[1] = out[1];
+    result[2] = out[2];
+}
+
+static inline __m128 sseCross(__m128 a, __m128 b) {
+    __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// Columns of L^-1 are the cross products of L's rows over det(L)
+void sseAffineInverse(const float a[4][4], float result[4][4]) {
+    __m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    __m128 r0 = _mm_and_ps(_mm_loadu_ps(a[0]), mask);
+    __m128 r1 = _mm_and_ps(_mm_loadu_ps(a[1]), mask);
+    __m128 r2 = _mm_and_ps(_mm_loadu_ps(a[2]), mask);
+    __m128 t = _mm_set_ps(0.0f, a[2][3], a[1][3], a[0][3]);
+
+    __m128 c0 = sseCross(r1, r2);
+    __m128 c1 = sseCross(r2, r0);
+    __m128 c2 = sseCross(r0, r1);
+
+    __m128 d = _mm_mul_ps(r0, c0);
+    __m128 det = _mm_add_ps(_mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 1, 1, 1))),
+        _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 2, 2, 2)));
+    __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), _mm_shuffle_ps(det, det, 0));
+    c0 = _mm_mul_ps(c0, invDet);
+    c1 = _mm_mul_ps(c1, invDet);
+    c2 = _mm_mul_ps(c2, invDet);
+
+    // -L^-1 * t = -(c0 * t.x + c1 * t.y + c2 * t.z) as a column
+    __m128 negT = _mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(c0, _mm_shuffle_ps(t, t, _MM_SHUFFLE(0, 0, 0, 0))),
+        _mm_mul_ps(c1, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 1, 1, 1)))),
+        _mm_mul_ps(c2, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 2, 2, 2))));
+    negT = _mm_sub_ps(_mm_setzero_ps(), negT);
+    __m128 c3 = _mm_or_ps(_mm_and_ps(negT, mask), _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    _mm_storeu_ps(result[0], c0);
+    _mm_storeu_ps(result[1], c1);
+    _mm_storeu_ps(result[2], c2);
+    _mm_storeu_ps(result[3], c3);
+}
+
+void sseMultiplyMany(const Mat4* a, const Mat4* b, Mat4* result, size_t count) {
+    for (size_t n = 0; n < count; n++) {
+        sseMultiply(a[n].m, b[n].m, result[n].m);
+    }
+}
+
+// Columns of a stay in registers; each point is x * c0 + y * c1 + z * c2 + c3
+void sseTransformPoints(const float a[4][4], char* points, size_t stride, size_t count) {
+    __m128 c0 = _mm_set_ps(0.0f, a[2][0], a[1][0], a[0][0]);
+    __m128 c1 = _mm_set_ps(0.0f, a[2][1], a[1][1], a[0][1]);
+    __m128 c2 = _mm_set_ps(0.0f, a[2][2], a[1][2], a[0][2]);
+    __m128 c3 = _mm_set_ps(0.0f, a[2][3], a[1][3], a[0][3]);
+    for (size_t n = 0; n < count; n++, points += stride) {
+        float p[4];
+        memcpy(p, points, 3 * sizeof(float));
+        __m128 r = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])), c3);
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(p[1])));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(p[2])));
+        _mm_storeu_ps(p, r);
+        memcpy(points, p, 3 * sizeof(float));
+    }
+}
+
+// Two result rows per 256-bit register; each lane broadcasts its own row's a[i][k]
+SIMD_TARGET_AVX2 static inline __m256 avx2MultiplyRows(__m256 rows, __m256 b0, __m256 b1, __m256 b2, __m256 b3) {
+    __m256 r = _mm256_mul_ps(_mm256_permute_ps(rows, 0x00), b0);
+    r = _mm256_fmadd_ps(_mm256_permute_ps(rows, 0x55), b1, r);
+    r = _mm256_fmadd_ps(_mm256_permute_ps(rows, 0xAA), b2, r);
+    return _mm256_fmadd_ps(_mm256_permute_ps(rows, 0xFF), b3, r);
+}
+
+SIMD_TARGET_AVX2 void avx2Multiply(const float a[4][4], const float b[4][4], float result[4][4]) {
+    __m256 b0 = _mm256_broadcast_ps((const __m128*)b[0]);
+    __m256 b1 = _mm256_broadcast_ps((const __m128*)b[1]);
+    __m256 b2 = _mm256_broadcast_ps((const __m128*)b[2]);
+    __m256 b3 = _mm256_broadcast_ps((const __m128*)b[3]);
+    __m256 lo = avx2MultiplyRows(_mm256_loadu_ps(a[0]), b0, b1, b2, b3);
+    __m256 hi = avx2MultiplyRows(_mm256_loadu_ps(a[2]), b0, b1, b2, b3);
+    _mm256_storeu_ps(result[0], lo);
+    _mm256_storeu_ps(result[2], hi);
+}
+
+SIMD_TARGET_AVX2 void avx2MultiplyMany(const Mat4* a, const Mat4* b, Mat4* result, size_t count) {
+    for (size_t n = 0; n < count; n++) {
+        const float* bm = b[n].m[0];
+        __m256 b0 = _mm256_broadcast_ps((const __m128*)(bm + 0));
+        __m256 b1 = _mm256_broadcast_ps((const __m128*)(bm + 4));
+        __m256 b2 = _mm256_broadcast_ps((const __m128*)(bm + 8));
+        __m256 b3 = _mm256_broadcast_ps((const __m128*)(bm + 12));
+        __m256 lo = avx2MultiplyRows(_mm256_loadu_ps(a[n].m[0]), b0, b1, b2, b3);
+        __m256 hi = avx2MultiplyRows(_mm256_loadu_ps(a[n].m[2]), b0, b1, b2, b3);
+        _mm256_storeu_ps(result[n].m[0], lo);
+        _mm256_storeu_ps(result[n].m[2], hi);
+    }
+}
+
+bool cpuSupportsAVX2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || !fma) return false;
+    if ((_xgetbv(0) & 0x6) != 0x6) return false;  // OS saves XMM and YMM state
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+#endif // MATRIX_SIMD_X86
+
+
+const MatrixKernels scalarKernels = {
+    "scalar", scalarMultiply, scalarTranspose, scalarTransformPoint, scalarAffineInverse, scalarMultiplyMany,
+    scalarTransformPoints
+};
+
+#ifdef MATRIX_SIMD_X86
+const MatrixKernels sseKernels = {
+    "SSE", sseMultiply, sseTranspose, sseTransformPoint, sseAffineInverse, sseMultiplyMany,
+    sseTransformPoints
+};
+
+// AVX2 only pays off for the products; a 4x4 transpose, point transform or
+// affine inverse fits in four 128-bit registers, so those entries are the
+// SSE kernels on purpose.
+const MatrixKernels avx2Kernels = {
+    "AVX2", avx2Multiply, sseTranspose, sseTransformPoint, sseAffineInverse, avx2MultiplyMany,
+    sseTransformPoints
+};
+#endif
+
+const MatrixKernels* matrixKernels = &scalarKernels;
+
+void selectMatrixKernels() {
+#ifdef MATRIX_SIMD_X86
+    // SSE2 is part of the x86-64 baseline
+    matrixKernels = cpuSupportsAVX2() ? &avx2Kernels : &sseKernels;
+#else
+    matrixKernels = &scalarKernels;
+#endif
+}
+
+
+void matrixMultiply(float a[4][4], float b[4][4], float result[4][4]) {
+    matrixKernels->multiply(a, b, result);
+}
+
+
+void createShearMatrix(float xy, float xz, float yx, float yz, float zx, float zy, float matrix[4][4]) {
+    matrixIdentity(matrix);
+    
+    matrix[0][1] = xy;  
+    matrix[0][2] = xz;  
+
+    
+    matrix[1][0] = yx;  
+    matrix[1][2] = yz;  
+
+    
+    matrix[2][0] = zx;  
+    matrix[2][1] = zy;  
+}
+
+
+void createReflectionMatrix(bool x, bool y, bool z, float matrix[4][4]) {
+
+    matrixIdentity(matrix);
+    
+    matrix[0][0] = x ? -1.0f : 1.0f;  
+    matrix[1][1] = y ? -1.0f : 1.0f;  
+    matrix[2][2] = z ? -1.0f : 1.0f;  
+    matrix[3][3] = 1.0f;  
+
+}
+
+
+void createTranslationMatrix(float x, float y, float z, float matrix[4][4]) {
+
+    matrixIdentity(matrix);
+    matrix[0][3] = x;
+    matrix[1][3] = y;
+    matrix[2][3] = z;
+
+}
+
+void createScaleMatrix(float x, float y, float z, float matrix[4][4]) {
+
+    matrixIdentity(matrix);
+    matrix[0][0] = x;
+    matrix[1][1] = y;
+    matrix[2][2] = z;
+
+}
+
+void createRotationXMatrix(float angle, float matrix[4][4]) {
+
+    matrixIdentity(matrix);
+
+    float rad = angle * M_PI / 180.0f;
+    float cos_t = cos(rad);
+    float sin_t = sin(rad);
+    matrix[1][1] = cos_t;
+    matrix[1][2] = -sin_t;
+    matrix[2][1] = sin_t;
+    matrix[2][2] = cos_t;
+
+}
+
+void createRotationYMatrix(float angle, float matrix[4][4]) {
+
+    matrixIdentity(matrix);
+    float rad = angle * M_PI / 180.0f;
+    float cos_t = cos(rad);
+    float sin_t = sin(rad);
+    matrix[0][0] = cos_t;
+    matrix[0][2] = sin_t;
+    matrix[2][0] = -sin_t;
+    matrix[2][2] = cos_t;
+
+
+}
+
+void createRotationZMatrix(float angle, float matrix[4][4]) {
+
+    matrixIdentity(matrix);
+    float rad = angle * M_PI / 180.0f;
+    float cos_t = cos(rad);
+    float sin_t = sin(rad);
+    matrix[0][0] = cos_t;
+    matrix[0][1] = -sin_t;
+    matrix[1][0] = sin_t;
+    matrix[1][1] = cos_t;
+
+
+}
+
+
+// Reference composition: scale * shear * reflect * Rz * Ry * Rx * translate built
+// from the individual create*Matrix helpers. Kept as the reference that
+// GeometryTests checks the closed-form composers below against.
+void composeTransformChain(float result[4][4]) {
+    float translationMat[4][4], rotationXMat[4][4], rotationYMat[4][4],
+        rotationZMat[4][4], scaleMat[4][4], shearMat[4][4],
+        reflectionMat[4][4], tempMat[4][4];
+
+    
+    createTranslationMatrix(position[0], position[1], position[2], translationMat);
+    createRotationXMatrix(rotation[0], rotationXMat);
+    createRotationYMatrix(rotation[1], rotationYMat);
+    createRotationZMatrix(rotation[2], rotationZMat);
+    createScaleMatrix(scale[0], scale[1], scale[2], scaleMat);
+    createShearMatrix(shear[0], shear[1], shear[0], shear[2], shear[1], shear[2], shearMat);
+    createReflectionMatrix(reflection[0], reflection[1], reflection[2], reflectionMat);
+
+    
+    matrixIdentity(tempMat);
+    matrixMultiply(tempMat, scaleMat, tempMat);
+    
+    matrixMultiply(tempMat, shearMat, tempMat);
+
+    matrixMultiply(tempMat, reflectionMat, tempMat);
+    
+    matrixMultiply(tempMat, rotationZMat, tempMat);
+    matrixMultiply(tempMat, rotationYMat, tempMat);
+    matrixMultiply(tempMat, rotationXMat, tempMat);
+    
+    matrixMultiply(tempMat, translationMat, result);
+}
+
+// Closed-form Rz * Ry * Rx (angles in degrees) into the upper-left 3x3
+void composeRotation3(const float rot[3], float r[3][3]) {
+    float rx = rot[0] * M_PI / 180.0f;
+    float ry = rot[1] * M_PI / 180.0f;
+    float rz = rot[2] * M_PI / 180.0f;
+    float cx = cos(rx), sx = sin(rx);
+    float cy = cos(ry), sy = sin(ry);
+    float cz = cos(rz), sz = sin(rz);
+
+    r[0][0] = cz * cy;  r[0][1] = cz * sy * sx - sz * cx;  r[0][2] = cz * sy * cx + sz * sx;
+    r[1][0] = sz * cy;  r[1][1] = sz * sy * sx + cz * cx;  r[1][2] = sz * sy * cx - cz * sx;
+    r[2][0] = -sy;      r[2][1] = cy * sx;                 r[2][2] = cy * cx;
+}
+
+// Closed-form scale * shear * reflect into the upper-left 3x3.
+// Shear uses the same pairing as updateTransformMatrix always has:
+// xy = yx = shear[0], xz = zx = shear[1], yz = zy = shear[2].
+void composeScaleShearReflect3(const float scl[3], const float shr[3], const bool refl[3], float a[3][3]) {
+    float fx = refl[0] ? -1.0f : 1.0f;
+    float fy = refl[1] ? -1.0f : 1.0f;
+    float fz = refl[2] ? -1.0f : 1.0f;
+
+    a[0][0] = scl[0] * fx;           a[0][1] = scl[0] * shr[0] * fy;  a[0][2] = scl[0] * shr[1] * fz;
+    a[1][0] = scl[1] * shr[0] * fx;  a[1][1] = scl[1] * fy;           a[1][2] = scl[1] * shr[2] * fz;
+    a[2][0] = scl[2] * shr[1] * fx;  a[2][1] = scl[2] * shr[2] * fy;  a[2][2] = scl[2] * fz;
+}
+
+// Linear part = a * r, translation column = linear * pos
+void composeLinear(const float a[3][3], const float r[3][3], float matrix[4][4]) {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            matrix[i][j] = a[i][0] * r[0][j] + a[i][1] * r[1][j] + a[i][2] * r[2][j];
+        }
+    }
+    matrix[3][0] = matrix[3][1] = matrix[3][2] = 0.0f;
+    matrix[3][3] = 1.0f;
+}
+
+void composeTranslation(const float pos[3], float matrix[4][4]) {
+    for (int i = 0; i < 3; i++) {
+        matrix[i][3] = matrix[i][0] * pos[0] + matrix[i][1] * pos[1] + matrix[i][2] * pos[2];
+    }
+}
+
+// Single-shot closed-form equivalent of composeTransformChain for arbitrary parameters
+void composeTransformMatrix(const float pos[3], const float rot[3], const float scl[3],
+    const float shr[3], const bool refl[3], float matrix[4][4]) {
+    float a[3][3], r[3][3];
+    composeScaleShearReflect3(scl, shr, refl, a);
+    composeRotation3(rot, r);
+    composeLinear(a, r, matrix);
+    composeTranslation(pos, matrix);
+}
+
+// Quaternions are float[4] in (w, x, y, z) order
+void quaternionMultiply(const float a[4], const float b[4], float result[4]) {
+    float w = a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3];
+    float x = a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2];
+    float y = a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1];
+    float z = a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0];
+    result[0] = w;
+    result[1] = x;
+    result[2] = y;
+    result[3] = z;
+}
+
+void quaternionNormalize(float q[4]) {
+    float length = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    for (int k = 0; k < 4; k++) q[k] /= length;
+}
+
+// axis must be unit length
+void quaternionFromAxisAngle(const float axis[3], float degrees, float q[4]) {
+    float half = degrees * M_PI / 360.0f;
+    float s = sin(half);
+    q[0] = cos(half);
+    q[1] = axis[0] * s;
+    q[2] = axis[1] * s;
+    q[3] = axis[2] * s;
+}
+
+// Same rotation as composeRotation3: qz * qy * qx
+void quaternionFromEuler(const float rot[3], float q[4]) {
+    const float xAxis[3] = { 1, 0, 0 }, yAxis[3] = { 0, 1, 0 }, zAxis[3] = { 0, 0, 1 };
+    float qx[4], qy[4], qz[4], zy[4];
+    quaternionFromAxisAngle(xAxis, rot[0], qx);
+    quaternionFromAxisAngle(yAxis, rot[1], qy);
+    quaternionFromAxisAngle(zAxis, rot[2], qz);
+    quaternionMultiply(qz, qy, zy);
+    quaternionMultiply(zy, qx, q);
+}
+
+// Unit quaternion to rotation matrix, no trig
+void quaternionToRotation3(const float q[4], float r[3][3]) {
+    float w = q[0], x = q[1], y = q[2], z = q[3];
+    r[0][0] = 1 - 2 * (y * y + z * z);  r[0][1] = 2 * (x * y - w * z);      r[0][2] = 2 * (x * z + w * y);
+    r[1][0] = 2 * (x * y + w * z);      r[1][1] = 1 - 2 * (x * x + z * z);  r[1][2] = 2 * (y * z - w * x);
+    r[2][0] = 2 * (x * z - w * y);      r[2][1] = 2 * (y * z + w * x);      r[2][2] = 1 - 2 * (x * x + y * y);
+}
+
+// Inverse of composeRotation3, degrees. At +-90 degrees about Y the Z angle is taken as 0.
+void rotation3ToEuler(const float r[3][3], float rot[3]) {
+    float sy = std::min(1.0f, std::max(-1.0f, -r[2][0]));
+    rot[1] = asin(sy) * 180.0f / M_PI;
+    if (fabs(sy) < 0.99999f) {
+        rot[0] = atan2(r[2][1], r[2][2]) * 180.0f / M_PI;
+        rot[2] = atan2(r[1][0], r[0][0]) * 180.0f / M_PI;
+    }
+    else {
+        rot[0] = atan2(sy * r[0][1], r[1][1]) * 180.0f / M_PI;
+        rot[2] = 0.0f;
+    }
+}
+
+// Shortest-arc spherical interpolation between unit quaternions
+void quaternionSlerp(const float a[4], const float b[4], float t, float result[4]) {
+    float cosine = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+    float sign = 1.0f;
+    if (cosine < 0.0f) {
+        cosine = -cosine;
+        sign = -1.0f;
+    }
+    float wa, wb;
+    if (cosine > 0.9995f) {
+        // Nearly parallel: lerp, normalized below
+        wa = 1.0f - t;
+        wb = t;
+    }
+    else {
+        float angle = acos(cosine);
+        float inverseSine = 1.0f / sin(angle);
+        wa = sin((1.0f - t) * angle) * inverseSine;
+        wb = sin(t * angle) * inverseSine;
+    }
+    for (int k = 0; k < 4; k++) result[k] = wa * a[k] + sign * wb * b[k];
+    quaternionNormalize(result);
+}
+
+// composeTransformMatrix with the rotation given as a unit quaternion
+void composeTransformMatrixQuat(const float pos[3], const float orientation[4], const float scl[3],
+    const float shr[3], const bool refl[3], float matrix[4][4]) {
+    float a[3][3], r[3][3];
+    composeScaleShearReflect3(scl, shr, refl, a);
+    quaternionToRotation3(orientation, r);
+    composeLinear(a, r, matrix);
+    composeTranslation(pos, matrix);
+}
+
+unsigned int transformDirty = DIRTY_ALL;
+float cachedRotation3[3][3];
+float cachedScaleShearReflect3[3][3];
+
+void markTransformDirty(unsigned int bits) {
+    transformDirty |= bits;
+}
+
+// Rebuilds only the parts of transformMatrix whose inputs changed: a position
+// edit patches the translation column, rotation edits redo the trig, and
+// scale/shear/reflection edits redo the 3x3 in front of the rotation.
+void updateTransformMatrix() {
+    if (transformDirty == 0) return;
+
+    bool linearDirty = false;
+    if (transformDirty & DIRTY_ROTATION) {
+        composeRotation3(rotation, cachedRotation3);
+        linearDirty = true;
+    }
+    if (transformDirty & (DIRTY_SCALE | DIRTY_SHEAR | DIRTY_REFLECTION)) {
+        composeScaleShearReflect3(scale, shear, reflection, cachedScaleShearReflect3);
+        linearDirty = true;
+    }
+    if (linearDirty) {
+        composeLinear(cachedScaleShearReflect3, cachedRotation3, transformMatrix);
+    }
+    composeTranslation(position, transformMatrix);
+    transformDirty = 0;
+}
+
+
+const MeshVertex* meshVertexData(const Mesh& mesh) {
+    return mesh.mappedVertices ? mesh.mappedVertices : mesh.vertices.data();
+}
+
+size_t meshVertexCount(const Mesh& mesh) {
+    return mesh.mappedVertices ? mesh.mappedVertexCount : mesh.vertices.size();
+}
+
+const unsigned int* meshIndexData(const Mesh& mesh) {
+    return mesh.mappedIndices ? mesh.mappedIndices : mesh.indices.data();
+}
+
+size_t meshIndexCount(const Mesh& mesh) {
+    return mesh.mappedIndices ? mesh.mappedIndexCount : mesh.indices.size();
+}
+
+unsigned int addMeshVertex(Mesh& mesh, float x, float y, float z,
+    float nx, float ny, float nz, float r, float g, float b) {
+    MeshVertex v = { { x, y, z }, { nx, ny, nz }, { r, g, b } };
+    mesh.vertices.push_back(v);
+    return (unsigned int)(mesh.vertices.size() - 1);
+}
+
+void addMeshTriangle(Mesh& mesh, unsigned int a, unsigned int b, unsigned int c) {
+    mesh.indices.push_back(a);
+    mesh.indices.push_back(b);
+    mesh.indices.push_back(c);
+}
+
+// Flat-shaded quad with the same winding as GL_QUADS
+void addMeshQuad(Mesh& mesh, const float corners[4][3], const float normal[3], const float color[3]) {
+    unsigned int base = (unsigned int)mesh.vertices.size();
+    for (int i = 0; i < 4; i++) {
+        addMeshVertex(mesh, corners[i][0], corners[i][1], corners[i][2],
+            normal[0], normal[1], normal[2], color[0], color[1], color[2]);
+    }
+    addMeshTriangle(mesh, base, base + 1, base + 2);
+    addMeshTriangle(mesh, base, base + 2, base + 3);
+}
+
+void buildCubeMesh(Mesh& mesh) {
+    const float faces[6][4][3] = {
+        { {-0.5f, -0.5f, 0.5f}, {0.5f, -0.5f, 0.5f}, {0.5f, 0.5f, 0.5f}, {-0.5f, 0.5f, 0.5f} },      // Front
+        { {-0.5f, -0.5f, -0.5f}, {-0.5f, 0.5f, -0.5f}, {0.5f, 0.5f, -0.5f}, {0.5f, -0.5f, -0.5f} },  // Back
+        { {-0.5f, 0.5f, -0.5f}, {-0.5f, 0.5f, 0.5f}, {0.5f, 0.5f, 0.5f}, {0.5f, 0.5f, -0.5f} },      // Top
+        { {-0.5f, -0.5f, -0.5f}, {0.5f, -0.5f, -0.5f}, {0.5f, -0.5f, 0.5f}, {-0.5f, -0.5f, 0.5f} },  // Bottom
+        { {0.5f, -0.5f, -0.5f}, {0.5f, 0.5f, -0.5f}, {0.5f, 0.5f, 0.5f}, {0.5f, -0.5f, 0.5f} },      // Right
+        { {-0.5f, -0.5f, -0.5f}, {-0.5f, -0.5f, 0.5f}, {-0.5f, 0.5f, 0.5f}, {-0.5f, 0.5f, -0.5f} }   // Left
+    };
+    const float normals[6][3] = {
+        {0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, -1.0f}, {0.0f, 1.0f, 0.0f},
+        {0.0f, -1.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, {-1.0f, 0.0f, 0.0f}
+    };
+    const float colors[6][3] = {
+        {1.0f, 0.0f, 0.0f},  // Red
+        {0.0f, 1.0f, 0.0f},  // Green
+        {0.0f, 0.0f, 1.0f},  // Blue
+        {1.0f, 1.0f, 0.0f},  // Yellow
+        {1.0f, 0.0f, 1.0f},  // Purple
+        {0.0f, 1.0f, 1.0f}   // Cyan
+    };
+
+    for (int f = 0; f < 6; f++) {
+        addMeshQuad(mesh, faces[f], normals[f], colors[f]);
+    }
+}
+
+void buildSphereMesh(Mesh& mesh, int stacks, int slices) {
+    const float radius = 0.5f;
+
+    // (stacks + 1) x (slices + 1) grid of shared vertices
+    for (int i = 0; i <= stacks; i++) {
+        float phi = M_PI * float(i) / stacks;
+        float sinPhi = sin(phi);
+        float cosPhi = cos(phi);
+        for (int j = 0; j <= slices; j++) {
+            float theta = 2.0f * M_PI * float(j) / slices;
+            float nx = sinPhi * cos(theta);
+            float ny = cosPhi;
+            float nz = sinPhi * sin(theta);
+            addMeshVertex(mesh, radius * nx, radius * ny, radius * nz, nx, ny, nz, 1.0f, 0.0f, 0.0f);
+        }
+    }
+
+    // Same triangles the per-stack GL_TRIANGLE_STRIP produced
+    for (int i = 0; i < stacks; i++) {
+        for (int j = 0; j < slices; j++) {
+            unsigned int top = i * (slices + 1) + j;
+            unsigned int bottom = top + slices + 1;
+            addMeshTriangle(mesh, top, bottom, top + 1);
+            addMeshTriangle(mesh, top + 1, bottom, bottom + 1);
+        }
+    }
+}
+
+void buildPyramidMesh(Mesh& mesh) {
+    const float apex[3] = { 0.0f, 0.5f, 0.0f };
+    const float base[4][3] = {
+        {-0.5f, -0.5f, 0.5f}, {0.5f, -0.5f, 0.5f}, {0.5f, -0.5f, -0.5f}, {-0.5f, -0.5f, -0.5f}
+    };
+    // Front, right, back, left; normals kept as drawn before (unnormalized)
+    const float normals[4][3] = {
+        {0.0f, 0.5f, 0.5f}, {0.5f, 0.5f, 0.0f}, {0.0f, 0.5f, -0.5f}, {-0.5f, 0.5f, 0.0f}
+    };
+    const float colors[4][3] = {
+        {1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {1.0f, 1.0f, 0.0f}
+    };
+
+    for (int f = 0; f < 4; f++) {
+        const float* a = base[f];
+        const float* b = base[(f + 1) % 4];
+        const float* n = normals[f];
+        const float* c = colors[f];
+        unsigned int i0 = addMeshVertex(mesh, apex[0], apex[1], apex[2], n[0], n[1], n[2], c[0], c[1], c[2]);
+        unsigned int i1 = addMeshVertex(mesh, a[0], a[1], a[2], n[0], n[1], n[2], c[0], c[1], c[2]);
+        unsigned int i2 = addMeshVertex(mesh, b[0], b[1], b[2], n[0], n[1], n[2], c[0], c[1], c[2]);
+        addMeshTriangle(mesh, i0, i1, i2);
+    }
+
+    // Bottom
+    const float bottom[4][3] = {
+        {-0.5f, -0.5f, 0.5f}, {-0.5f, -0.5f, -0.5f}, {0.5f, -0.5f, -0.5f}, {0.5f, -0.5f, 0.5f}
+    };
+    const float bottomNormal[3] = { 0.0f, -1.0f, 0.0f };
+    const float bottomColor[3] = { 1.0f, 0.0f, 1.0f };
+    addMeshQuad(mesh, bottom, bottomNormal, bottomColor);
+}
+
+void buildCylinderMesh(Mesh& mesh, int segments) {
+    const float radius = 0.5f;
+    const float height = 1.0f;
+
+    // Sides: top/bottom vertex pair per segment edge
+    unsigned int sideBase = (unsigned int)mesh.vertices.size();
+    for (int i = 0; i <= segments; i++) {
+        float theta = 2.0f * M_PI * float(i) / segments;
+        float c = cos(theta);
+        float s = sin(theta);
+        addMeshVertex(mesh, radius * c, height / 2, radius * s, c, 0.0f, s, 0.0f, 0.0f, 1.0f);
+        addMeshVertex(mesh, radius * c, -height / 2, radius * s, c, 0.0f, s, 0.0f, 0.0f, 1.0f);
+    }
+    for (int i = 0; i < segments; i++) {
+        unsigned int top = sideBase + 2 * i;
+        addMeshTriangle(mesh, top, top + 1, top + 3);
+        addMeshTriangle(mesh, top, top + 3, top + 2);
+    }
+
+    // Top and bottom caps as triangle fans
+    for (int side = 0; side < 2; side++) {
+        float y = (side == 0) ? height / 2 : -height / 2;
+        float normalY = (side == 0) ? 1.0f : -1.0f;
+        float direction = (side == 0) ? -1.0f : 1.0f;
+
+        unsigned int center = addMeshVertex(mesh, 0.0f, y, 0.0f, 0.0f, normalY, 0.0f, 0.0f, 1.0f, 0.0f);
+        for (int i = 0; i <= segments; i++) {
+            float theta = direction * 2.0f * M_PI * float(i) / segments;
+            addMeshVertex(mesh, radius * cos(theta), y, radius * sin(theta), 0.0f, normalY, 0.0f, 0.0f, 1.0f, 0.0f);
+        }
+        for (int i = 0; i < segments; i++) {
+            addMeshTriangle(mesh, center, center + 1 + i, center + 2 + i);
+        }
+    }
+}
+
+
+InstanceSet instances;
+double instanceComposeMs = 0.0;
+
+float randomRange(float lo, float hi) {
+    return lo + (hi - lo) * (float(rand()) / float(RAND_MAX));
+}
+
+void spawnInstances(size_t count) {
+    instances = InstanceSet();
+    instances.count = count;
+    for (int k = 0; k < 3; k++) {
+        instances.position[k].resize(count);
+        instances.rotation[k].resize(count);
+        instances.scale[k].resize(count);
+        instances.shear[k].resize(count);
+    }
+    for (int k = 0; k < 4; k++) {
+        instances.spinPre[k].resize(count);
+        instances.spinPost[k].resize(count);
+    }
+    instances.reflection.resize(count);
+    instances.spin.resize(count);
+    instances.matrices.resize(count * 16);
+
+    // Spread instances through a cube whose volume grows with the count
+    float extent = 0.75f * cbrt(float(count));
+    srand(1);
+    for (int shape = 0; shape < builtinShapeCount; shape++) {
+        instances.shapeStart[shape] = count * shape / builtinShapeCount;
+        instances.shapeCount[shape] = count * (shape + 1) / builtinShapeCount - instances.shapeStart[shape];
+    }
+    for (size_t i = 0; i < count; i++) {
+        for (int k = 0; k < 3; k++) {
+            instances.position[k][i] = randomRange(-extent, extent);
+            instances.rotation[k][i] = randomRange(0.0f, 360.0f);
+            instances.scale[k][i] = randomRange(0.3f, 0.6f);
+            instances.shear[k][i] = randomRange(-0.2f, 0.2f);
+        }
+        instances.reflection[i] = (unsigned char)(rand() & 7);
+        instances.spin[i] = randomRange(-90.0f, 90.0f);
+
+        const float xAxis[3] = { 1, 0, 0 }, yAxis[3] = { 0, 1, 0 }, zAxis[3] = { 0, 0, 1 };
+        float qx[4], qy[4], qz[4], pre[4];
+        quaternionFromAxisAngle(xAxis, instances.rotation[0][i], qx);
+        quaternionFromAxisAngle(yAxis, instances.rotation[1][i], qy);
+        quaternionFromAxisAngle(zAxis, instances.rotation[2][i], qz);
+        quaternionMultiply(qz, qy, pre);
+        for (int k = 0; k < 4; k++) {
+            instances.spinPre[k][i] = pre[k];
+            instances.spinPost[k][i] = qx[k];
+        }
+    }
+}
+
+// Spinning around Y between the Y and X Euler rotations only needs one
+// sin/cos per instance when the fixed parts are kept as quaternions
+void composeInstanceMatrices(float seconds) {
+    auto start = std::chrono::steady_clock::now();
+    const float yAxis[3] = { 0, 1, 0 };
+
+    for (size_t i = 0; i < instances.count; i++) {
+        float pos[3] = { instances.position[0][i], instances.position[1][i], instances.position[2][i] };
+        float pre[4] = { instances.spinPre[0][i], instances.spinPre[1][i], instances.spinPre[2][i], instances.spinPre[3][i] };
+        float post[4] = { instances.spinPost[0][i], instances.spinPost[1][i], instances.spinPost[2][i], instances.spinPost[3][i] };
+        float spin[4], spun[4], orientation[4];
+        quaternionFromAxisAngle(yAxis, instances.spin[i] * seconds, spin);
+        quaternionMultiply(pre, spin, spun);
+        quaternionMultiply(spun, post, orientation);
+        float scl[3] = { instances.scale[0][i], instances.scale[1][i], instances.scale[2][i] };
+        float shr[3] = { instances.shear[0][i], instances.shear[1][i], instances.shear[2][i] };
+        unsigned char bits = instances.reflection[i];
+        bool refl[3] = { (bits & 1) != 0, (bits & 2) != 0, (bits & 4) != 0 };
+
+        float m[4][4];
+        composeTransformMatrixQuat(pos, orientation, scl, shr, refl, m);
+
+        // Write column-major so the buffer can feed glVertexAttribPointer directly
+        matrixKernels->transpose(m, (float(*)[4])&instances.matrices[i * 16]);
+    }
+
+    instanceComposeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+// Transform math, shape tessellation and instance composition shared by the
+// viewer and the Benchmarks program. Nothing here touches GL or GLUT.
+#include <vector>
+#include <stddef.h>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define MATRIX_SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SIMD_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Shape selection
+enum Shape { CUBE, SPHERE, PYRAMID, CYLINDER, IMPORTED };
+const int builtinShapeCount = 4;  // Instances and the demo scene only use these
+const int shapeTypeCount = 5;     // IMPORTED is the mesh loaded with --mesh
+
+
+// Global transformation matrix using 2D array
+extern float transformMatrix[4][4];
+
+// Global position, rotation, scale variables
+extern float position[3];
+extern float rotation[3];
+extern float scale[3];
+extern float shear[3];
+extern bool reflection[3];  // For x, y, z planes
+
+// 16-byte aligned row-major 4x4 matrix, same layout as transformMatrix
+struct alignas(16) Mat4 {
+    float m[4][4];
+};
+
+// Matrix kernels, selected once at startup by selectMatrixKernels().
+// All kernels take row-major matrices and allow result to alias an input.
+struct MatrixKernels {
+    const char* name;
+    void (*multiply)(const float a[4][4], const float b[4][4], float result[4][4]);
+    void (*transpose)(const float a[4][4], float result[4][4]);
+    void (*transformPoint)(const float a[4][4], const float p[3], float result[3]);
+    void (*affineInverse)(const float a[4][4], float result[4][4]);
+    // result[i] = a[i] * b[i] for i in [0, count)
+    void (*multiplyMany)(const Mat4* a, const Mat4* b, Mat4* result, size_t count);
+    // Transforms count (x, y, z) float triples in place, each starting stride
+    // bytes after the previous one so records may carry other fields
+    void (*transformPoints)(const float a[4][4], char* points, size_t stride, size_t count);
+};
+
+extern const MatrixKernels* matrixKernels;
+void selectMatrixKernels();
+
+void matrixIdentity(float matrix[4][4]);
+void matrixMultiply(float a[4][4], float b[4][4], float result[4][4]);
+void createShearMatrix(float xy, float xz, float yx, float yz, float zx, float zy, float matrix[4][4]);
+void createReflectionMatrix(bool x, bool y, bool z, float matrix[4][4]);
+void createTranslationMatrix(float x, float y, float z, float matrix[4][4]);
+void createScaleMatrix(float x, float y, float z, float matrix[4][4]);
+void createRotationXMatrix(float angle, float matrix[4][4]);
+void createRotationYMatrix(float angle, float matrix[4][4]);
+void createRotationZMatrix(float angle, float matrix[4][4]);
+
+// Transform composition. composeTransformChain is the matrix-by-matrix
+// reference for the global parameters; the rest are the closed forms.
+void composeTransformChain(float result[4][4]);
+void composeRotation3(const float rot[3], float r[3][3]);
+void composeScaleShearReflect3(const float scl[3], const float shr[3], const bool refl[3], float a[3][3]);
+void composeLinear(const float a[3][3], const float r[3][3], float matrix[4][4]);
+void composeTranslation(const float pos[3], float matrix[4][4]);
+void composeTransformMatrix(const float pos[3], const float rot[3], const float scl[3],
+    const float shr[3], const bool refl[3], float matrix[4][4]);
+void composeTransformMatrixQuat(const float pos[3], const float orientation[4], const float scl[3],
+    const float shr[3], const bool refl[3], float matrix[4][4]);
+
+// Quaternions are float[4] in (w, x, y, z) order
+void quaternionMultiply(const float a[4], const float b[4], float result[4]);
+void quaternionNormalize(float q[4]);
+void quaternionFromAxisAngle(const float axis[3], float degrees, float q[4]);
+void quaternionFromEuler(const float rot[3], float q[4]);
+void quaternionToRotation3(const float q[4], float r[3][3]);
+void rotation3ToEuler(const float r[3][3], float rot[3]);
+void quaternionSlerp(const float a[4], const float b[4], float t, float result[4]);
+
+// Per-component dirty flags for the global transform parameters
+enum TransformDirtyBits {
+    DIRTY_POSITION = 1 << 0,
+    DIRTY_ROTATION = 1 << 1,
+    DIRTY_SCALE = 1 << 2,
+    DIRTY_SHEAR = 1 << 3,
+    DIRTY_REFLECTION = 1 << 4,
+    DIRTY_ALL = DIRTY_POSITION | DIRTY_ROTATION | DIRTY_SCALE | DIRTY_SHEAR | DIRTY_REFLECTION
+};
+
+extern unsigned int transformDirty;
+extern float cachedRotation3[3][3];           // Rz * Ry * Rx
+extern float cachedScaleShearReflect3[3][3];  // scale * shear * reflect
+
+void markTransformDirty(unsigned int bits);
+void updateTransformMatrix();
+
+
+// Interleaved vertex layout shared by every cached shape
+struct MeshVertex {
+    float position[3];
+    float normal[3];
+    float color[3];
+};
+
+// Indexed triangle mesh, tessellated once and uploaded to buffer objects on
+// first draw. Falls back to client-side arrays without buffer object support.
+struct Mesh {
+    std::vector<MeshVertex> vertices;
+    std::vector<unsigned int> indices;
+    unsigned int vertexBuffer = 0;  // GL names, set by the viewer
+    unsigned int indexBuffer = 0;
+    unsigned int vertexArray = 0;   // Core pipeline only, created on first draw
+    bool built = false;
+    bool uploaded = false;
+    // Set instead of the vectors when the arrays live in a mapped mesh cache
+    const MeshVertex* mappedVertices = NULL;
+    const unsigned int* mappedIndices = NULL;
+    size_t mappedVertexCount = 0;
+    size_t mappedIndexCount = 0;
+};
+
+const MeshVertex* meshVertexData(const Mesh& mesh);
+size_t meshVertexCount(const Mesh& mesh);
+const unsigned int* meshIndexData(const Mesh& mesh);
+size_t meshIndexCount(const Mesh& mesh);
+
+unsigned int addMeshVertex(Mesh& mesh, float x, float y, float z,
+    float nx, float ny, float nz, float r, float g, float b);
+void addMeshTriangle(Mesh& mesh, unsigned int a, unsigned int b, unsigned int c);
+void addMeshQuad(Mesh& mesh, const float corners[4][3], const float normal[3], const float color[3]);
+void buildCubeMesh(Mesh& mesh);
+void buildSphereMesh(Mesh& mesh, int stacks, int slices);
+void buildPyramidMesh(Mesh& mesh);
+void buildCylinderMesh(Mesh& mesh, int segments);
+
+
+// Instanced scene mode: many independently transformed shapes, stored as
+// structure-of-arrays transform parameters and composed in bulk every frame.
+struct InstanceSet {
+    size_t count = 0;
+    std::vector<float> position[3];
+    std::vector<float> rotation[3];
+    std::vector<float> scale[3];
+    std::vector<float> shear[3];
+    std::vector<unsigned char> reflection;  // Bit i set = reflect axis i
+    std::vector<float> spin;                // Degrees per second around Y
+    // Rotation as quaternions around the spin: Rz * Ry * Rspin * Rx
+    std::vector<float> spinPre[4];          // qz * qy
+    std::vector<float> spinPost[4];         // qx
+    size_t shapeStart[builtinShapeCount] = { 0, 0, 0, 0 };  // Instances are grouped by Shape
+    size_t shapeCount[builtinShapeCount] = { 0, 0, 0, 0 };
+    std::vector<float> matrices;            // 16 floats per instance, column-major
+};
+
+extern InstanceSet instances;
+extern double instanceComposeMs;
+
+float randomRange(float lo, float hi);
+void spawnInstances(size_t count);
+void composeInstanceMatrices(float seconds);
@@ -0,0 +1,214 @@
+// Microbenchmarks for the math and tessellation code. Built without GL or
+// GLUT against Geometry.cpp, so they run on a machine without a display or
+// GPU, and with COUNT_ALLOCATIONS so each result carries allocations per op.
+// Results are JSON so runs can be diffed between commits.
+//
+// Usage: Benchmarks [FILE]   (JSON goes to stdout without FILE)
+#include "Geometry.h"
+#include "AllocationCounter.h"
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+
+struct BenchResult {
+    std::string name;
+    size_t iterations;
+    double nsPerOp;
+    double itemsPerOp;       // Work items per op, e.g. triangles for tessellation
+    const char* itemName;
+    double allocationsPerOp;
+    double bytesPerOp;
+};
+
+volatile float benchSink;  // Keeps results observable so the optimizer can't drop the work
+
+// Calibrates the iteration count to ~20 ms, then keeps the fastest of five runs
+template <typename Fn>
+BenchResult runBenchmark(const char* name, double itemsPerOp, const char* itemName, Fn fn) {
+    typedef std::chrono::steady_clock Clock;
+    size_t iterations = 1;
+    for (;;) {
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < iterations; i++) fn();
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        if (ms > 20.0 || iterations >= ((size_t)1 << 30)) break;
+        iterations *= ms < 2.0 ? 10 : 2;
+    }
+
+    double bestNs = 1e300;
+    size_t allocations = 0, bytes = 0;
+    for (int run = 0; run < 5; run++) {
+        size_t allocationsBefore = heapAllocationCount();
+        size_t bytesBefore = heapAllocationBytes();
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < iterations; i++) fn();
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        bestNs = std::min(bestNs, ns);
+        allocations = heapAllocationCount() - allocationsBefore;
+        bytes = heapAllocationBytes() - bytesBefore;
+    }
+
+    BenchResult result = { name, iterations, bestNs / iterations, itemsPerOp, itemName,
+        (double)allocations / iterations, (double)bytes / iterations };
+    return result;
+}
+
+std::vector<BenchResult> runMatrixBenchmarks() {
+    std::vector<BenchResult> results;
+    float a[4][4], b[4][4], m[4][4];
+    float angle = 0.0f;
+    createRotationXMatrix(30.0f, a);
+    createRotationYMatrix(40.0f, b);
+
+    results.push_back(runBenchmark("matrixMultiply", 1, "matrices", [&]() {
+        matrixMultiply(a, b, m);
+        a[3][0] = m[0][0];  // Chain ops so the multiply isn't hoisted
+    }));
+    results.push_back(runBenchmark("createTranslationMatrix", 1, "matrices", [&]() {
+        createTranslationMatrix(angle, 2.0f, 3.0f, m);
+        angle += m[0][3] * 1e-9f;
+    }));
+    results.push_back(runBenchmark("createScaleMatrix", 1, "matrices", [&]() {
+        createScaleMatrix(angle, 2.0f, 3.0f, m);
+        angle += m[0][0] * 1e-9f;
+    }));
+    results.push_back(runBenchmark("createRotationXMatrix", 1, "matrices", [&]() {
+        createRotationXMatrix(angle, m);
+        angle += m[1][1] * 1e-9f;
+    }));
+    results.push_back(runBenchmark("createRotationYMatrix", 1, "matrices", [&]() {
+        createRotationYMatrix(angle, m);
+        angle += m[0][0] * 1e-9f;
+    }));
+    results.push_back(runBenchmark("createRotationZMatrix", 1, "matrices", [&]() {
+        createRotationZMatrix(angle, m);
+        angle += m[0][0] * 1e-9f;
+    }));
+    results.push_back(runBenchmark("createShearMatrix", 1, "matrices", [&]() {
+        createShearMatrix(angle, 0.1f, 0.2f, 0.3f, 0.4f, 0.5f, m);
+        angle += m[0][1] * 1e-9f;
+    }));
+    results.push_back(runBenchmark("createReflectionMatrix", 1, "matrices", [&]() {
+        createReflectionMatrix(angle > 0.0f, true, false, m);
+        angle += m[0][0] * 1e-9f;
+    }));
+    results.push_back(runBenchmark("composeTransformChain", 1, "matrices", [&]() {
+        rotation[0] += 0.001f;
+        composeTransformChain(m);
+    }));
+    results.push_back(runBenchmark("composeTransformMatrix/euler", 1, "matrices", [&]() {
+        float rot[3] = { angle, 40.0f, 50.0f };
+        composeTransformMatrix(position, rot, scale, shear, reflection, m);
+        angle += m[0][0] * 1e-9f;
+    }));
+    results.push_back(runBenchmark("composeTransformMatrix/quaternion", 1, "matrices", [&]() {
+        float q[4] = { 1.0f, angle, 0.2f, 0.3f };
+        quaternionNormalize(q);
+        composeTransformMatrixQuat(position, q, scale, shear, reflection, m);
+        angle += m[0][0] * 1e-9f;
+    }));
+    spawnInstances(10000);
+    results.push_back(runBenchmark("composeInstanceMatrices/10k", 10000, "matrices", [&]() {
+        composeInstanceMatrices(angle);
+        angle += instances.matrices[0] * 1e-9f;
+    }));
+    spawnInstances(0);
+    {
+        // Packed xyz records, the layout of raw point files
+        std::vector<float> cloud(3 * 65536, 1.0f);
+        results.push_back(runBenchmark("transformPoints/64k", 65536, "points", [&]() {
+            matrixKernels->transformPoints(a, (char*)cloud.data(), 3 * sizeof(float), 65536);
+            benchSink = cloud.back();
+        }));
+    }
+    results.push_back(runBenchmark("updateTransformMatrix/all", 1, "matrices", [&]() {
+        rotation[0] += 0.001f;
+        markTransformDirty(DIRTY_ALL);
+        updateTransformMatrix();
+    }));
+    results.push_back(runBenchmark("updateTransformMatrix/position", 1, "matrices", [&]() {
+        position[0] += 0.001f;
+        markTransformDirty(DIRTY_POSITION);
+        updateTransformMatrix();
+    }));
+    benchSink = m[0][0] + a[3][0] + angle + transformMatrix[0][0];
+    return results;
+}
+
+std::vector<BenchResult> runTessellationBenchmarks() {
+    std::vector<BenchResult> results;
+    const int sphereSizes[][2] = { { 6, 8 }, { 10, 14 }, { 20, 20 }, { 40, 48 }, { 128, 256 } };
+    const int cylinderSizes[] = { 8, 16, 30, 64, 512 };
+    char name[64];
+
+    for (const int* size : sphereSizes) {
+        int stacks = size[0], slices = size[1];
+        snprintf(name, sizeof(name), "buildSphereMesh/%dx%d", stacks, slices);
+        results.push_back(runBenchmark(name, 2.0 * stacks * slices, "triangles", [&]() {
+            Mesh mesh;
+            buildSphereMesh(mesh, stacks, slices);
+            benchSink = mesh.vertices.back().position[0];
+        }));
+    }
+    for (int segments : cylinderSizes) {
+        Mesh probe;
+        buildCylinderMesh(probe, segments);
+        snprintf(name, sizeof(name), "buildCylinderMesh/%d", segments);
+        results.push_back(runBenchmark(name, probe.indices.size() / 3.0, "triangles", [&]() {
+            Mesh mesh;
+            buildCylinderMesh(mesh, segments);
+            benchSink = mesh.vertices.back().position[0];
+        }));
+    }
+    return results;
+}
+
+void writeBenchJson(FILE* out, const std::vector<BenchResult>& results) {
+    fprintf(out, "{\n  \"kernels\": \"%s\",\n  \"benchmarks\": [\n", matrixKernels->name);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        double itemsPerSecond = r.itemsPerOp * 1e9 / r.nsPerOp;
+        fprintf(out, "    { \"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.3f, "
+            "\"ops_per_sec\": %.1f, \"%s_per_sec\": %.1f, \"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f }%s\n",
+            r.name.c_str(), r.iterations, r.nsPerOp, 1e9 / r.nsPerOp, r.itemName, itemsPerSecond,
+            r.allocationsPerOp, r.bytesPerOp, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+// Writes to path, or stdout when path is NULL. Returns the process exit code.
+int runBenchmarks(const char* path) {
+    std::vector<BenchResult> results = runMatrixBenchmarks();
+    std::vector<BenchResult> tessellation = runTessellationBenchmarks();
+    results.insert(results.end(), tessellation.begin(), tessellation.end());
+
+    FILE* out = path ? fopen(path, "w") : stdout;
+    if (!out) {
+        std::cerr << "Cannot open benchmark output " << path << std::endl;
+        return 1;
+    }
+    writeBenchJson(out, results);
+    if (path) fclose(out);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    selectMatrixKernels();
+
+    // Options start with --; the first other argument is the output path
+    const char* path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0 || path) {
+            std::cerr << "Unknown argument: " << argv[i] << std::endl;
+            std::cerr << "Usage: " << argv[0] << " [FILE]   (JSON benchmark results, stdout without FILE)" << std::endl;
+            return 1;
+        }
+        path = argv[i];
+    }
+    return runBenchmarks(path);
+}
@@ -0,0 +1,110 @@
+// Checks the closed-form transform composers in Geometry.cpp against
+// composeTransformChain, the matrix-by-matrix reference, over random
+// parameters. Built without GL or GLUT; exits non-zero on any mismatch.
+//
+// Usage: GeometryTests [TRIALS]   (default 2000)
+#include "Geometry.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+int failures = 0;
+const int maxReportedFailures = 10;
+
+// Same tolerance the old per-update debug check used
+bool matricesMatch(const float actual[4][4], const float reference[4][4], const char* what, int trial) {
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            float tolerance = 1e-4f * (1.0f + fabs(reference[i][j]));
+            if (fabs(reference[i][j] - actual[i][j]) > tolerance) {
+                if (failures < maxReportedFailures) {
+                    std::cerr << what << " mismatch in trial " << trial << " at [" << i << "][" << j << "]: "
+                        << actual[i][j] << " vs " << reference[i][j] << std::endl;
+                }
+                failures++;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Replaces the global parameters selected by bits with random values
+void randomizeParameters(unsigned int bits) {
+    for (int k = 0; k < 3; k++) {
+        if (bits & DIRTY_POSITION) position[k] = randomRange(-10.0f, 10.0f);
+        if (bits & DIRTY_ROTATION) rotation[k] = randomRange(-360.0f, 360.0f);
+        if (bits & DIRTY_SCALE) scale[k] = randomRange(-3.0f, 3.0f);
+        if (bits & DIRTY_SHEAR) shear[k] = randomRange(-1.0f, 1.0f);
+        if (bits & DIRTY_REFLECTION) reflection[k] = (rand() & 1) != 0;
+    }
+}
+
+void testComposeTransformMatrix(int trial) {
+    float reference[4][4], matrix[4][4];
+    randomizeParameters(DIRTY_ALL);
+    composeTransformChain(reference);
+    composeTransformMatrix(position, rotation, scale, shear, reflection, matrix);
+    matricesMatch(matrix, reference, "composeTransformMatrix", trial);
+}
+
+// From a consistent transformMatrix, edits exactly the parameters of each of
+// the 32 dirty-bit combinations and lets updateTransformMatrix patch it
+void testUpdateTransformMatrix(int trial) {
+    float reference[4][4];
+    randomizeParameters(DIRTY_ALL);
+    markTransformDirty(DIRTY_ALL);
+    updateTransformMatrix();
+    for (unsigned int bits = 0; bits <= DIRTY_ALL; bits++) {
+        randomizeParameters(bits);
+        markTransformDirty(bits);
+        updateTransformMatrix();
+        composeTransformChain(reference);
+        char what[64];
+        snprintf(what, sizeof(what), "updateTransformMatrix(dirty 0x%02x)", bits);
+        matricesMatch(transformMatrix, reference, what, trial);
+    }
+}
+
+// The quaternion composer is checked two ways: from Euler angles through
+// quaternionFromEuler, and from an arbitrary unit quaternion through the
+// Euler angles rotation3ToEuler recovers for it
+void testComposeTransformMatrixQuat(int trial) {
+    float reference[4][4], matrix[4][4];
+    randomizeParameters(DIRTY_ALL);
+    float q[4];
+    quaternionFromEuler(rotation, q);
+    composeTransformChain(reference);
+    composeTransformMatrixQuat(position, q, scale, shear, reflection, matrix);
+    matricesMatch(matrix, reference, "composeTransformMatrixQuat(euler)", trial);
+
+    float r[3][3];
+    for (int k = 0; k < 4; k++) q[k] = randomRange(-1.0f, 1.0f);
+    quaternionNormalize(q);
+    quaternionToRotation3(q, r);
+    rotation3ToEuler(r, rotation);
+    composeTransformChain(reference);
+    composeTransformMatrixQuat(position, q, scale, shear, reflection, matrix);
+    matricesMatch(matrix, reference, "composeTransformMatrixQuat(random)", trial);
+}
+
+int main(int argc, char** argv) {
+    selectMatrixKernels();
+    int trials = argc > 1 ? atoi(argv[1]) : 2000;
+    if (trials <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [TRIALS]" << std::endl;
+        return 1;
+    }
+
+    srand(1);
+    for (int trial = 0; trial < trials; trial++) {
+        testComposeTransformMatrix(trial);
+        testUpdateTransformMatrix(trial);
+        testComposeTransformMatrixQuat(trial);
+    }
+
+    printf("%d trials, %s kernels: %d mismatches\n", trials, matrixKernels->name, failures);
+    return failures ? 1 : 0;
+}